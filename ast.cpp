@@ -2,10 +2,11 @@
 #include "values.h"
 #include "env.h"
 #include "type.h"
+#include "native.h"
 
 namespace basil {
 	ASTNode::ASTNode(SourceLocation loc):
-		_loc(loc), _type(nullptr) {}
+		_loc(loc), _type(nullptr), _effects(-1), _shape(0) {}
 
 	ASTNode::~ASTNode() {}
 
@@ -18,6 +19,171 @@ namespace basil {
 		return _type->concretify();
 	}
 
+	void ASTNode::children(vector<ASTNode*>& nodes) {
+		//
+	}
+
+	u32 ASTNode::effects() {
+		if (_effects < 0) {
+			_effects = EFFECT_ANY; // in case we reach ourselves
+			_effects = lazy_effects();
+		}
+		return _effects;
+	}
+
+	u32 ASTNode::lazy_effects() {
+		vector<ASTNode*> nodes;
+		children(nodes);
+		u32 result = EFFECT_NONE;
+		for (ASTNode* node : nodes) result |= node->effects();
+		return result;
+	}
+
+	bool ASTNode::same(ASTNode* other) {
+		return false;
+	}
+
+	u64 ASTNode::shape() {
+		if (!_shape) _shape = lazy_shape();
+		return _shape;
+	}
+
+	u64 ASTNode::lazy_shape() {
+		vector<ASTNode*> nodes;
+		children(nodes);
+		u64 h = ::hash(u64(kind()));
+		for (ASTNode* node : nodes) h = rotl(h, 7) ^ node->shape();
+		return h;
+	}
+
+	bool ASTNode::cheap() {
+		return false;
+	}
+
+	// Same kind of node, with the same subexpressions.
+	static bool same_shape(ASTNode* a, ASTNode* b) {
+		if (a->kind() != b->kind()) return false;
+		vector<ASTNode*> as, bs;
+		a->children(as), b->children(bs);
+		if (as.size() != bs.size()) return false;
+		for (u32 i = 0; i < as.size(); i ++) 
+			if (!as[i]->same(bs[i])) return false;
+		return true;
+	}
+
+	static bool _cse_enabled = true;
+	static u64 _cse_reused = 0;
+
+	void cse_enabled(bool enabled) {
+		_cse_enabled = enabled;
+	}
+
+	u64 cse_reused() {
+		return _cse_reused;
+	}
+
+	// A pure expression that has already been emitted into the current
+	// function, and the local holding its result.
+	struct Available {
+		ASTNode* node;
+		Location loc;
+		bool valid;
+	};
+
+	static vector<Available> available;
+	static map<u64, vector<u32>> by_shape; // indices into available, oldest first
+
+	// The latest valid entry the same as node, or -1.
+	static i64 lookup(ASTNode* node) {
+		auto it = by_shape.find(node->shape());
+		if (it == by_shape.end()) return -1;
+		const vector<u32>& entries = it->second;
+		for (i64 i = i64(entries.size()) - 1; i >= 0; i --) {
+			const Available& a = available[entries[i]];
+			if (a.valid && a.node->same(node)) return entries[i];
+		}
+		return -1;
+	}
+
+	// Finds an earlier result for node, or returns none.
+	static Location find_available(ASTNode* node) {
+		if (!_cse_enabled) return ssa_none();
+		i64 i = lookup(node);
+		if (i < 0) return ssa_none();
+		_cse_reused ++;
+		return available[i].loc;
+	}
+
+	// Records loc as the result of node, if node is pure.
+	static Location make_available(ASTNode* node, Location loc) {
+		if (_cse_enabled && loc.type == SSA_LOCAL 
+			&& node->effects() == EFFECT_NONE) {
+			auto it = by_shape.find(node->shape());
+			if (it == by_shape.end()) by_shape.put(node->shape(), {}), it = by_shape.find(node->shape());
+			it->second.push(available.size());
+			available.push({ node, loc, true });
+		}
+		return loc;
+	}
+
+	// Whether node's value is already at hand: a constant, a variable, or
+	// a pure expression computed earlier.
+	static bool at_hand(ASTNode* node) {
+		switch (node->kind()) {
+			case NODE_VOID:
+			case NODE_INT:
+			case NODE_SYMBOL:
+			case NODE_BOOL:
+			case NODE_VAR:
+				return true;
+			case NODE_BLOCK: {
+				vector<ASTNode*> nodes;
+				node->children(nodes);
+				return nodes.size() == 1 && at_hand(nodes[0]);
+			}
+			default:
+				break;
+		}
+		return _cse_enabled && lookup(node) >= 0;
+	}
+
+	// Drops everything recorded since mark, e.g. at the end of a branch.
+	static void forget_since(u32 mark) {
+		while (available.size() > mark) {
+			by_shape[available.back().node->shape()].pop();
+			available.pop();
+		}
+	}
+
+	static bool reads(ASTNode* node, const Def* def) {
+		if (node->kind() == NODE_VAR) return ((ASTVar*)node)->def() == def;
+		vector<ASTNode*> nodes;
+		node->children(nodes);
+		for (ASTNode* child : nodes) if (reads(child, def)) return true;
+		return false;
+	}
+
+	// Invalidates every recorded result that depends on def.
+	static void kill(const Def* def) {
+		for (Available& a : available) 
+			if (a.valid && reads(a.node, def)) a.valid = false;
+	}
+
+	static void kill_all() {
+		for (Available& a : available) a.valid = false;
+	}
+
+	// Invalidates everything the writes within node might change.
+	static void kill_writes(ASTNode* node) {
+		if (!(node->effects() & EFFECT_WRITE)) return;
+		if (node->kind() == NODE_CALL) return kill_all();
+		if (node->kind() == NODE_ASSIGN) kill(((ASTAssign*)node)->dest());
+		if (node->kind() == NODE_DEFINE) kill(((ASTDefine*)node)->def());
+		vector<ASTNode*> nodes;
+		node->children(nodes);
+		for (ASTNode* child : nodes) kill_writes(child);
+	}
+
 	ASTSingleton::ASTSingleton(const Type* type):
 		ASTNode(NO_LOCATION), _type(type) {}
 
@@ -25,6 +191,10 @@ namespace basil {
 		return _type;
 	}
 
+	ASTKind ASTSingleton::kind() const {
+		return NODE_SINGLETON;
+	}
+
 	Location ASTSingleton::emit(Function& func) {
 		return ssa_none();
 	}
@@ -40,6 +210,18 @@ namespace basil {
 		return VOID;
 	}
 
+	bool ASTVoid::cheap() {
+		return true;
+	}
+
+	bool ASTVoid::same(ASTNode* other) {
+		return other->kind() == NODE_VOID;
+	}
+
+	ASTKind ASTVoid::kind() const {
+		return NODE_VOID;
+	}
+
 	Location ASTVoid::emit(Function& function) {
 		return ssa_immediate(0);
 	}
@@ -55,6 +237,22 @@ namespace basil {
 		return INT;
 	}
 
+	bool ASTInt::cheap() {
+		return true;
+	}
+
+	bool ASTInt::same(ASTNode* other) {
+		return other->kind() == NODE_INT && ((ASTInt*)other)->_value == _value;
+	}
+
+	u64 ASTInt::lazy_shape() {
+		return ::hash(_value) ^ 9408727361840927171ul;
+	}
+
+	ASTKind ASTInt::kind() const {
+		return NODE_INT;
+	}
+
 	Location ASTInt::emit(Function& func) {
 		return ssa_immediate(_value);
 	}
@@ -70,6 +268,22 @@ namespace basil {
 		return SYMBOL;
 	}
 
+	bool ASTSymbol::cheap() {
+		return true;
+	}
+
+	bool ASTSymbol::same(ASTNode* other) {
+		return other->kind() == NODE_SYMBOL && ((ASTSymbol*)other)->_value == _value;
+	}
+
+	u64 ASTSymbol::lazy_shape() {
+		return ::hash(_value) ^ 2793440117523960813ul;
+	}
+
+	ASTKind ASTSymbol::kind() const {
+		return NODE_SYMBOL;
+	}
+
 	Location ASTSymbol::emit(Function& func) {
 		return ssa_immediate(_value);
 	}
@@ -85,6 +299,14 @@ namespace basil {
 		return STRING;
 	}
 
+	const string& ASTString::value() const {
+		return _value;
+	}
+
+	ASTKind ASTString::kind() const {
+		return NODE_STRING;
+	}
+
 	Location ASTString::emit(Function& func) {
 		return func.add(new AddressInsn(ssa_const(ssa_next_label(), _value), type()));
 	}
@@ -100,6 +322,22 @@ namespace basil {
 		return BOOL;
 	}
 
+	bool ASTBool::cheap() {
+		return true;
+	}
+
+	bool ASTBool::same(ASTNode* other) {
+		return other->kind() == NODE_BOOL && ((ASTBool*)other)->_value == _value;
+	}
+
+	u64 ASTBool::lazy_shape() {
+		return _value ? 6611832975069472321ul : 14205587303197722943ul;
+	}
+
+	ASTKind ASTBool::kind() const {
+		return NODE_BOOL;
+	}
+
 	Location ASTBool::emit(Function& func) {
 		return ssa_immediate(_value ? 1 : 0);
 	}
@@ -120,6 +358,26 @@ namespace basil {
 		return ERROR;
 	}
 
+	bool ASTVar::cheap() {
+		return true;
+	}
+
+	ASTKind ASTVar::kind() const {
+		return NODE_VAR;
+	}
+
+	const Def* ASTVar::def() const {
+		return _env->find(symbol_for(_name));
+	}
+
+	bool ASTVar::same(ASTNode* other) {
+		return other->kind() == NODE_VAR && ((ASTVar*)other)->def() == def();
+	}
+
+	u64 ASTVar::lazy_shape() {
+		return ::hash(def());
+	}
+
 	Location ASTVar::emit(Function& func) {
 		const Def* def = _env->find(symbol_for(_name));
 		if (!def) return ssa_none();
@@ -139,6 +397,10 @@ namespace basil {
 		_child->dec();
 	}
 
+	void ASTUnary::children(vector<ASTNode*>& nodes) {
+		nodes.push(_child);
+	}
+
 	ASTBinary::ASTBinary(SourceLocation loc, ASTNode* left, ASTNode* right):		ASTNode(loc), _left(left), _right(right) {
 		_left->inc(), _right->inc();
 	}
@@ -147,6 +409,11 @@ namespace basil {
 		_left->dec(), _right->dec();
 	}
 
+	void ASTBinary::children(vector<ASTNode*>& nodes) {
+		nodes.push(_left);
+		nodes.push(_right);
+	}
+
 	ASTBinaryMath::ASTBinaryMath(SourceLocation loc, ASTMathOp op, 
 		ASTNode* left, ASTNode* right):
 		ASTBinary(loc, left, right), _op(op) {}
@@ -165,18 +432,33 @@ namespace basil {
 		return result;
 	}
 
+	bool ASTBinaryMath::cheap() {
+		return _op != AST_DIV && _op != AST_REM && _left->cheap() && _right->cheap();
+	}
+
+	ASTKind ASTBinaryMath::kind() const {
+		return NODE_MATH;
+	}
+
+	bool ASTBinaryMath::same(ASTNode* other) {
+		return same_shape(this, other) && ((ASTBinaryMath*)other)->_op == _op;
+	}
+
 	Location ASTBinaryMath::emit(Function& func) {
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		Location left = _left->emit(func), right = _right->emit(func);
 		switch (_op) {
 			case AST_ADD:
-				return func.add(new AddInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new AddInsn(left, right)));
 			case AST_SUB:
-				return func.add(new SubInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new SubInsn(left, right)));
 			case AST_MUL:
-				return func.add(new MulInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new MulInsn(left, right)));
 			case AST_DIV:
-				return func.add(new DivInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new DivInsn(left, right)));
 			case AST_REM:
-				return func.add(new RemInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new RemInsn(left, right)));
 			default:
 				return ssa_none();
 		}
@@ -208,14 +490,43 @@ namespace basil {
 		return BOOL;
 	}
 
+	bool ASTBinaryLogic::cheap() {
+		return _left->cheap() && _right->cheap();
+	}
+
+	ASTKind ASTBinaryLogic::kind() const {
+		return NODE_LOGIC;
+	}
+
+	bool ASTBinaryLogic::same(ASTNode* other) {
+		return same_shape(this, other) && ((ASTBinaryLogic*)other)->_op == _op;
+	}
+
 	Location ASTBinaryLogic::emit(Function& func) {
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		if (_op != AST_XOR && !_right->cheap()) {
+			// only evaluate the right side if the left doesn't decide the result
+			u32 _end = ssa_next_label();
+			result = func.create_local(type());
+			Location left = _left->emit(func);
+			func.add(new StoreInsn(result, left, true));
+			if (_op == AST_AND) func.add(new IfZeroInsn(_end, left));
+			else func.add(new IfNonZeroInsn(_end, left));
+			u32 mark = available.size();
+			func.add(new StoreInsn(result, _right->emit(func), true));
+			forget_since(mark);
+			func.add(new Label(_end));
+			return make_available(this, result);
+		}
+		Location left = _left->emit(func), right = _right->emit(func);
 		switch (_op) {
 			case AST_AND:
-				return func.add(new AndInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new AndInsn(left, right)));
 			case AST_OR:
-				return func.add(new OrInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new OrInsn(left, right)));
 			case AST_XOR:
-				return func.add(new XorInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new XorInsn(left, right)));
 			default:
 				return ssa_none();
 		}
@@ -242,8 +553,22 @@ namespace basil {
 		return BOOL;
 	}
 
+	bool ASTNot::cheap() {
+		return _child->cheap();
+	}
+
+	ASTKind ASTNot::kind() const {
+		return NODE_NOT;
+	}
+
+	bool ASTNot::same(ASTNode* other) {
+		return same_shape(this, other);
+	}
+
 	Location ASTNot::emit(Function& func) {
-		return func.add(new NotInsn(_child->emit(func)));
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		return make_available(this, func.add(new NotInsn(_child->emit(func))));
 	}
 
 	void ASTNot::format(stream& io) const {
@@ -259,7 +584,32 @@ namespace basil {
 		return BOOL;
 	}
 
+	bool ASTBinaryEqual::cheap() {
+		return _left->type() != STRING && _right->type() != STRING 
+			&& _left->cheap() && _right->cheap();
+	}
+
+	ASTKind ASTBinaryEqual::kind() const {
+		return NODE_EQUAL;
+	}
+
+	bool ASTBinaryEqual::same(ASTNode* other) {
+		return same_shape(this, other) && ((ASTBinaryEqual*)other)->_op == _op;
+	}
+
+	static bool empty_string(ASTNode* node) {
+		return node->kind() == NODE_STRING && ((ASTString*)node)->value().size() == 0;
+	}
+
 	Location ASTBinaryEqual::emit(Function& func) {
+		Location cached = find_available(this);
+		if (cached.type != SSA_NONE) return cached;
+		ASTNode* nonempty = empty_string(_right) ? _left : empty_string(_left) ? _right : nullptr;
+		if (nonempty && nonempty->type() == STRING) { // only the first byte can differ from ""
+			Location first = func.add(new LoadPtrInsn(Indirect(nonempty->emit(func), 0), INT, x64::BYTE));
+			if (_op == AST_INEQUAL) return make_available(this, func.add(new InequalInsn(first, ssa_immediate(0))));
+			return make_available(this, func.add(new EqualInsn(first, ssa_immediate(0))));
+		}
     if (_left->type() == STRING || _right->type() == STRING) {
       func.add(new StoreArgumentInsn(_left->emit(func), 0, _left->type()));
       func.add(new StoreArgumentInsn(_right->emit(func), 1, _right->type()));
@@ -267,14 +617,16 @@ namespace basil {
 			label.type = SSA_LABEL;
 			label.label_index = ssa_find_label("_strcmp");
       Location result = func.add(new CallInsn(label, INT));
-      return func.add(new EqualInsn(result, ssa_immediate(0)));
+			if (_op == AST_INEQUAL) return make_available(this, func.add(new InequalInsn(result, ssa_immediate(0))));
+      return make_available(this, func.add(new EqualInsn(result, ssa_immediate(0))));
     }
 
+		Location left = _left->emit(func), right = _right->emit(func);
 		switch (_op) {
 			case AST_EQUAL:
-				return func.add(new EqualInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new EqualInsn(left, right)));
 			case AST_INEQUAL:
-				return func.add(new InequalInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new InequalInsn(left, right)));
 			default:
 				return ssa_none();
 		}
@@ -311,7 +663,22 @@ namespace basil {
 		return BOOL;
 	}
 
+	bool ASTBinaryRel::cheap() {
+		return _left->type() != STRING && _right->type() != STRING 
+			&& _left->cheap() && _right->cheap();
+	}
+
+	ASTKind ASTBinaryRel::kind() const {
+		return NODE_RELATION;
+	}
+
+	bool ASTBinaryRel::same(ASTNode* other) {
+		return same_shape(this, other) && ((ASTBinaryRel*)other)->_op == _op;
+	}
+
 	Location ASTBinaryRel::emit(Function& func) {
+		Location cached = find_available(this);
+		if (cached.type != SSA_NONE) return cached;
     if (_left->type() == STRING || _right->type() == STRING) {
       func.add(new StoreArgumentInsn(_left->emit(func), 0, _left->type()));
       func.add(new StoreArgumentInsn(_right->emit(func), 1, _right->type()));
@@ -322,27 +689,28 @@ namespace basil {
 
       switch(_op) {
         case AST_LESS:
-          return func.add(new LessInsn(result, ssa_immediate(0)));
+          return make_available(this, func.add(new LessInsn(result, ssa_immediate(0))));
         case AST_LESS_EQUAL:
-          return func.add(new LessEqualInsn(result, ssa_immediate(0)));
+          return make_available(this, func.add(new LessEqualInsn(result, ssa_immediate(0))));
         case AST_GREATER:
-          return func.add(new GreaterInsn(result, ssa_immediate(0)));
+          return make_available(this, func.add(new GreaterInsn(result, ssa_immediate(0))));
         case AST_GREATER_EQUAL:
-          return func.add(new GreaterEqualInsn(result, ssa_immediate(0)));
+          return make_available(this, func.add(new GreaterEqualInsn(result, ssa_immediate(0))));
         default:
           return ssa_none();
       }
     }
 
+		Location left = _left->emit(func), right = _right->emit(func);
 		switch (_op) {
 			case AST_LESS:
-				return func.add(new LessInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new LessInsn(left, right)));
 			case AST_LESS_EQUAL:
-				return func.add(new LessEqualInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new LessEqualInsn(left, right)));
 			case AST_GREATER:
-				return func.add(new GreaterInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new GreaterInsn(left, right)));
 			case AST_GREATER_EQUAL:
-				return func.add(new GreaterEqualInsn(_left->emit(func), _right->emit(func)));
+				return make_available(this, func.add(new GreaterEqualInsn(left, right)));
 			default:
 				return ssa_none();
 		}
@@ -363,8 +731,21 @@ namespace basil {
 		return VOID;
 	}
 
+	ASTKind ASTDefine::kind() const {
+		return NODE_DEFINE;
+	}
+
+	const Def* ASTDefine::def() const {
+		return _env->find(symbol_for(_name));
+	}
+
+	u32 ASTDefine::lazy_effects() {
+		return EFFECT_WRITE | _child->effects();
+	}
+
 	Location ASTDefine::emit(Function& func) {
-		Location loc = func.create_local(symbol_for(_name), type());
+		Location loc = func.create_local(symbol_for(_name), _child->type());
+		kill(def());
 		_env->find(symbol_for(_name))->location = loc;
 		func.add(new StoreInsn(loc, _child->emit(func), true));
 		return ssa_none();
@@ -375,7 +756,7 @@ namespace basil {
 	}
 
 	ASTCall::ASTCall(SourceLocation loc, ASTNode* func, const vector<ASTNode*>& args):
-		ASTNode(loc), _func(func), _args(args) {
+		ASTNode(loc), _func(func), _args(args), _inline(false) {
 		_func->inc();
 		for (ASTNode* n : _args) n->inc();
 	}
@@ -403,8 +784,45 @@ namespace basil {
 		return ((const FunctionType*)fntype)->ret();
 	}
 
+	ASTNode* ASTCall::func() const {
+		return _func;
+	}
+
+	const vector<ASTNode*>& ASTCall::args() const {
+		return _args;
+	}
+
+	void ASTCall::set_inline(bool should) {
+		_inline = should;
+	}
+
+	bool ASTCall::inlined() const {
+		return _inline;
+	}
+
+	ASTKind ASTCall::kind() const {
+		return NODE_CALL;
+	}
+
+	void ASTCall::children(vector<ASTNode*>& nodes) {
+		nodes.push(_func);
+		for (ASTNode* n : _args) nodes.push(n);
+	}
+
+	u32 ASTCall::lazy_effects() {
+		u32 result = ASTNode::lazy_effects();
+		if (_func->kind() != NODE_FUNCTION) return EFFECT_ANY; // unknown callee
+		return result | ((ASTFunction*)_func)->body()->effects();
+	}
+
+	bool ASTCall::same(ASTNode* other) {
+		return same_shape(this, other);
+	}
+
 	Location ASTCall::emit(Function& func) {
-		Location fn = _func->emit(func);
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		Location fn = _inline ? ssa_none() : _func->emit(func);
 		vector<Location> arglocs;
 		const Type* argt = ((const FunctionType*)_func->type())->arg();
 		for (u32 i = 0; i < _args.size(); i ++) {
@@ -415,10 +833,13 @@ namespace basil {
 				arglocs[i] = func.add(new AddressInsn(arglocs[i], 
 					((const ProductType*)argt)->member(i)));
 			}
-			func.add(new StoreArgumentInsn(arglocs[i], i, 
+			if (!_inline) func.add(new StoreArgumentInsn(arglocs[i], i, 
 				((const ProductType*)argt)->member(i)));
 		}
-		return func.add(new CallInsn(fn, type()));
+		if (_inline) result = ((ASTFunction*)_func)->emit_inline(func, arglocs);
+		else result = func.add(new CallInsn(fn, type()));
+		if (effects() & EFFECT_WRITE) kill_all();
+		return make_available(this, result);
 	}
 
 	void ASTCall::format(stream& io) const {
@@ -434,6 +855,14 @@ namespace basil {
 	ASTIncompleteFn::ASTIncompleteFn(SourceLocation loc, const Type* args, i64 name):
 		ASTNode(loc), _args(args), _name(name) {}
 
+	i64 ASTIncompleteFn::name() const {
+		return _name;
+	}
+
+	ASTKind ASTIncompleteFn::kind() const {
+		return NODE_INCOMPLETE_FN;
+	}
+
 	Location ASTIncompleteFn::emit(Function& func) {
 		Location loc;
 		loc.type = SSA_LABEL;
@@ -462,6 +891,34 @@ namespace basil {
 		return find<FunctionType>(_args_type, _body->type());
 	}
 
+	ASTNode* ASTFunction::body() const {
+		return _body;
+	}
+
+	i64 ASTFunction::name() const {
+		return _name;
+	}
+
+	u32 ASTFunction::arity() const {
+		return _args.size();
+	}
+
+	const Def* ASTFunction::param(u32 i) const {
+		return _env->find(symbol_for(_args[i]));
+	}
+
+	ASTKind ASTFunction::kind() const {
+		return NODE_FUNCTION;
+	}
+
+	bool ASTFunction::same(ASTNode* other) {
+		return other == this;
+	}
+
+	u64 ASTFunction::lazy_shape() {
+		return ::hash(this);
+	}
+
 	Location ASTFunction::emit(Function& func) {
 		if (!_emitted) {
 			Function& fn = _name == -1 ? func.create_function() 
@@ -472,7 +929,11 @@ namespace basil {
 				if (def) def->location = fn.add(new LoadArgumentInsn(i, 
 					((ProductType*)_args_type)->member(i)));
 			}
+			vector<Available> outer = available;
+			map<u64, vector<u32>> outer_shapes = by_shape;
+			available.clear(), by_shape = map<u64, vector<u32>>();
 			fn.add(new RetInsn(_body->emit(fn)));
+			available = outer, by_shape = outer_shapes;
 
 			_emitted = true;
 		}
@@ -483,6 +944,21 @@ namespace basil {
 		return loc;
 	}
 
+	// Binds each parameter to a copy of its argument, and emits the body
+	// into func, yielding its result.
+	Location ASTFunction::emit_inline(Function& func, const vector<Location>& args) {
+		for (u32 i = 0; i < _args.size(); i ++) {
+			Def* def = _env->find(symbol_for(_args[i]));
+			if (!def) continue;
+			kill(def);
+			def->location = func.create_local(symbol_for(_args[i]), 
+				((ProductType*)_args_type)->member(i));
+			func.add(new StoreInsn(def->location, args[i], true));
+		}
+		Location result = _body->emit(func);
+		return result.type == SSA_NONE ? ssa_immediate(0) : result;
+	}
+
 	void ASTFunction::format(stream& io) const {
 		if (_name == -1) write(io, "<anonymous>");
 		else write(io, symbol_for(_name));
@@ -502,6 +978,14 @@ namespace basil {
 		return _exprs.back()->type();
 	}
 
+	ASTKind ASTBlock::kind() const {
+		return NODE_BLOCK;
+	}
+
+	void ASTBlock::children(vector<ASTNode*>& nodes) {
+		for (ASTNode* n : _exprs) nodes.push(n);
+	}
+
 	Location ASTBlock::emit(Function& func) {
 		Location loc;
 		for (ASTNode* n : _exprs) loc = n->emit(func);
@@ -546,16 +1030,36 @@ namespace basil {
 		return t;
 	}
 
+	ASTKind ASTIf::kind() const {
+		return NODE_IF;
+	}
+
+	void ASTIf::children(vector<ASTNode*>& nodes) {
+		nodes.push(_cond);
+		nodes.push(_if_true);
+		nodes.push(_if_false);
+	}
+
 	Location ASTIf::emit(Function& func) {
+		Location cond = _cond->emit(func);
+		if (at_hand(_if_true) && at_hand(_if_false)) { // pick one without branching
+			Location true_result = _if_true->emit(func);
+			Location false_result = _if_false->emit(func);
+			return func.add(new SelectInsn(cond, true_result, false_result, type()));
+		}
+
 		u32 _else = ssa_next_label(), _end = ssa_next_label();
 		Location result = func.create_local(type());
-		func.add(new IfZeroInsn(_else, _cond->emit(func)));
+		func.add(new IfZeroInsn(_else, cond));
+		u32 mark = available.size();
 		Location true_result = _if_true->emit(func);
 		func.add(new StoreInsn(result, true_result, true));
 		func.add(new GotoInsn(_end));
+		forget_since(mark);
 		func.add(new Label(_else));
 		Location false_result = _if_false->emit(func);
 		func.add(new StoreInsn(result, false_result, true));
+		forget_since(mark);
 		func.add(new Label(_end));
 		return result;
 	}
@@ -586,12 +1090,24 @@ namespace basil {
 		return VOID;
 	}
 
+	ASTKind ASTWhile::kind() const {
+		return NODE_WHILE;
+	}
+
+	void ASTWhile::children(vector<ASTNode*>& nodes) {
+		nodes.push(_cond);
+		nodes.push(_body);
+	}
+
 	Location ASTWhile::emit(Function& func) {
 		u32 _start = ssa_next_label(), _end = ssa_next_label();
 		Location result = func.create_local(type());
+		kill_writes(this); // anything the loop changes isn't available at its start
 		func.add(new Label(_start));
 		func.add(new IfZeroInsn(_end, _cond->emit(func)));
+		u32 mark = available.size();
 		_body->emit(func);
+		forget_since(mark);
 		func.add(new GotoInsn(_start));
 		func.add(new Label(_end));
 		return result;
@@ -617,8 +1133,18 @@ namespace basil {
 		return BOOL;
 	}
 
+	ASTKind ASTIsEmpty::kind() const {
+		return NODE_IS_EMPTY;
+	}
+
+	bool ASTIsEmpty::same(ASTNode* other) {
+		return same_shape(this, other);
+	}
+
 	Location ASTIsEmpty::emit(Function& func) {
-		return func.add(new EqualInsn(_child->emit(func), ssa_immediate(0)));
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		return make_available(this, func.add(new EqualInsn(_child->emit(func), ssa_immediate(0))));
 	}
 
 	void ASTIsEmpty::format(stream& io) const {
@@ -641,8 +1167,18 @@ namespace basil {
 		return ((const ListType*) _child->type())->element();
 	}
 
+	ASTKind ASTHead::kind() const {
+		return NODE_HEAD;
+	}
+
+	bool ASTHead::same(ASTNode* other) {
+		return same_shape(this, other);
+	}
+
 	Location ASTHead::emit(Function& func) {
-		return func.add(new LoadPtrInsn(_child->emit(func), type(), 0));
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		return make_available(this, func.add(new LoadPtrInsn(_child->emit(func), type(), 0)));
 	}
 
 	void ASTHead::format(stream& io) const {
@@ -665,8 +1201,18 @@ namespace basil {
 		return _child->type();
 	}
 
+	ASTKind ASTTail::kind() const {
+		return NODE_TAIL;
+	}
+
+	bool ASTTail::same(ASTNode* other) {
+		return same_shape(this, other);
+	}
+
 	Location ASTTail::emit(Function& func) {
-		return func.add(new LoadPtrInsn(_child->emit(func), type(), 8));
+		Location result = find_available(this);
+		if (result.type != SSA_NONE) return result;
+		return make_available(this, func.add(new LoadPtrInsn(_child->emit(func), type(), 8)));
 	}
 
 	void ASTTail::format(stream& io) const {
@@ -674,7 +1220,11 @@ namespace basil {
 	}
 
 	ASTCons::ASTCons(SourceLocation loc, ASTNode* first, ASTNode* rest):
-		ASTBinary(loc, first, rest) {}
+		ASTBinary(loc, first, rest), _local(false) {}
+
+	void ASTCons::set_local(bool local) {
+		_local = local;
+	}
 
 	const Type* ASTCons::lazy_type() {
 		const Type *first = _left->type(), *rest = _right->type();
@@ -697,8 +1247,24 @@ namespace basil {
 		}
 	}
 
+	ASTKind ASTCons::kind() const {
+		return NODE_CONS;
+	}
+
+	u32 ASTCons::lazy_effects() {
+		return EFFECT_ALLOC | ASTNode::lazy_effects();
+	}
+
 	Location ASTCons::emit(Function& func) {
 		Location l = _left->emit(func), r = _right->emit(func);
+		Location cell = _local ? func.create_cell() : ssa_none();
+		if (cell.type != SSA_NONE) { // nothing outlives the frame, so fill in a cell of it
+			if (l.type == SSA_LABEL) l = func.add(new AddressInsn(l, _left->type()));
+			Location result = func.add(new AddressInsn(cell, type()));
+			func.add(new StorePtrInsn(result, l, 0));
+			func.add(new StorePtrInsn(result, r, 8));
+			return result;
+		}
 		func.add(new StoreArgumentInsn(l, 0, _left->type()));
 		func.add(new StoreArgumentInsn(r, 1, _right->type()));
 		Location label;
@@ -714,20 +1280,37 @@ namespace basil {
 	const Type* ASTLength::lazy_type() {
 		const Type *child = _child->type();
 		if (child == ERROR) return ERROR;
-		if (unify(_child->type(), STRING) != STRING
-			&& unify(_child->type(), find<ListType>(find<TypeVariable>()))->kind() 
-				!= KIND_LIST) {
-			err(_child->loc(), "Argument to 'length' expression must be string or list, ",
-				"given '", _child->type());
+		if (child->kind() == KIND_ARRAY) return INT;
+		const Type* list = unify(_child->type(), find<ListType>(find<TypeVariable>()));
+		if (unify(_child->type(), STRING) != STRING && (!list || list->kind() != KIND_LIST)) {
+			err(_child->loc(), "Argument to 'length' expression must be string, list ",
+				"or array, given '", _child->type(), "'.");
 			return ERROR;
 		}
 		return INT;
 	}
 
+	u32 ASTLength::lazy_effects() {
+		u32 result = ASTNode::lazy_effects();
+		return _child->type()->kind() == KIND_ARRAY ? result | EFFECT_READ : result;
+	}
+
 	ASTLength::ASTLength(SourceLocation loc, ASTNode* child)
     : basil::ASTUnary(loc, child) {}
 
+  ASTKind ASTLength::kind() const {
+    return NODE_LENGTH;
+  }
+
+  bool ASTLength::same(ASTNode* other) {
+    return same_shape(this, other);
+  }
+
   Location ASTLength::emit(Function& func) {
+    if (_child->type()->kind() == KIND_ARRAY) // kept in the header, but may change
+      return func.add(new LoadPtrInsn(_child->emit(func), INT, 0));
+    Location result = find_available(this);
+    if (result.type != SSA_NONE) return result;
     func.add(new StoreArgumentInsn(_child->emit(func), 0, _child->type()));
 
     Location label;
@@ -735,13 +1318,267 @@ namespace basil {
     if (_child->type() == STRING) label.label_index = ssa_find_label("_strlen");
     else label.label_index = ssa_find_label("_listlen");
     
-    return func.add(new CallInsn(label, INT));
+    return make_available(this, func.add(new CallInsn(label, INT)));
   }
 
   void ASTLength::format(stream& io) const {
     write(io, "(length ", _child, ")");
   }
 
+	static Location native_label(const char* name) {
+		Location label;
+		label.type = SSA_LABEL;
+		label.label_index = ssa_find_label(name);
+		return label;
+	}
+
+	// element i of an array whose elements start at elements
+	static Indirect element(Location elements, Location i) {
+		Indirect ind(elements, 0);
+		ind.index = i, ind.scale = x64::SCALE8;
+		return ind;
+	}
+
+	// The array type of node, or null if it can't be one.
+	static const Type* array_type(ASTNode* node) {
+		const Type* t = node->type();
+		if (t->kind() != KIND_ARRAY && !t->concrete()) 
+			t = unify(t, find<ArrayType>(find<TypeVariable>()));
+		return t && t->kind() == KIND_ARRAY ? t : nullptr;
+	}
+
+	ASTToArray::ASTToArray(SourceLocation loc, ASTNode* list):
+		ASTUnary(loc, list) {}
+
+	const Type* ASTToArray::lazy_type() {
+		if (_child->type() == ERROR) return ERROR;
+		const Type* ct = _child->type();
+		if (ct->kind() != KIND_LIST && !ct->concrete()) 
+			ct = unify(ct, find<ListType>(find<TypeVariable>()));
+		if (!ct || ct->kind() != KIND_LIST) {
+			err(_child->loc(), "Invalid argument to 'to-array' expression: '",
+				_child->type(), "'.");
+			return ERROR;
+		}
+		return find<ArrayType>(((const ListType*)ct)->element());
+	}
+
+	u32 ASTToArray::lazy_effects() {
+		return EFFECT_ALLOC | ASTNode::lazy_effects();
+	}
+
+	ASTKind ASTToArray::kind() const {
+		return NODE_TO_ARRAY;
+	}
+
+	// Counts the list, allocates an array with room for all of it, then
+	// copies each element across.
+	Location ASTToArray::emit(Function& func) {
+		const Type* list_type = _child->type();
+		const Type* element_type = ((const ArrayType*)type())->element();
+		Location list = _child->emit(func);
+		func.add(new StoreArgumentInsn(list, 0, list_type));
+		Location length = func.add(new CallInsn(native_label("_listlen"), INT));
+		func.add(new StoreArgumentInsn(length, 0, INT));
+		Location array = func.add(new CallInsn(native_label("_new_array"), type()));
+		func.add(new StorePtrInsn(array, length, 0));
+		Location elements = func.add(new LoadPtrInsn(array, INT, 16));
+
+		Location i = func.create_local(INT), rest = func.create_local(list_type);
+		u32 loop = ssa_next_label(), done = ssa_next_label();
+		func.add(new StoreInsn(i, ssa_immediate(0), true));
+		func.add(new StoreInsn(rest, list, true));
+		func.add(new Label(loop));
+		func.add(new IfZeroInsn(done, rest));
+		func.add(new StorePtrInsn(element(elements, i), 
+			func.add(new LoadPtrInsn(rest, element_type, 0))));
+		func.add(new StoreInsn(rest, func.add(new LoadPtrInsn(rest, list_type, 8)), true));
+		func.add(new StoreInsn(i, func.add(new AddInsn(i, ssa_immediate(1))), true));
+		func.add(new GotoInsn(loop));
+		func.add(new Label(done));
+		return array;
+	}
+
+	void ASTToArray::format(stream& io) const {
+		write(io, "(to-array ", _child, ")");
+	}
+
+	ASTToList::ASTToList(SourceLocation loc, ASTNode* array):
+		ASTUnary(loc, array) {}
+
+	const Type* ASTToList::lazy_type() {
+		if (_child->type() == ERROR) return ERROR;
+		const Type* t = array_type(_child);
+		if (!t) {
+			err(_child->loc(), "Invalid argument to 'to-list' expression: '",
+				_child->type(), "'.");
+			return ERROR;
+		}
+		return find<ListType>(((const ArrayType*)t)->element());
+	}
+
+	u32 ASTToList::lazy_effects() {
+		return EFFECT_ALLOC | EFFECT_READ | ASTNode::lazy_effects();
+	}
+
+	ASTKind ASTToList::kind() const {
+		return NODE_TO_LIST;
+	}
+
+	// Conses the elements onto the empty list, from the last one back.
+	Location ASTToList::emit(Function& func) {
+		const Type* element_type = ((const ListType*)type())->element();
+		Location array = _child->emit(func);
+		Location i = func.create_local(INT), list = func.create_local(type());
+		u32 loop = ssa_next_label(), done = ssa_next_label();
+		func.add(new StoreInsn(i, func.add(new LoadPtrInsn(array, INT, 0)), true));
+		func.add(new StoreInsn(list, ssa_immediate(0), true));
+		func.add(new Label(loop));
+		func.add(new IfZeroInsn(done, i));
+		func.add(new StoreInsn(i, func.add(new SubInsn(i, ssa_immediate(1))), true));
+		Location elements = func.add(new LoadPtrInsn(array, INT, 16));
+		func.add(new StoreArgumentInsn(func.add(new LoadPtrInsn(element(elements, i), 
+			element_type, x64::QWORD)), 0, element_type));
+		func.add(new StoreArgumentInsn(list, 1, type()));
+		func.add(new StoreInsn(list, func.add(new CallInsn(native_label("_cons"), type())), true));
+		func.add(new GotoInsn(loop));
+		func.add(new Label(done));
+		return list;
+	}
+
+	void ASTToList::format(stream& io) const {
+		write(io, "(to-list ", _child, ")");
+	}
+
+	ASTIndex::ASTIndex(SourceLocation loc, ASTNode* array, ASTNode* index):
+		ASTBinary(loc, array, index) {}
+
+	const Type* ASTIndex::lazy_type() {
+		if (_left->type() == ERROR || _right->type() == ERROR) return ERROR;
+		const Type* t = array_type(_left);
+		if (!t || unify(_right->type(), INT) != INT) {
+			err(loc(), "Invalid arguments to 'at' expression: '",
+				_left->type(), "' and '", _right->type(), "'.");
+			return ERROR;
+		}
+		return ((const ArrayType*)t)->element();
+	}
+
+	u32 ASTIndex::lazy_effects() {
+		return EFFECT_READ | ASTNode::lazy_effects();
+	}
+
+	ASTKind ASTIndex::kind() const {
+		return NODE_INDEX;
+	}
+
+	Location ASTIndex::emit(Function& func) {
+		Location array = _left->emit(func), index = _right->emit(func);
+		Location elements = func.add(new LoadPtrInsn(array, INT, 16));
+		return func.add(new LoadPtrInsn(element(elements, index), type(), x64::QWORD));
+	}
+
+	void ASTIndex::format(stream& io) const {
+		write(io, "(at ", _left, " ", _right, ")");
+	}
+
+	ASTSetIndex::ASTSetIndex(SourceLocation loc, ASTNode* array, ASTNode* index, ASTNode* value):
+		ASTNode(loc), _array(array), _index(index), _value(value) {
+		_array->inc();
+		_index->inc();
+		_value->inc();
+	}
+
+	ASTSetIndex::~ASTSetIndex() {
+		_array->dec();
+		_index->dec();
+		_value->dec();
+	}
+
+	const Type* ASTSetIndex::lazy_type() {
+		if (_array->type() == ERROR || _index->type() == ERROR 
+			|| _value->type() == ERROR) return ERROR;
+		const Type* t = array_type(_array);
+		const Type* element = t ? ((const ArrayType*)t)->element() : nullptr;
+		if (!t || unify(_index->type(), INT) != INT || unify(_value->type(), element) != element) {
+			err(loc(), "Invalid arguments to 'set' expression: '", _array->type(), 
+				"', '", _index->type(), "' and '", _value->type(), "'.");
+			return ERROR;
+		}
+		return VOID;
+	}
+
+	u32 ASTSetIndex::lazy_effects() {
+		return EFFECT_WRITE | ASTNode::lazy_effects();
+	}
+
+	ASTKind ASTSetIndex::kind() const {
+		return NODE_SET_INDEX;
+	}
+
+	void ASTSetIndex::children(vector<ASTNode*>& nodes) {
+		nodes.push(_array);
+		nodes.push(_index);
+		nodes.push(_value);
+	}
+
+	Location ASTSetIndex::emit(Function& func) {
+		Location array = _array->emit(func), index = _index->emit(func), value = _value->emit(func);
+		if (value.type == SSA_LABEL) value = func.add(new AddressInsn(value, _value->type()));
+		Location elements = func.add(new LoadPtrInsn(array, INT, 16));
+		func.add(new StorePtrInsn(element(elements, index), value));
+		return ssa_immediate(0);
+	}
+
+	void ASTSetIndex::format(stream& io) const {
+		write(io, "(set ", _array, " ", _index, " ", _value, ")");
+	}
+
+	ASTPush::ASTPush(SourceLocation loc, ASTNode* array, ASTNode* value):
+		ASTBinary(loc, array, value) {}
+
+	const Type* ASTPush::lazy_type() {
+		if (_left->type() == ERROR || _right->type() == ERROR) return ERROR;
+		const Type* t = array_type(_left);
+		const Type* element = t ? ((const ArrayType*)t)->element() : nullptr;
+		if (!t || unify(_right->type(), element) != element) {
+			err(loc(), "Invalid arguments to 'push' expression: '",
+				_left->type(), "' and '", _right->type(), "'.");
+			return ERROR;
+		}
+		return VOID;
+	}
+
+	u32 ASTPush::lazy_effects() {
+		return EFFECT_WRITE | ASTNode::lazy_effects();
+	}
+
+	ASTKind ASTPush::kind() const {
+		return NODE_PUSH;
+	}
+
+	// Stores past the last element, first calling _grow_array if there's
+	// no room there. Growing moves the elements, but never the header.
+	Location ASTPush::emit(Function& func) {
+		Location array = _left->emit(func), value = _right->emit(func);
+		if (value.type == SSA_LABEL) value = func.add(new AddressInsn(value, _right->type()));
+		Location length = func.add(new LoadPtrInsn(array, INT, 0));
+		Location capacity = func.add(new LoadPtrInsn(array, INT, 8));
+		u32 room = ssa_next_label();
+		func.add(new IfZeroInsn(room, func.add(new EqualInsn(length, capacity))));
+		func.add(new StoreArgumentInsn(array, 0, _left->type()));
+		func.add(new CallInsn(native_label("_grow_array"), VOID));
+		func.add(new Label(room));
+		Location elements = func.add(new LoadPtrInsn(array, INT, 16));
+		func.add(new StorePtrInsn(element(elements, length), value));
+		func.add(new StorePtrInsn(array, func.add(new AddInsn(length, ssa_immediate(1))), 0));
+		return ssa_immediate(0);
+	}
+
+	void ASTPush::format(stream& io) const {
+		write(io, "(push ", _left, " ", _right, ")");
+	}
+
 
 	const Type* ASTDisplay::lazy_type() {
 		return VOID;
@@ -750,6 +1587,14 @@ namespace basil {
 	ASTDisplay::ASTDisplay(SourceLocation loc, ASTNode* node):
 		ASTUnary(loc, node) {}
 
+	ASTKind ASTDisplay::kind() const {
+		return NODE_DISPLAY;
+	}
+
+	u32 ASTDisplay::lazy_effects() {
+		return EFFECT_IO | _child->effects();
+	}
+
 	Location ASTDisplay::emit(Function& func) {
 		const char* name;
 		if (_child->type() == INT) name = "_display_int";
@@ -761,6 +1606,10 @@ namespace basil {
 		else if (_child->type() == find<ListType>(BOOL)) name = "_display_bool_list";
 		else if (_child->type() == find<ListType>(STRING)) name = "_display_string_list";
 		else if (_child->type() == VOID) name = "_display_int_list";
+		else if (_child->type() == find<ArrayType>(INT)) name = "_display_int_array";
+		else if (_child->type() == find<ArrayType>(SYMBOL)) name = "_display_symbol_array";
+		else if (_child->type() == find<ArrayType>(BOOL)) name = "_display_bool_array";
+		else if (_child->type() == find<ArrayType>(STRING)) name = "_display_string_array";
 		func.add(new StoreArgumentInsn(_child->emit(func), 0, _child->type()));
 		Location label;
 		label.type = SSA_LABEL;
@@ -793,13 +1642,35 @@ namespace basil {
     return _ret;
   }
 
+  ASTKind ASTNativeCall::kind() const {
+    return NODE_NATIVE_CALL;
+  }
+
+  void ASTNativeCall::children(vector<ASTNode*>& nodes) {
+    for (ASTNode* n : _args) nodes.push(n);
+  }
+
+  // Natives that don't only read their arguments are assumed to do I/O.
+  u32 ASTNativeCall::lazy_effects() {
+    u32 result = ASTNode::lazy_effects();
+    if (native_pure(_func_name)) return result;
+    return result | EFFECT_IO;
+  }
+
+  bool ASTNativeCall::same(ASTNode* other) {
+    return same_shape(this, other) 
+      && ((ASTNativeCall*)other)->_func_name == _func_name;
+  }
+
   Location ASTNativeCall::emit(Function& func) {
+    Location result = find_available(this);
+    if (result.type != SSA_NONE) return result;
     for (int i = 0; i < _args.size(); i ++)
       func.add(new StoreArgumentInsn(_args[i]->emit(func), i, _args[i]->type()));
 		Location label;
 		label.type = SSA_LABEL;
 		label.label_index = ssa_find_label(_func_name);
-    return func.add(new CallInsn(label, _ret));
+    return make_available(this, func.add(new CallInsn(label, _ret)));
   }
 
   void ASTNativeCall::format(stream& io) const {
@@ -824,10 +1695,24 @@ namespace basil {
     return VOID;
 	}
 
+	ASTKind ASTAssign::kind() const {
+		return NODE_ASSIGN;
+	}
+
+	const Def* ASTAssign::dest() const {
+		return _env->find(symbol_for(_dest));
+	}
+
+	u32 ASTAssign::lazy_effects() {
+		return EFFECT_WRITE | _child->effects();
+	}
+
 	Location ASTAssign::emit(Function& func) {
 		const Def* def = _env->find(symbol_for(_dest));
 		if (!def) return ssa_none();
-		return func.add(new StoreInsn(def->location, _child->emit(func), false));
+		Location result = func.add(new StoreInsn(def->location, _child->emit(func), false));
+		kill(def);
+		return result;
 	}
 
 	void ASTAssign::format(stream& io) const {
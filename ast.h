@@ -14,17 +14,72 @@ namespace basil {
 	class Def;
 	class Env;
 	
+	enum ASTKind {
+		NODE_SINGLETON,
+		NODE_VOID,
+		NODE_INT,
+		NODE_SYMBOL,
+		NODE_STRING,
+		NODE_BOOL,
+		NODE_VAR,
+		NODE_MATH,
+		NODE_LOGIC,
+		NODE_NOT,
+		NODE_EQUAL,
+		NODE_RELATION,
+		NODE_DEFINE,
+		NODE_CALL,
+		NODE_INCOMPLETE_FN,
+		NODE_FUNCTION,
+		NODE_BLOCK,
+		NODE_IF,
+		NODE_WHILE,
+		NODE_IS_EMPTY,
+		NODE_HEAD,
+		NODE_TAIL,
+		NODE_CONS,
+		NODE_LENGTH,
+		NODE_DISPLAY,
+		NODE_NATIVE_CALL,
+		NODE_ASSIGN,
+		NODE_TO_ARRAY,
+		NODE_TO_LIST,
+		NODE_INDEX,
+		NODE_SET_INDEX,
+		NODE_PUSH
+	};
+
+	// What evaluating a node might do, besides computing its value.
+	enum Effect {
+		EFFECT_NONE = 0,
+		EFFECT_IO = 1, // reads input or displays output
+		EFFECT_WRITE = 2, // defines or assigns a variable, or writes to an array
+		EFFECT_ALLOC = 4, // yields a new cell or array, distinct from any other
+		EFFECT_READ = 8, // reads an array, which may since have been written to
+		EFFECT_ANY = 15
+	};
+
 	class ASTNode : public RC {
 		SourceLocation _loc;
 		const Type* _type;
+		i32 _effects;
+		u64 _shape;
 	protected:
 		virtual const Type* lazy_type() = 0;
+		virtual u32 lazy_effects(); // those of its children, by default
+		virtual u64 lazy_shape(); // its kind and its children's shapes, by default
 	public:
 		ASTNode(SourceLocation loc);
 		virtual ~ASTNode();
 
 		SourceLocation loc() const;
 		const Type* type();
+		u32 effects();
+		virtual ASTKind kind() const = 0;
+		virtual void children(vector<ASTNode*>& nodes); // subexpressions, in evaluation order
+		virtual bool same(ASTNode* other); // computes the same value, given the same variables
+		u64 shape(); // a hash of what same() compares, so nodes that are the same hash alike
+		virtual bool cheap(); // no side effects, can't trap, and costs about as much as a branch
 		virtual Location emit(Function& function) = 0;
 		virtual void format(stream& io) const = 0;
 	};
@@ -36,6 +91,7 @@ namespace basil {
 	public:
 		ASTSingleton(const Type* type);
 	
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -46,6 +102,9 @@ namespace basil {
 	public:
 		ASTVoid(SourceLocation loc);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -54,9 +113,13 @@ namespace basil {
 		i64 _value;
 	protected:
 		const Type* lazy_type() override;
+		u64 lazy_shape() override;
 	public:
 		ASTInt(SourceLocation loc, i64 value);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -65,9 +128,13 @@ namespace basil {
 		u64 _value;
 	protected:
 		const Type* lazy_type() override;
+		u64 lazy_shape() override;
 	public:
 		ASTSymbol(SourceLocation loc, u64 value);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -79,6 +146,8 @@ namespace basil {
 	public:
 		ASTString(SourceLocation, const string& value);
 
+		const string& value() const;
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -87,9 +156,13 @@ namespace basil {
 		bool _value;
 	protected:
 		const Type* lazy_type() override;
+		u64 lazy_shape() override;
 	public:
 		ASTBool(SourceLocation loc, bool value);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -99,9 +172,14 @@ namespace basil {
 		u64 _name;
 	protected:
 		const Type* lazy_type() override;
+		u64 lazy_shape() override;
 	public:
 		ASTVar(SourceLocation loc, const ref<Env> env, u64 name);
 
+		const Def* def() const;
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -112,6 +190,8 @@ namespace basil {
 	public:
 		ASTUnary(SourceLocation loc, ASTNode* child);
 		~ASTUnary();
+
+		void children(vector<ASTNode*>& nodes) override;
 	};
 
 	class ASTBinary : public ASTNode {
@@ -120,6 +200,8 @@ namespace basil {
 	public:
 		ASTBinary(SourceLocation loc, ASTNode* left, ASTNode* right);
 		~ASTBinary();
+
+		void children(vector<ASTNode*>& nodes) override;
 	};
 	
 	enum ASTMathOp {
@@ -138,6 +220,9 @@ namespace basil {
 		ASTBinaryMath(SourceLocation loc, ASTMathOp op, 
 			ASTNode* left, ASTNode* right);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -157,6 +242,9 @@ namespace basil {
 		ASTBinaryLogic(SourceLocation loc, ASTLogicOp op, 
 			ASTNode* left, ASTNode* right);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -167,6 +255,9 @@ namespace basil {
 	public:
 		ASTNot(SourceLocation loc, ASTNode* child);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -184,6 +275,9 @@ namespace basil {
 		ASTBinaryEqual(SourceLocation loc, ASTEqualOp op, 
 			ASTNode* left, ASTNode* right);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -203,6 +297,9 @@ namespace basil {
 		ASTBinaryRel(SourceLocation loc, ASTRelOp op, 
 			ASTNode* left, ASTNode* right);
 
+		bool cheap() override;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -212,9 +309,13 @@ namespace basil {
 		u64 _name;
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTDefine(SourceLocation loc, ref<Env> env, u64 name, ASTNode* value);
 
+		const Def* def() const;
+
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -222,12 +323,21 @@ namespace basil {
 	class ASTCall : public ASTNode {
 		ASTNode* _func;
 		vector<ASTNode*> _args;
+		bool _inline;
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTCall(SourceLocation loc, ASTNode* func, const vector<ASTNode*>& args);
 		~ASTCall();
 
+		ASTNode* func() const;
+		const vector<ASTNode*>& args() const;
+		void set_inline(bool should); // emits the callee's body in place of the call
+		bool inlined() const;
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
+		void children(vector<ASTNode*>& nodes) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -240,6 +350,8 @@ namespace basil {
 	public:
 		ASTIncompleteFn(SourceLocation loc, const Type* args, i64 name);
 
+		i64 name() const;
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -254,12 +366,20 @@ namespace basil {
 		u32 _label;
 	protected:
 		const Type* lazy_type() override;
+		u64 lazy_shape() override;
 	public:
 		ASTFunction(SourceLocation loc, ref<Env> env, const Type* args_type, 
 			const vector<u64>& args, ASTNode* body, i64 name = -1);
 		~ASTFunction();
 
+		ASTNode* body() const;
+		i64 name() const;
+		u32 arity() const;
+		const Def* param(u32 i) const; // or null, if the body never names it
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
+		Location emit_inline(Function& function, const vector<Location>& args);
 		void format(stream& io) const override;
 	};
 
@@ -271,6 +391,8 @@ namespace basil {
 		ASTBlock(SourceLocation loc, const vector<ASTNode*>& exprs);
 		~ASTBlock();
 
+		ASTKind kind() const override;
+		void children(vector<ASTNode*>& nodes) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -283,6 +405,8 @@ namespace basil {
 		ASTIf(SourceLocation loc, ASTNode* cond, ASTNode* if_true, ASTNode* if_false);
 		~ASTIf();
 
+		ASTKind kind() const override;
+		void children(vector<ASTNode*>& nodes) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -295,6 +419,8 @@ namespace basil {
 		ASTWhile(SourceLocation loc, ASTNode* cond, ASTNode* body);
 		~ASTWhile();
 
+		ASTKind kind() const override;
+		void children(vector<ASTNode*>& nodes) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -305,6 +431,8 @@ namespace basil {
 	public:
 		ASTIsEmpty(SourceLocation loc, ASTNode* list);
 
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -315,6 +443,8 @@ namespace basil {
 	public:
 		ASTHead(SourceLocation loc, ASTNode* list);
 
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -325,16 +455,22 @@ namespace basil {
 	public:
 		ASTTail(SourceLocation loc, ASTNode* list);
 
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
 
 	class ASTCons : public ASTBinary {
+		bool _local;
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTCons(SourceLocation loc, ASTNode* first, ASTNode* rest);
 
+		void set_local(bool local); // places the cell in the current frame
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -342,9 +478,78 @@ namespace basil {
   class ASTLength : public ASTUnary {
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTLength(SourceLocation loc, ASTNode* child);
 
+		ASTKind kind() const override;
+		bool same(ASTNode* other) override;
+		Location emit(Function& function) override;
+		void format(stream& io) const override;
+	};
+
+	// Copies a list into a new array.
+	class ASTToArray : public ASTUnary {
+	protected:
+		const Type* lazy_type() override;
+		u32 lazy_effects() override;
+	public:
+		ASTToArray(SourceLocation loc, ASTNode* list);
+
+		ASTKind kind() const override;
+		Location emit(Function& function) override;
+		void format(stream& io) const override;
+	};
+
+	// Copies an array into a new list.
+	class ASTToList : public ASTUnary {
+	protected:
+		const Type* lazy_type() override;
+		u32 lazy_effects() override;
+	public:
+		ASTToList(SourceLocation loc, ASTNode* array);
+
+		ASTKind kind() const override;
+		Location emit(Function& function) override;
+		void format(stream& io) const override;
+	};
+
+	class ASTIndex : public ASTBinary {
+	protected:
+		const Type* lazy_type() override;
+		u32 lazy_effects() override;
+	public:
+		ASTIndex(SourceLocation loc, ASTNode* array, ASTNode* index);
+
+		ASTKind kind() const override;
+		Location emit(Function& function) override;
+		void format(stream& io) const override;
+	};
+
+	class ASTSetIndex : public ASTNode {
+		ASTNode *_array, *_index, *_value;
+	protected:
+		const Type* lazy_type() override;
+		u32 lazy_effects() override;
+	public:
+		ASTSetIndex(SourceLocation loc, ASTNode* array, ASTNode* index, ASTNode* value);
+		~ASTSetIndex();
+
+		ASTKind kind() const override;
+		void children(vector<ASTNode*>& nodes) override;
+		Location emit(Function& function) override;
+		void format(stream& io) const override;
+	};
+
+	// Appends a value to an array, growing it in place if it's full.
+	class ASTPush : public ASTBinary {
+	protected:
+		const Type* lazy_type() override;
+		u32 lazy_effects() override;
+	public:
+		ASTPush(SourceLocation loc, ASTNode* array, ASTNode* value);
+
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -352,9 +557,11 @@ namespace basil {
 	class ASTDisplay : public ASTUnary {
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTDisplay(SourceLocation loc, ASTNode* node);
 
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
@@ -366,11 +573,15 @@ namespace basil {
       const vector<const Type*> _arg_types;
     protected:
       const Type* lazy_type() override;
+      u32 lazy_effects() override;
     public:
       ASTNativeCall(SourceLocation loc, const string &func_name, const Type* ret);
       // TODO make args a variadic template instead of a vector
       ASTNativeCall(SourceLocation loc, const string &func_name, const Type *ret, const vector<ASTNode*>& args, const vector<const Type*>& arg_types);
 			~ASTNativeCall();
+      ASTKind kind() const override;
+      bool same(ASTNode* other) override;
+      void children(vector<ASTNode*>& nodes) override;
       Location emit(Function& function) override;
       void format(stream& io) const override;
   };
@@ -380,13 +591,23 @@ namespace basil {
 		u64 _dest;
 	protected:
 		const Type* lazy_type() override;
+		u32 lazy_effects() override;
 	public:
 		ASTAssign(SourceLocation loc, const ref<Env> env, 
 			u64 dest, ASTNode* src);
 
+		const Def* dest() const;
+
+		ASTKind kind() const override;
 		Location emit(Function& function) override;
 		void format(stream& io) const override;
 	};
+
+	// Common subexpression elimination, as nodes are emitted: a pure node
+	// the same as one already computed on every path to it reuses its 
+	// result.
+	void cse_enabled(bool enabled);
+	u64 cse_reused();
 }
 
 void write(stream& io, basil::ASTNode* t); 
@@ -0,0 +1,101 @@
+// Measures how quickly jasmine encodes the instruction mix basil's code
+// generator produces, with and without the table-driven encoder, and
+// checks that both produce the same machine code.
+
+#include "jasmine/x64.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace x64;
+
+static const Register registers[] = {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+static const i64 displacements[] = { 0, 8, -16, 120, 4096, -70000 };
+static const i64 immediates[] = { 0, 1, -1, 100, -128, 1000, 0x7fffffff };
+
+static u64 state = 0x9e3779b97f4a7c15ul;
+
+static u64 next() {
+    state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+    return state;
+}
+
+template<typename T, u64 N>
+static const T& pick(const T (&options)[N]) {
+    return options[next() % N];
+}
+
+static Arg memory() {
+    Register base = pick(registers);
+    if (next() % 4) return m64(base, pick(displacements));
+    Register index = pick(registers);
+    while (index == RSP) index = pick(registers);
+    return m64(base, index, Scale(next() % 4), pick(displacements));
+}
+
+static Arg operand(bool allow_memory, bool allow_immediate) {
+    u64 kind = next() % 3;
+    if (kind == 1 && allow_memory) return memory();
+    if (kind == 2 && allow_immediate) return imm(pick(immediates));
+    return r64(pick(registers));
+}
+
+static void (*const ops[])(const Arg&, const Arg&, Size) = {
+    add, or_, and_, sub, xor_, cmp, mov, mov, mov
+};
+
+struct Recorded {
+    u32 op;
+    Arg dest, src;
+};
+
+static vector<Recorded> program;
+
+static u64 encode_all(jasmine::Object& obj) {
+    writeto(obj);
+    obj.code().clear();
+    for (const Recorded& insn : program) ops[insn.op](insn.dest, insn.src, AUTO);
+    return obj.code().size();
+}
+
+static double measure(bool table, u32 rounds, jasmine::Object& obj) {
+    table_encoding(table);
+    auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < rounds; i ++) encode_all(obj);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return program.size() * double(rounds) / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    for (u32 i = 0; i < 100000; i ++) {
+        Recorded insn;
+        insn.op = next() % (sizeof(ops) / sizeof(ops[0]));
+        insn.dest = operand(true, false);
+        insn.src = operand(!is_memory(insn.dest.type), true);
+        program.push(insn);
+    }
+
+    jasmine::Object general, table;
+    table_encoding(false);
+    u64 size = encode_all(general);
+    table_encoding(true);
+    if (encode_all(table) != size) {
+        fprintf(stderr, "[ERROR] Encoders produced different amounts of code.\n");
+        return 1;
+    }
+    for (u64 i = 0; i < size; i ++) {
+        if (general.code().read() != table.code().read()) {
+            fprintf(stderr, "[ERROR] Encoders differ at byte %lu.\n", i);
+            return 1;
+        }
+    }
+
+    u32 rounds = argc > 1 ? atoi(argv[1]) : 50;
+    double before = measure(false, rounds, general), after = measure(true, rounds, table);
+    printf("general encoder: %.1fM insns/sec\n", before / 1000000);
+    printf("table encoder:   %.1fM insns/sec (%.2fx)\n", after / 1000000, after / before);
+    return 0;
+}
@@ -4,9 +4,14 @@
 #include "errors.h"
 #include "values.h"
 #include "native.h"
+#include "gc.h"
 #include "eval.h"
 #include "ssa.h"
 #include "ast.h"
+#include "peephole.h"
+#include "opt.h"
+#include "inline.h"
+#include "escape.h"
 #include "util/io.h"
 
 namespace basil {
@@ -14,7 +19,9 @@ namespace basil {
 		_print_parsed = false,
 		_print_ast = false,
 		_print_ssa = false,
-		_print_asm = false;
+		_print_asm = false,
+		_print_stats = false,
+		_print_gc_stats = false;
 
 	void print_tokens(bool should) {
 		_print_tokens = should;
@@ -36,6 +43,14 @@ namespace basil {
 		_print_asm = should;
 	}
 
+	void print_stats(bool should) {
+		_print_stats = should;
+	}
+
+	void print_gc_stats(bool should) {
+		_print_gc_stats = should;
+	}
+
 	vector<Token> lex(Source::View& view) {
 		vector<Token> tokens;
 		while (view.peek()) tokens.push(scan(view));
@@ -70,6 +85,7 @@ namespace basil {
 	}
 
 	void compile(Value value, Object& object, Function& fn) {
+		optimize(fn);
 		fn.allocate();
 		fn.emit(object);
 		ssa_emit_constants(object);
@@ -85,6 +101,23 @@ namespace basil {
 		add_native_functions(object);
 
 		object.load();
+		ssa_resolve_safepoints(object);
+
+		if (_print_stats) {
+			print(BOLDYELLOW);
+			println("inline: ", inlined_calls(), " calls inlined");
+			println("cse: ", cse_reused(), " expressions reused");
+			println("peephole: removed ", peephole_removed_insns(), " instructions (",
+				peephole_removed_bytes(), " bytes)");
+			println("relax: ", ssa_short_jumps(), " jumps encoded short");
+			println("alloc: ", ssa_inline_allocs(), " list cells allocated inline");
+			println("escape: ", local_cells(), " cons expressions kept local, ",
+				ssa_stack_cells(), " cells placed in frames");
+			println("reduce: ", native_reductions(), " reduce calls run natively, with ",
+				simd_kernels(), " kernels");
+			print_opt_stats(_stdout);
+			println(RESET);
+		}
 	}
 
 	void generate(Value value, Function& fn) {
@@ -120,6 +153,7 @@ namespace basil {
 		auto main_jit = object.find(jasmine::global("main"));
 		if (main_jit) {
 			u64 result = ((u64(*)())main_jit)();
+			if (_print_gc_stats) print_heap_stats(_stdout);
 			const Type* t = value.get_runtime()->type();
 			if (t == VOID) return;
 			print("= ");
@@ -129,14 +163,17 @@ namespace basil {
 			else if (t == BOOL) print((bool)result);
 			else if (t == STRING) print('"', (const char*)result, '"');
 			else if (t->kind() == KIND_LIST) display_native_list(t, (void*)result);
+			else if (t->kind() == KIND_ARRAY) display_native_array(t, (const void*)result);
 			println("");
 		}
 	}
 
 	int execute(Value value, const Object& object) {
 		auto main_jit = object.find(jasmine::global("main"));
-		if (main_jit) return ((i64(*)())main_jit)();
-		return 1;
+		if (!main_jit) return 1;
+		i64 result = ((i64(*)())main_jit)();
+		if (_print_gc_stats) print_heap_stats(_stdout);
+		return result;
 	}
 
 	Value repl(ref<Env> global, Source& src, Function& mainfn) {
@@ -161,6 +198,8 @@ namespace basil {
 		if (_print_ast) 
 			println(BOLDCYAN, result.get_runtime(), RESET, "\n");
 
+		inline_calls(result.get_runtime());
+		find_local_cells(result.get_runtime());
 		jasmine::Object object;
 		generate(result, mainfn);
 		compile(result, object, mainfn);
@@ -209,6 +248,8 @@ namespace basil {
 		if (_print_ast) 
 			println(BOLDCYAN, result.get_runtime(), RESET, "\n");
 
+		inline_calls(result.get_runtime());
+		find_local_cells(result.get_runtime());
 		jasmine::Object object;
 		compile(result, object);
 		if (error_count()) return print_errors(_stdout), 1;
@@ -12,6 +12,8 @@ namespace basil {
 	void print_ast(bool should);
 	void print_ssa(bool should);
 	void print_asm(bool should);
+	void print_stats(bool should);
+	void print_gc_stats(bool should);
 
 	Value repl(ref<Env> global, Source& src, Function& mainfn);
 	ref<Env> load(Source& src);
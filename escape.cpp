@@ -0,0 +1,248 @@
+#include "escape.h"
+#include "env.h"
+#include "util/hash.h"
+
+namespace basil {
+	static bool _enabled = true;
+	static u64 _local = 0;
+
+	void escape_enabled(bool enabled) {
+		_enabled = enabled;
+	}
+
+	u64 local_cells() {
+		return _local;
+	}
+
+	// The cells a value may point to, directly or through other cells: the
+	// cons expressions that may have built them, and the parameters of the
+	// function being analyzed that may have passed them in.
+	struct Flow {
+		set<ASTCons*> cells;
+		u64 params; // one bit per parameter, for the first 64
+
+		Flow(): params(0) {}
+	};
+
+	static void merge(Flow& dest, const Flow& src) {
+		for (ASTCons* cons : src.cells) dest.cells.insert(cons);
+		dest.params |= src.params;
+	}
+
+	// What calling a function out of line does with the cells passed to
+	// it: which parameters may be kept past the call, and which returned.
+	struct Summary {
+		u64 escapes, returned;
+		bool done; // false while its body is still being looked at
+	};
+
+	// The frame cells are being placed in: the variables of the function
+	// that owns it, and of any bodies inlined into it.
+	//
+	// A cons within a loop fills in the same cell on every iteration, so
+	// its cell can only be kept by variables bound anew each time round -
+	// those defined at least as deep in loops, and not under an if, which
+	// might leave them pointing to the last iteration's cell.
+	struct Context {
+		map<const Def*, Flow> vars;
+		map<const Def*, u32> depths; // loops each variable is bound anew within
+		map<ASTCons*, u32> made; // loops each cell is filled in within
+		u64 escapes; // parameters whose cells may outlive the frame
+		u32 loops; // while loops around the current node
+		u32 branches; // ifs around the current node, within the innermost loop
+
+		Context(): escapes(0), loops(0), branches(0) {}
+	};
+
+	static map<ASTFunction*, Summary> summaries;
+	static ASTFunction* current = nullptr; // whose summary is being found
+	static set<ASTCons*> seen, escaped;
+
+	static void escape(Context& ctx, const Flow& flow) {
+		for (ASTCons* cons : flow.cells) escaped.insert(cons);
+		ctx.escapes |= flow.params;
+	}
+
+	static Flow flow(ASTNode* node, Context& ctx);
+	static Summary summarize(ASTFunction* fn);
+
+	static void bind(Context& ctx, const Def* def, const Flow& value, u32 depth) {
+		auto it = ctx.depths.find(def);
+		if (it == ctx.depths.end() || depth < it->second) ctx.depths[def] = depth;
+		depth = ctx.depths[def];
+		for (ASTCons* cons : value.cells) if (ctx.made[cons] > depth) escaped.insert(cons);
+		merge(ctx.vars[def], value);
+	}
+
+	// total size of the variables' flows, which only ever grow
+	static u64 weight(Context& ctx) {
+		u64 total = 0;
+		for (auto& entry : ctx.vars)
+			total += entry.second.cells.size() + __builtin_popcountl(entry.second.params);
+		return total;
+	}
+
+	static Flow flow_call(ASTCall* call, Context& ctx) {
+		vector<Flow> args;
+		for (ASTNode* arg : call->args()) args.push(flow(arg, ctx));
+		Flow result;
+		if (call->inlined()) { // the body runs in this frame, on these arguments
+			ASTFunction* fn = (ASTFunction*)call->func();
+			for (u32 i = 0; i < fn->arity(); i ++) // bound right before they're used
+				if (fn->param(i)) bind(ctx, fn->param(i), args[i], ctx.loops);
+			return flow(fn->body(), ctx);
+		}
+		Summary s = { ~0ul, 0, false }; // a callee we can't see keeps everything
+		bool self = false;
+		if (call->func()->kind() == NODE_FUNCTION) {
+			s = summarize((ASTFunction*)call->func());
+			self = call->func() == current;
+		}
+		else if (call->func()->kind() == NODE_INCOMPLETE_FN && current) { // calls by name
+			i64 name = ((ASTIncompleteFn*)call->func())->name();
+			if (name != -1 && name == current->name() && args.size() == current->arity())
+				s = summaries[current], self = true;
+		}
+		else flow(call->func(), ctx);
+		for (u32 i = 0; i < args.size(); i ++) {
+			if (self) { // the call may become a jump back to the top, reusing this frame
+				for (ASTCons* cons : args[i].cells) escaped.insert(cons);
+				args[i].cells = set<ASTCons*>();
+			}
+			if ((!s.done && !self) || i >= 64 || s.escapes >> i & 1) escape(ctx, args[i]);
+			else if (s.returned >> i & 1) merge(result, args[i]);
+		}
+		return result;
+	}
+
+	static Flow flow_node(ASTNode* node, Context& ctx) {
+		Flow result;
+		vector<ASTNode*> children;
+		node->children(children);
+		switch (node->kind()) {
+			case NODE_CONS: {
+				ASTCons* cons = (ASTCons*)node;
+				for (ASTNode* child : children) merge(result, flow(child, ctx));
+				seen.insert(cons);
+				result.cells.insert(cons);
+				if (ctx.made[cons] < ctx.loops) ctx.made[cons] = ctx.loops;
+				return result;
+			}
+			case NODE_VAR: {
+				auto it = ctx.vars.find(((ASTVar*)node)->def());
+				if (it != ctx.vars.end()) result = it->second;
+				return result;
+			}
+			case NODE_DEFINE: {
+				Flow value = flow(children[0], ctx);
+				bind(ctx, ((ASTDefine*)node)->def(), value, ctx.branches ? ctx.loops - 1 : ctx.loops);
+				return result;
+			}
+			case NODE_ASSIGN: {
+				result = flow(children[0], ctx);
+				const Def* dest = ((ASTAssign*)node)->dest();
+				if (ctx.vars.find(dest) == ctx.vars.end()) escape(ctx, result); // some other frame's
+				else bind(ctx, dest, result, ctx.depths[dest]);
+				return result;
+			}
+			case NODE_CALL:
+				return flow_call((ASTCall*)node, ctx);
+			case NODE_FUNCTION:
+				summarize((ASTFunction*)node);
+				return result;
+			case NODE_BLOCK:
+				for (ASTNode* child : children) result = flow(child, ctx);
+				return result;
+			case NODE_IF:
+				flow(children[0], ctx);
+				if (ctx.loops) ctx.branches ++;
+				for (u32 i = 1; i < children.size(); i ++) merge(result, flow(children[i], ctx));
+				if (ctx.loops) ctx.branches --;
+				return result;
+			case NODE_WHILE: { // until what the variables may hold stops growing
+				u32 branches = ctx.branches;
+				u64 before;
+				ctx.loops ++, ctx.branches = 0;
+				do {
+					before = weight(ctx);
+					for (ASTNode* child : children) flow(child, ctx);
+				} while (weight(ctx) != before);
+				ctx.loops --, ctx.branches = branches;
+				return result;
+			}
+			case NODE_HEAD:
+			case NODE_TAIL:
+				return flow(children[0], ctx);
+			case NODE_SINGLETON:
+			case NODE_VOID:
+			case NODE_INT:
+			case NODE_SYMBOL:
+			case NODE_STRING:
+			case NODE_BOOL:
+			case NODE_INCOMPLETE_FN:
+			case NODE_MATH:
+			case NODE_LOGIC:
+			case NODE_NOT:
+			case NODE_EQUAL:
+			case NODE_RELATION:
+			case NODE_IS_EMPTY:
+			case NODE_LENGTH:
+			case NODE_DISPLAY:
+			case NODE_NATIVE_CALL: // these read lists, but never keep them
+				for (ASTNode* child : children) flow(child, ctx);
+				return result;
+			default:
+				for (ASTNode* child : children) escape(ctx, flow(child, ctx));
+				return result;
+		}
+	}
+
+	// Finds what fn does with its arguments. Calls it makes to itself
+	// are assumed to do what's been found so far, until that stops
+	// changing; calls to others still being looked at keep everything.
+	static Summary summarize(ASTFunction* fn) {
+		auto it = summaries.find(fn);
+		if (it != summaries.end()) return it->second;
+		summaries.put(fn, { 0, 0, false });
+
+		ASTFunction* outer = current;
+		current = fn;
+		Summary before;
+		do {
+			before = summaries[fn];
+			Context ctx;
+			for (u32 i = 0; i < fn->arity() && i < 64; i ++) {
+				if (!fn->param(i)) continue;
+				Flow param;
+				param.params = 1ul << i;
+				bind(ctx, fn->param(i), param, 0);
+			}
+			Flow result = flow(fn->body(), ctx);
+			for (ASTCons* cons : result.cells) escaped.insert(cons);
+			summaries[fn] = { ctx.escapes, result.params, false };
+		} while (summaries[fn].escapes != before.escapes || summaries[fn].returned != before.returned);
+		current = outer;
+		summaries[fn].done = true;
+		return summaries[fn];
+	}
+
+	static Flow flow(ASTNode* node, Context& ctx) {
+		Flow result = flow_node(node, ctx);
+		if (node->type()->concretify()->kind() == KIND_SINGLETON) return Flow(); // no pointers in it
+		return result;
+	}
+
+	void find_local_cells(ASTNode* root) {
+		if (!_enabled) return;
+		summaries = map<ASTFunction*, Summary>();
+		current = nullptr;
+		seen = set<ASTCons*>(), escaped = set<ASTCons*>();
+		Context ctx;
+		escape(ctx, flow(root, ctx)); // the program's result is read after it returns
+		for (ASTCons* cons : seen) {
+			if (escaped.find(cons) != escaped.end()) continue;
+			cons->set_local(true);
+			_local ++;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef BASIL_ESCAPE_H
+#define BASIL_ESCAPE_H
+
+#include "util/defs.h"
+#include "ast.h"
+
+namespace basil {
+	void escape_enabled(bool enabled);
+
+	// Marks cons expressions within root whose cells can't outlive the
+	// frame they're built in - never returned, passed where they may be
+	// kept, or stored anywhere but that frame's variables - so they can be
+	// placed in the frame instead of the heap. Run after inlining, since a
+	// body emitted in place shares its caller's frame.
+	void find_local_cells(ASTNode* root);
+
+	u64 local_cells(); // cons expressions marked so far
+}
+
+#endif
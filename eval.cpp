@@ -117,6 +117,42 @@ namespace basil {
     return char_at(args.get_product()[0], args.get_product()[1]);
   }
 
+  Value builtin_to_array(ref<Env> env, const Value& args) {
+    return to_array(args.get_product()[0]);
+  }
+
+  Value builtin_to_list(ref<Env> env, const Value& args) {
+    return to_list(args.get_product()[0]);
+  }
+
+  Value builtin_set_at(ref<Env> env, const Value& args) {
+    return set_at(args.get_product()[0], args.get_product()[1], args.get_product()[2]);
+  }
+
+  Value builtin_push(ref<Env> env, const Value& args) {
+    return push(args.get_product()[0], args.get_product()[1]);
+  }
+
+  Value builtin_sum(ref<Env> env, const Value& args) {
+    return reduce(args.get_product()[0], REDUCE_SUM);
+  }
+
+  Value builtin_min(ref<Env> env, const Value& args) {
+    return reduce(args.get_product()[0], REDUCE_MIN);
+  }
+
+  Value builtin_max(ref<Env> env, const Value& args) {
+    return reduce(args.get_product()[0], REDUCE_MAX);
+  }
+
+  Value builtin_count(ref<Env> env, const Value& args) {
+    return count(args.get_product()[0], args.get_product()[1]);
+  }
+
+  Value builtin_dot(ref<Env> env, const Value& args) {
+    return dot(args.get_product()[0], args.get_product()[1]);
+  }
+
 	Value builtin_if_macro(ref<Env> env, const Value& args) {
 		return list_of(Value("#?"), args.get_product()[0],
 			list_of(Value("quote"), args.get_product()[1]),
@@ -180,6 +216,15 @@ namespace basil {
     root->def("read-int", new FunctionValue(root, builtin_read_int, 0), 0);
     root->infix("length", new FunctionValue(root, builtin_length, 1), 1, 50);
     root->infix("at", new FunctionValue(root, builtin_char_at, 2), 2, 90);
+    root->infix("to-array", new FunctionValue(root, builtin_to_array, 1), 1, 50);
+    root->infix("to-list", new FunctionValue(root, builtin_to_list, 1), 1, 50);
+    root->infix("set", new FunctionValue(root, builtin_set_at, 3), 3, 0);
+    root->infix("push", new FunctionValue(root, builtin_push, 2), 2, 0);
+    root->infix("sum", new FunctionValue(root, builtin_sum, 1), 1, 50);
+    root->infix("min", new FunctionValue(root, builtin_min, 1), 1, 50);
+    root->infix("max", new FunctionValue(root, builtin_max, 1), 1, 50);
+    root->infix("count", new FunctionValue(root, builtin_count, 2), 2, 50);
+    root->infix("dot", new FunctionValue(root, builtin_dot, 2), 2, 50);
     root->def("true", Value(true, BOOL));
     root->def("false", Value(false, BOOL));
     return root;
@@ -862,6 +907,44 @@ namespace basil {
 		return false;
 	}
 
+	// Whether sym names the builtin procedure fn within env.
+	static bool names_builtin(const ref<Env> env, const Value& sym, BuiltinFn fn) {
+		if (!sym.is_symbol()) return false;
+		const Def* def = env->find(symbol_for(sym.get_symbol()));
+		return def && def->value.is_function() && def->value.get_function().is_builtin()
+			&& def->value.get_function().get_builtin() == fn;
+	}
+
+	Reduction find_reduction(const FunctionValue& fn) {
+		if (fn.is_builtin() || fn.arity() != 2) return REDUCE_NONE;
+		u64 x = fn.args()[0], y = fn.args()[1];
+		if ((x | y) & KEYWORD_ARG_BIT || x == y) return REDUCE_NONE;
+		vector<Value> body = to_vector(fn.body()); // (do <expr>)
+		if (body.size() != 2) return REDUCE_NONE;
+		vector<Value> expr = to_vector(body[1]);
+		auto is_arg = [&](const Value& v, u64 arg) { return v.is_symbol() && v.get_symbol() == arg; };
+		auto args = [&](const Value& a, const Value& b) {
+			return (is_arg(a, x) && is_arg(b, y)) || (is_arg(a, y) && is_arg(b, x));
+		};
+
+		// (+ x y)
+		if (expr.size() == 3 && names_builtin(fn.get_env(), expr[0], builtin_add) 
+			&& args(expr[1], expr[2])) return REDUCE_SUM;
+
+		// (if (< a b) a else b), and the like
+		if (expr.size() != 5 || !is_keyword(expr[0], "if") || !is_keyword(expr[3], "else")) 
+			return REDUCE_NONE;
+		vector<Value> cond = to_vector(expr[1]);
+		if (cond.size() != 3 || !args(cond[1], cond[2]) || !args(expr[2], expr[4])) return REDUCE_NONE;
+		bool less = names_builtin(fn.get_env(), cond[0], builtin_less) 
+			|| names_builtin(fn.get_env(), cond[0], builtin_less_equal);
+		bool greater = names_builtin(fn.get_env(), cond[0], builtin_greater) 
+			|| names_builtin(fn.get_env(), cond[0], builtin_greater_equal);
+		if (!less && !greater) return REDUCE_NONE;
+		bool first = is_arg(expr[2], cond[1].get_symbol()); // picks the left operand if true
+		return less == first ? REDUCE_MIN : REDUCE_MAX;
+	}
+
   Value if_expr(ref<Env> env, const Value& term) {
     Value params = tail(term);
 		prep(env, params);
@@ -1025,6 +1108,13 @@ namespace basil {
 		return Value(VOID);
 	}
 
+	bool is_std_reduce(const FunctionValue& fn) {
+		auto it = modules.find("std/list.bl");
+		if (it == modules.end()) return false;
+		const Def* def = it->second.env->find("reduce");
+		return def && def->value.is_function() && &def->value.get_function() == &fn;
+	}
+
   Value eval_list(ref<Env> env, const Value& term) {
     Value h = head(term);
     if (h.is_symbol()) {
@@ -1048,7 +1138,7 @@ namespace basil {
       const Value* v = &term.get_list().tail();
 			u32 i = 0;
       while (v->is_list()) {
-				if (i < first.get_macro().arity()
+				if (i < first.get_macro().args().size() // builtins have no keywords
 						&& first.get_macro().args()[i] & KEYWORD_ARG_BIT
 						&& v->get_list().head().is_symbol())
 					args.push(list_of(Value("quote"), v->get_list().head())); 
@@ -1070,7 +1160,7 @@ namespace basil {
       const Value* v = &args_term;
 			u32 i = 0;
       while (v->is_list()) {
-				if (i < first.get_function().arity()
+				if (i < first.get_function().args().size() // builtins have no keywords
 					&& first.get_function().args()[i] & KEYWORD_ARG_BIT
 					&& v->get_list().head().is_symbol()) {
 					args.push(v->get_list().head()); // leave keywords quoted
@@ -10,6 +10,13 @@ namespace basil {
 
 	bool introduces_env(const Value& list);
 
+	// Which reduction fn performs on its two arguments, if its body just
+	// adds them, or picks the lesser or greater with a builtin comparison.
+	Reduction find_reduction(const FunctionValue& fn);
+
+	// Whether fn is std/list's reduce, not just some procedure by that name.
+	bool is_std_reduce(const FunctionValue& fn);
+
 	void prep(ref<Env> env, Value& term);
   Value eval(ref<Env> env, Value term);
 }
@@ -0,0 +1,267 @@
+#include "gc.h"
+#include "util/hash.h"
+#include <cstdlib>
+#include <ctime>
+
+namespace basil {
+	// The heap is a list of CHUNK_SIZE-aligned chunks, so the chunk holding
+	// an object is found by masking its address. Cell chunks hold 16-byte
+	// list cells and a bitmap of which survived the last collection; cells
+	// are bump-allocated from the runs between survivors. String chunks
+	// hold strings and arrays back to back, and are only freed once none
+	// of them are reachable. Nothing is ever moved, so the collector only has to find
+	// the pointers in each frame, never update them.
+	static const u64 CHUNK_SIZE = 1 << 20, CELL_SIZE = 16, CELLS = CHUNK_SIZE / CELL_SIZE;
+
+	enum ChunkKind : u8 {
+		CELL_CHUNK, STRING_CHUNK
+	};
+
+	struct Chunk {
+		ChunkKind kind;
+		bool marked; // some string in it is reachable
+		u64 size;
+		u64 marks[CELLS / 64]; // one bit per cell
+	};
+
+	static const u64 FIRST_CELL = (sizeof(Chunk) + CELL_SIZE - 1) / CELL_SIZE;
+	static const u64 MIN_COLLECT = 4 << 20; // bytes allocated before the first collection
+
+	// compiled code runs on one thread at a time, so the chunks are shared
+	static vector<Chunk*> chunks;
+	static set<u64> chunk_bases;
+	static thread_local Region cells = { nullptr, nullptr }, strings = { nullptr, nullptr };
+	static u64 cursor = 0, cursor_cell = FIRST_CELL; // where to look for the next run of free cells
+	static u8* run_start = nullptr; // of the run cells are being allocated from
+	static u64 allocated = 0, next_collection = MIN_COLLECT;
+	static u64 collections = 0, total_allocated = 0, live_bytes = 0, heap_bytes = 0, peak_bytes = 0;
+	static clock_t paused = 0;
+
+	static map<u64, Safepoint> safepoints; // by return address
+
+	bool gc_traced(const Type* t) {
+		t = t->concretify();
+		return t == STRING || t->kind() == KIND_LIST || t->kind() == KIND_ARRAY;
+	}
+
+	void gc_clear_safepoints() {
+		safepoints = map<u64, Safepoint>();
+	}
+
+	void gc_add_safepoint(const void* ret, const Safepoint& safepoint) {
+		safepoints.put(u64(ret), safepoint);
+	}
+
+	Region* gc_region() {
+		return &cells;
+	}
+
+	static Chunk* new_chunk(ChunkKind kind, u64 size) {
+		Chunk* chunk = (Chunk*)aligned_alloc(CHUNK_SIZE, size);
+		chunk->kind = kind, chunk->marked = false, chunk->size = size;
+		for (u64& word : chunk->marks) word = 0;
+		chunks.push(chunk);
+		chunk_bases.insert(u64(chunk));
+		heap_bytes += size;
+		if (heap_bytes > peak_bytes) peak_bytes = heap_bytes;
+		return chunk;
+	}
+
+	static Chunk* last_chunk = nullptr; // lists are mostly allocated in order
+
+	static Chunk* chunk_of(const void* p) {
+		u64 base = u64(p) & ~(CHUNK_SIZE - 1);
+		if (base == u64(last_chunk)) return last_chunk;
+		if (chunk_bases.find(base) == chunk_bases.end()) return nullptr;
+		return last_chunk = (Chunk*)base;
+	}
+
+	// counts the cells allocated from the current run, inline or not
+	static void count_cells() {
+		total_allocated += cells.ptr - run_start;
+		run_start = cells.ptr;
+	}
+
+	static bool marked(const Chunk* chunk, u64 cell) {
+		return chunk->marks[cell / 64] >> (cell % 64) & 1;
+	}
+
+	static void mark(const void* p, const Type* t);
+
+	// Marks an array's header and elements, and what its elements reach,
+	// once per collection.
+	static void mark_array(Array* array, const Type* t) {
+		if (array->mark == collections) return;
+		array->mark = collections;
+		chunk_of(array)->marked = true;
+		chunk_of(array->elements)->marked = true;
+		const Type* element = ((const ArrayType*)t)->element()->concretify();
+		if (gc_traced(element))
+			for (i64 i = 0; i < array->length; i ++) mark((const void*)array->elements[i], element);
+	}
+
+	// Marks everything reachable from p, a value of type t. Strings that
+	// aren't in the heap, like constants, are left alone; list cells that
+	// aren't are in some frame, and are followed but not marked.
+	static void mark(const void* p, const Type* t) {
+		t = t->concretify();
+		while (p) {
+			Chunk* chunk = chunk_of(p);
+			if (!chunk && t->kind() != KIND_LIST) return;
+			if (chunk && chunk->kind == STRING_CHUNK) {
+				if (t == STRING) chunk->marked = true;
+				else if (t->kind() == KIND_ARRAY) mark_array((Array*)p, t);
+				return;
+			}
+			if (chunk) {
+				u64 offset = u64(p) - u64(chunk), cell = offset / CELL_SIZE;
+				if (t->kind() != KIND_LIST || offset % CELL_SIZE || cell < FIRST_CELL) return;
+				if (marked(chunk, cell)) return;
+				chunk->marks[cell / 64] |= 1ul << (cell % 64);
+				live_bytes += CELL_SIZE;
+			}
+
+			const Type* element = ((const ListType*)t)->element()->concretify();
+			if (gc_traced(element)) mark(*(void**)p, element);
+			p = *((void**)p + 1);
+		}
+	}
+
+	// Frees unreachable string chunks, and cell chunks with nothing in them
+	// beyond what the next collection's worth of allocation will reuse.
+	static void sweep() {
+		vector<Chunk*> kept;
+		last_chunk = nullptr;
+		u64 spare = next_collection / CHUNK_SIZE;
+		for (Chunk* chunk : chunks) {
+			bool live = chunk->marked;
+			if (chunk->kind == CELL_CHUNK) for (u64 word : chunk->marks) live = live || word;
+			if (chunk->kind == STRING_CHUNK && live) live_bytes += chunk->size;
+			if (!live && (chunk->kind == STRING_CHUNK || !spare)) {
+				chunk_bases.erase(u64(chunk));
+				heap_bytes -= chunk->size;
+				free(chunk);
+				continue;
+			}
+			if (!live) spare --;
+			kept.push(chunk);
+		}
+		chunks = kept;
+	}
+
+	// Finds the roots in each compiled frame on the stack, starting from the
+	// one that called the native at frame, and marks what they reach. Does
+	// nothing if the native wasn't called from a safepoint.
+	static void collect(void* frame, i64 value, void* next) {
+		const u8* sp = (const u8*)frame + 16;
+		auto it = safepoints.find(*(const u64*)((const u8*)frame + 8));
+		if (it == safepoints.end()) return;
+
+		clock_t start = clock();
+		count_cells();
+		collections ++, live_bytes = 0;
+		for (Chunk* chunk : chunks) {
+			chunk->marked = false;
+			for (u64& word : chunk->marks) word = 0;
+		}
+		if (it->second.cons) { // the cell being built isn't anywhere else yet
+			const Type* element = ((const ListType*)it->second.cons)->element();
+			mark(next, it->second.cons);
+			if (gc_traced(element)) mark((const void*)value, element);
+		}
+		while (it != safepoints.end()) {
+			for (const Root& root : it->second.roots) mark(*(void* const*)(sp + root.offset), root.type);
+			u64 ret = *(const u64*)(sp + it->second.frame);
+			sp += it->second.frame + 8;
+			it = safepoints.find(ret);
+		}
+		if (strings.ptr) chunk_of(strings.ptr - 1)->marked = true; // still being filled
+		sweep();
+
+		cells = { nullptr, nullptr };
+		run_start = nullptr;
+		cursor = 0, cursor_cell = FIRST_CELL;
+		allocated = 0;
+		next_collection = live_bytes > MIN_COLLECT ? live_bytes : MIN_COLLECT;
+		paused += clock() - start;
+	}
+
+	// Points the cell region at the next run of cells free since the last
+	// collection, or at a new chunk.
+	static void refill_cells() {
+		count_cells();
+		for (; cursor < chunks.size(); cursor ++, cursor_cell = FIRST_CELL) {
+			Chunk* chunk = chunks[cursor];
+			if (chunk->kind != CELL_CHUNK) continue;
+			while (cursor_cell < CELLS && marked(chunk, cursor_cell)) cursor_cell ++;
+			if (cursor_cell == CELLS) continue;
+			u64 end = cursor_cell;
+			while (end < CELLS && !marked(chunk, end)) end ++;
+			cells.ptr = run_start = (u8*)chunk + cursor_cell * CELL_SIZE, cells.limit = (u8*)chunk + end * CELL_SIZE;
+			allocated += (end - cursor_cell) * CELL_SIZE;
+			cursor_cell = end;
+			return;
+		}
+		Chunk* chunk = new_chunk(CELL_CHUNK, CHUNK_SIZE);
+		cursor = chunks.size();
+		cells.ptr = run_start = (u8*)chunk + FIRST_CELL * CELL_SIZE, cells.limit = (u8*)chunk + CHUNK_SIZE;
+		allocated += CHUNK_SIZE - FIRST_CELL * CELL_SIZE;
+	}
+
+	void* gc_alloc_cell(i64 value, void* next, void* frame) {
+		if (u64(cells.limit - cells.ptr) < CELL_SIZE) {
+			if (allocated >= next_collection) collect(frame, value, next);
+			refill_cells();
+		}
+		void** cell = (void**)cells.ptr;
+		cells.ptr += CELL_SIZE;
+		cell[0] = (void*)value, cell[1] = next;
+		return cell;
+	}
+
+	void* gc_alloc_string(u64 size, void* frame) {
+		size = (size + 7) & ~u64(7);
+		if (u64(strings.limit - strings.ptr) < size) {
+			if (allocated >= next_collection) collect(frame, 0, nullptr);
+			if (size > (CHUNK_SIZE - sizeof(Chunk)) / 8) { // big strings get their own
+				u64 bytes = (sizeof(Chunk) + size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+				allocated += size, total_allocated += size;
+				return (u8*)new_chunk(STRING_CHUNK, bytes) + sizeof(Chunk);
+			}
+			Chunk* chunk = new_chunk(STRING_CHUNK, CHUNK_SIZE);
+			strings.ptr = (u8*)chunk + sizeof(Chunk), strings.limit = (u8*)chunk + CHUNK_SIZE;
+		}
+		void* result = strings.ptr;
+		strings.ptr += size;
+		allocated += size, total_allocated += size;
+		return result;
+	}
+
+	static const i64 MIN_CAPACITY = 4;
+
+	// The header and first elements are allocated together; elements
+	// allocated as the array grows are only reachable through it.
+	Array* gc_alloc_array(i64 capacity, void* frame) {
+		if (capacity < MIN_CAPACITY) capacity = MIN_CAPACITY;
+		Array* array = (Array*)gc_alloc_string(sizeof(Array) + capacity * sizeof(i64), frame);
+		array->length = 0, array->capacity = capacity;
+		array->elements = (i64*)(array + 1);
+		array->mark = 0;
+		return array;
+	}
+
+	void gc_grow_array(Array* array, void* frame) {
+		i64* elements = (i64*)gc_alloc_string(2 * array->capacity * sizeof(i64), frame);
+		for (i64 i = 0; i < array->length; i ++) elements[i] = array->elements[i];
+		array->elements = elements, array->capacity *= 2;
+	}
+
+	void print_heap_stats(stream& io) {
+		count_cells();
+		writeln(io, "gc: ", collections, " collections, ",
+			u64(paused) * 1000 / CLOCKS_PER_SEC, " ms paused");
+		writeln(io, "gc: ", total_allocated / 1024, " KB allocated, ", live_bytes / 1024,
+			" KB live after the last collection");
+		writeln(io, "gc: ", heap_bytes / 1024, " KB heap, ", peak_bytes / 1024, " KB at peak");
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef BASIL_GC_H
+#define BASIL_GC_H
+
+#include "util/defs.h"
+#include "util/vec.h"
+#include "util/io.h"
+#include "type.h"
+
+namespace basil {
+	// The run of free memory list cells are bump-allocated from, one per
+	// thread. Compiled code bumps ptr itself, so its layout is fixed.
+	struct Region {
+		u8* ptr;
+		u8* limit;
+	};
+
+	// An array's header. Its elements are a separate run of words, so it
+	// can grow without moving; compiled code indexes through elements, so
+	// this layout is fixed too.
+	struct Array {
+		i64 length;
+		i64 capacity;
+		i64* elements;
+		u64 mark; // the last collection that reached it
+	};
+
+	// A frame slot holding a heap pointer of the given type, at an offset
+	// from the frame's stack pointer.
+	struct Root {
+		i64 offset;
+		const Type* type;
+	};
+
+	// What the collector knows about a call from compiled code that may
+	// allocate: how big the calling frame is, and which of its slots hold
+	// heap pointers that are live across the call.
+	struct Safepoint {
+		u64 frame; // bytes from the frame's rsp to its return address
+		vector<Root> roots;
+		const Type* cons; // the list type of the cell, for calls to _cons
+	};
+
+	bool gc_traced(const Type* t); // whether values of type t may point into the heap
+	void gc_clear_safepoints();
+	void gc_add_safepoint(const void* ret, const Safepoint& safepoint);
+
+	// Both take the frame address of the native called from compiled code,
+	// which is where the collector starts looking for roots.
+	Region* gc_region();
+	void* gc_alloc_cell(i64 value, void* next, void* frame);
+	void* gc_alloc_string(u64 size, void* frame);
+	Array* gc_alloc_array(i64 capacity, void* frame); // empty, with room for capacity elements
+	void gc_grow_array(Array* array, void* frame); // doubles its capacity
+
+	void print_heap_stats(stream& io);
+}
+
+#endif
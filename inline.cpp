@@ -0,0 +1,129 @@
+#include "inline.h"
+#include "util/hash.h"
+
+namespace basil {
+	static bool _enabled = true;
+	static u64 _inlined = 0;
+
+	void inline_enabled(bool enabled) {
+		_enabled = enabled;
+	}
+
+	u64 inlined_calls() {
+		return _inlined;
+	}
+
+	// Instantiations no bigger than this, plus a little for each argument
+	// that no longer needs to be passed, are inlined everywhere. Those 
+	// called from just one place may be bigger, since the body then moves
+	// rather than being copied.
+	static const u32 SMALL_SIZE = 12, ARGUMENT_SIZE = 2, SINGLE_SITE_SIZE = 48;
+
+	// Each caller grows by at most this much from the calls inlined into
+	// it, counting what was inlined into those callees in turn.
+	static const u32 GROWTH_BUDGET = 256;
+
+	struct Instantiation {
+		u32 size; // roughly, the number of insns the body emits
+		u32 calls; // call sites naming it directly
+		bool referenced; // used as a value other than by calling it
+		bool recursive; // reaches a call to an incomplete function
+		u32 growth; // added to the body by the calls inlined into it
+	};
+
+	static map<ASTFunction*, Instantiation> infos;
+
+	static Instantiation& info(ASTFunction* fn);
+
+	// size of an expression, not counting the bodies of functions it names
+	static u32 size(ASTNode* node) {
+		ASTKind kind = node->kind();
+		if (kind == NODE_FUNCTION || kind == NODE_INCOMPLETE_FN) return 1;
+		vector<ASTNode*> children;
+		node->children(children);
+		u32 total = kind == NODE_CALL || kind == NODE_NATIVE_CALL || kind == NODE_CONS 
+			|| kind == NODE_LENGTH || kind == NODE_DISPLAY || kind == NODE_PUSH ? 2 + children.size() : 1;
+		if (kind == NODE_TO_ARRAY || kind == NODE_TO_LIST) total = 8; // a loop around a call
+		if (kind == NODE_CALL && ((ASTCall*)node)->func()->kind() == NODE_FUNCTION) total --;
+		for (ASTNode* child : children) total += size(child);
+		return total;
+	}
+
+	// whether node can reach a call to an incomplete function
+	static bool recursive(ASTNode* node) {
+		if (node->kind() == NODE_INCOMPLETE_FN) return true;
+		if (node->kind() == NODE_FUNCTION) return info((ASTFunction*)node).recursive;
+		vector<ASTNode*> children;
+		node->children(children);
+		for (ASTNode* child : children) if (recursive(child)) return true;
+		return false;
+	}
+
+	static Instantiation& info(ASTFunction* fn) {
+		auto it = infos.find(fn);
+		if (it != infos.end()) return it->second;
+		infos.put(fn, { size(fn->body()), 0, false, true, 0 }); // assume recursion while we look
+		bool rec = recursive(fn->body());
+		Instantiation& result = infos[fn];
+		result.recursive = rec;
+		return result;
+	}
+
+	// counts the ways each instantiation is used, visiting each body once
+	static void count(ASTNode* node, bool callee) {
+		if (node->kind() == NODE_FUNCTION) {
+			ASTFunction* fn = (ASTFunction*)node;
+			bool seen = infos.find(fn) != infos.end();
+			Instantiation& i = info(fn);
+			if (callee) i.calls ++;
+			else i.referenced = true;
+			if (!seen) count(fn->body(), false);
+			return;
+		}
+		vector<ASTNode*> children;
+		node->children(children);
+		for (u32 i = 0; i < children.size(); i ++) 
+			count(children[i], node->kind() == NODE_CALL && i == 0);
+	}
+
+	static bool should_inline(ASTCall* call) {
+		if (call->func()->kind() != NODE_FUNCTION) return false;
+		ASTFunction* fn = (ASTFunction*)call->func();
+		const Type* t = call->type();
+		if (t == ERROR || t->kind() == KIND_FUNCTION || fn->type() == ERROR) return false;
+		const Instantiation& i = info(fn);
+		if (i.recursive) return false;
+		if (i.size <= SMALL_SIZE + ARGUMENT_SIZE * call->args().size()) return true;
+		return i.calls == 1 && !i.referenced && i.size <= SINGLE_SITE_SIZE;
+	}
+
+	// callees are marked before their calls, so we know how much they grew
+	static void mark(ASTNode* node, set<ASTNode*>& visited, u32& growth) {
+		if (visited.find(node) != visited.end()) return;
+		visited.insert(node);
+		if (node->kind() == NODE_FUNCTION) {
+			u32 body_growth = 0;
+			mark(((ASTFunction*)node)->body(), visited, body_growth);
+			info((ASTFunction*)node).growth = body_growth;
+			return;
+		}
+		vector<ASTNode*> children;
+		node->children(children);
+		for (ASTNode* child : children) mark(child, visited, growth);
+		if (node->kind() == NODE_CALL && should_inline((ASTCall*)node)) {
+			const Instantiation& i = info((ASTFunction*)((ASTCall*)node)->func());
+			if (growth + i.size + i.growth > GROWTH_BUDGET) return;
+			growth += i.size + i.growth;
+			((ASTCall*)node)->set_inline(true), _inlined ++;
+		}
+	}
+
+	void inline_calls(ASTNode* root) {
+		if (!_enabled) return;
+		infos = map<ASTFunction*, Instantiation>();
+		count(root, false);
+		set<ASTNode*> visited;
+		u32 growth = 0;
+		mark(root, visited, growth);
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef BASIL_INLINE_H
+#define BASIL_INLINE_H
+
+#include "util/defs.h"
+#include "ast.h"
+
+namespace basil {
+	void inline_enabled(bool enabled);
+
+	// Marks calls within root whose callee is small enough, and not 
+	// recursive, to have its body emitted in place of the call. Each 
+	// instantiation is judged once, so it may end up inlined at every call
+	// site, or kept out of line for all of them, unless the caller has 
+	// already grown by as much as it's allowed to.
+	void inline_calls(ASTNode* root);
+
+	u64 inlined_calls();
+}
+
+#endif
@@ -35,6 +35,10 @@ namespace jasmine {
         refs[buf.size()] = { symbol, type, field_offset };
     }
 
+    const map<u64, SymbolRef>& Object::references() const {
+        return refs;
+    }
+
     void Object::resolve_refs() {
         for (auto& ref : refs) {
             u8* pos = (u8*)loaded_code + ref.first;
@@ -38,6 +38,7 @@ namespace jasmine {
         u64 size() const;
         void define(Symbol symbol);
         void reference(Symbol symbol, RefType type, i8 field_offset);
+        const map<u64, SymbolRef>& references() const; // by the offset they were made at
         void load();
         void write(const char* path);
         void read(const char* path);
@@ -58,28 +58,23 @@ void byte_buffer::read(char* buffer, u64 length) {
         buffer[i] = read();
 }
 
-void byte_buffer::write(u8 byte) {
-    u64 new_end = (_end + 1) & (_capacity - 1);
-    if (new_end == _start) {
-        // hold onto old buffer
-        u64 old_start = _start, old_end = _end, old_capacity = _capacity;
-        u8* old_data = _data;
-
-        // grow and clear buffer
-        _start = 0;
-        _end = 0;
-        _capacity *= 2;
-        _data = new u8[_capacity];
+void byte_buffer::reallocate(u64 capacity) {
+    // copies contents to the front of a new buffer
+    u8* data = new u8[capacity];
+    u64 size = 0;
+    for (u64 i = _start; i != _end; i = (i + 1) & (_capacity - 1))
+        data[size ++] = _data[i];
+    delete[] _data;
 
-        // copy from old buffer
-        while (old_start != old_end) {
-            write(old_data[old_start]);
-            old_start = (old_start + 1) & (old_capacity - 1);
-        }
+    _start = 0;
+    _end = size;
+    _capacity = capacity;
+    _data = data;
+}
 
-        // free old buffer
-        delete[] old_data;
-    }
+void byte_buffer::write(u8 byte) {
+    u64 new_end = (_end + 1) & (_capacity - 1);
+    if (new_end == _start) reallocate(_capacity * 2);
 
     _data[_end] = byte;
     _end = (_end + 1) & (_capacity - 1);
@@ -100,6 +95,20 @@ void byte_buffer::clear() {
     _start = _end;
 }
 
+u8* byte_buffer::reserve(u64 length) {
+    // the space can't wrap around, and must leave the buffer short of full
+    if (size() + length >= _capacity || (_end >= _start && _end + length > _capacity)) {
+        u64 capacity = _capacity;
+        while (size() + length >= capacity) capacity *= 2;
+        reallocate(capacity);
+    }
+    return _data + _end;
+}
+
+void byte_buffer::commit(u64 length) {
+    _end = (_end + length) & (_capacity - 1);
+}
+
 #if defined(__APPLE__) || defined(__linux__)
     #include "sys/mman.h"
 
@@ -62,6 +62,8 @@ class byte_buffer {
     u64 _end;
     u64 _capacity;
     u8* _data;
+
+    void reallocate(u64 capacity);
 public:
     byte_buffer();
     ~byte_buffer();
@@ -76,6 +78,11 @@ public:
     u64 size() const;
     void clear();
 
+    // returns contiguous space for at least length more bytes, which
+    // become part of the buffer once committed
+    u8* reserve(u64 length);
+    void commit(u64 length);
+
     template<typename T>
     T read() {
         // serializes object from lowest to highest address
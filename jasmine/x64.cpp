@@ -17,6 +17,9 @@ namespace x64 {
     // the object machine code is written to
     static Object* target = nullptr;
 
+    // if non-null, instructions are recorded here instead of encoded
+    static vector<Insn>* captured = nullptr;
+
     void writeto(Object& buf) {
         target = &buf;
     }
@@ -444,6 +447,19 @@ namespace x64 {
         return arg;
     }
 
+    bool record(Op op, const Arg& dest, const Arg& src, Size size, 
+        Condition condition = OVERFLOW) {
+        if (!captured) return false;
+        Insn insn;
+        insn.op = op;
+        insn.condition = condition;
+        insn.size = size;
+        insn.dest = dest;
+        insn.src = src;
+        captured->push(insn);
+        return true;
+    }
+
     void verify_buffer() {
         if (!target) { // requires that a buffer exist to write to
             fprintf(stderr, "[ERROR] Cannot assemble; no target buffer set.\n");
@@ -525,11 +541,30 @@ namespace x64 {
         return target; // return explicit size if no inference occurred
     }
 
+    bool needs_byte_rex(const Arg& arg, Size size) {
+        // spl, bpl, sil and dil are only addressable with a rex prefix
+        return size == BYTE && is_register(arg.type) 
+            && arg.data.reg >= RSP && arg.data.reg <= RDI;
+    }
+
     void emitprefix(const Arg& dest, Size size) {
+        if (size == WORD) target->code().write(0x66); // 16-bit prefix
+        u8 rex = 0x40;
+        Register dest_reg = base_register(dest);
+
+        if (is_64bit_register(dest_reg)) rex |= 1; // 64-bit r/m field
+        if (is_scaled_addressing(dest.type) && 
+            is_64bit_register(dest.data.scaled_index.index)) rex |= 2; // 64-bit SIB index
 
+        if (size == QWORD) rex |= 8; // 64-bit operand size
+        if (rex > 0x40 || needs_byte_rex(dest, size)) target->code().write(rex);
     }
 
     void emitprefix(const Arg& dest, const Arg& src, Size size) {
+        // the memory operand, if any, is always encoded in the r/m field
+        if (is_memory(src.type) && !is_memory(dest.type)) 
+            return emitprefix(src, dest, size);
+
         if (size == WORD) target->code().write(0x66); // 16-bit prefix
         u8 rex = 0x40;
         Register src_reg = base_register(src);
@@ -539,13 +574,12 @@ namespace x64 {
 
         if (is_scaled_addressing(dest.type) && 
             is_64bit_register(dest.data.scaled_index.index)) rex |= 2; // 64-bit SIB index
-        if (is_scaled_addressing(src.type) && 
-            is_64bit_register(src.data.scaled_index.index)) rex |= 2; // 64-bit SIB index
         
         if (is_64bit_register(src_reg)) rex |= 4; // 64-bit reg field
         
         if (size == QWORD) rex |= 8; // 64-bit operand size
-        if (rex > 0x40) target->code().write(rex);
+        if (rex > 0x40 || needs_byte_rex(dest, size) || needs_byte_rex(src, size)) 
+            target->code().write(rex);
     }
 
     void write_immediate(const Arg& src, Size size, bool allow64 = false) {
@@ -607,6 +641,23 @@ namespace x64 {
     }
 
     void emitargs(const Arg& dest, const Arg& src, Size size, i8 imod = -1) {
+        // the memory operand, if any, is always encoded in the r/m field
+        if (is_memory(src.type) && !is_memory(dest.type)) 
+            return emitargs(src, dest, size, imod);
+
+        if (is_label(dest.type)) { // the memory at a label, addressed relative to rip
+            Arg disp = riprel64(0);
+            disp.type = ArgType(dest.type == LABEL_AUTO ? RIPRELATIVE_AUTO 
+                : dest.type - LABEL8 + RIPRELATIVE8);
+            u64 start = target->code().size();
+            emitargs(disp, src, size, imod);
+
+            // modrm and displacement, then any immediate
+            i8 written = target->code().size() - start;
+            target->reference(dest.data.label, relative(DWORD), -(written - 1));
+            return;
+        }
+
         Size dest_size = operand_size(dest.type), src_size = operand_size(src.type);
         if (dest_size == AUTO) dest_size = size;
         if (src_size == AUTO) src_size = size;
@@ -634,42 +685,24 @@ namespace x64 {
 
         // offset/displacement
         i64 disp = 0;
+        bool displacement_only = is_displacement_only(dest.type);
 
         if (is_memory(dest.type)) {
             disp = memory_displacement(dest);
             
-            if (is_absolute(src.type)) {
-								sib |= RSP << 3;
-								sib |= RBP;
-								has_sib = true;
-						}
-            else if (is_scaled_addressing(dest.type)) {
-                sib |= dest.data.scaled_index.scale << 6;
-                sib |= dest.data.scaled_index.index << 3;
-                sib |= dest.data.scaled_index.base;
-                has_sib = true;
-            }
-            else if (base_register(dest) == RSP) {
+            if (is_absolute(dest.type)) {
                 sib |= RSP << 3;
-                sib |= RSP;
+                sib |= RBP;
                 has_sib = true;
             }
-        }
-        else if (is_memory(src.type)) {
-            disp = memory_displacement(src);
-            
-						if (is_absolute(src.type)) {
-								sib |= RSP << 3;
-								sib |= RBP;
-								has_sib = true;
-						}
-            else if (is_scaled_addressing(src.type)) {
-                sib |= src.data.scaled_index.scale << 6;
-                sib |= src.data.scaled_index.index << 3;
-                sib |= src.data.scaled_index.base;
+            else if (is_scaled_addressing(dest.type)) {
+                sib |= dest.data.scaled_index.scale << 6;
+                sib |= (dest.data.scaled_index.index & 7) << 3;
+                sib |= dest.data.scaled_index.base & 7;
                 has_sib = true;
             }
-            else if (base_register(src) == RSP) {
+            else if (!displacement_only && (base_register(dest) & 7) == RSP) {
+                // rsp and r12 can only be used as a base through the SIB byte
                 sib |= RSP << 3;
                 sib |= RSP;
                 has_sib = true;
@@ -677,8 +710,10 @@ namespace x64 {
         }
         else modrm |= 0b11000000; // register-register mod
 
-        if (disp && !is_displacement_only(src.type) && 
-						!is_displacement_only(dest.type)) {
+        // rbp and r13 have no displacement-free encoding, so they take a zero disp8
+        bool has_disp = !displacement_only && is_memory(dest.type) 
+            && (disp || (base_register(dest) & 7) == RBP);
+        if (has_disp) {
             if (disp > -129 && disp < 128) modrm |= 0b01000000; // 8-bit offset
             else if (disp < -0x80000000l || disp > 0x7fffffffl) {
                 fprintf(stderr, "[ERROR] Cannot represent memory offset %lx "
@@ -689,25 +724,18 @@ namespace x64 {
         }
 
         if (imod != -1) modrm |= imod << 3; // opcode extension in reg
-        else if (is_scaled_addressing(src.type)) 
-            modrm |= (base_register(dest) & 7) << 3;
-        else if (!is_displacement_only(src.type) && !is_immediate(src.type)) 
-						modrm |= (base_register(src) & 7) << 3; // source register in reg
-
-        if (is_scaled_addressing(dest.type)) modrm |= RSP;
-        else if (is_scaled_addressing(src.type) || is_absolute(src.type))
-            modrm |= RSP;
-				else if (is_rip_relative(src.type))
-						modrm |= RBP;
+        else if (is_register(src.type)) 
+            modrm |= (base_register(src) & 7) << 3; // source register in reg
+
+        if (is_scaled_addressing(dest.type) || is_absolute(dest.type)) modrm |= RSP;
+        else if (is_rip_relative(dest.type)) modrm |= RBP;
         else modrm |= (base_register(dest) & 7); // destination register in r/m byte
 
         target->code().write(modrm);
         if (has_sib) target->code().write(sib);
 
-				if (is_displacement_only(src.type) || is_displacement_only(dest.type)) {
-					target->code().write(little_endian((i32)disp));
-				}
-        else if (disp) {
+        if (displacement_only) target->code().write(little_endian((i32)disp));
+        else if (has_disp) {
             if (disp > -129 && disp < 128) target->code().write((i8)disp);
             else target->code().write(little_endian((i32)disp));
         }
@@ -756,8 +784,155 @@ namespace x64 {
         }
     }
 
+    // Table-driven encoding for the forms codegen emits most: the binary
+    // ALU ops and mov between 64-bit registers, memory and immediates. 
+    // These are encoded straight from the tables below into space reserved
+    // in the output buffer, skipping the general path's size inference and
+    // byte-at-a-time writes.
+
+    static bool table_enabled = true;
+
+    void table_encoding(bool enabled) {
+        table_enabled = enabled;
+    }
+
+    enum OperandClass : u8 {
+        CLASS_OTHER, CLASS_REG, CLASS_MEM, CLASS_IMM
+    };
+
+    static const OperandClass operand_classes[32] = {
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_REG, // REGISTER8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, // IMM8 - 64, always sized
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, // REGISTER_LABEL8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_MEM, // REGISTER_OFFSET8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, // LABEL8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, // ABSOLUTE8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_MEM, // SCALED_INDEX8 - 64
+        CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER // RIPRELATIVE8 - 64
+    };
+
+    static OperandClass operand_class(ArgType type) {
+        if (type < 32) return operand_classes[type];
+        if (type == IMM_AUTO) return CLASS_IMM;
+        if (type == REGISTER_OFFSET_AUTO || type == SCALED_INDEX_AUTO) return CLASS_MEM;
+        return CLASS_OTHER;
+    }
+
+    enum Form : u8 {
+        FORM_RR, FORM_RM, FORM_MR, FORM_RI, FORM_MI, NUM_FORMS, FORM_NONE = NUM_FORMS
+    };
+
+    // form for each (dest, src) pair of operand classes
+    static const Form forms[4][4] = {
+        { FORM_NONE, FORM_NONE, FORM_NONE, FORM_NONE },
+        { FORM_NONE, FORM_RR, FORM_RM, FORM_RI },
+        { FORM_NONE, FORM_MR, FORM_NONE, FORM_MI },
+        { FORM_NONE, FORM_NONE, FORM_NONE, FORM_NONE }
+    };
+
+    struct Encoding {
+        u8 opcode, imm8_opcode; // imm8_opcode is zero if there's no short form
+        u8 ext; // opcode extension in the reg field, for immediate forms
+    };
+
+    #define ALU_ENCODINGS(n) { \
+        { n * 8 + 1, 0, 0 }, { n * 8 + 3, 0, 0 }, { n * 8 + 1, 0, 0 }, \
+        { 0x81, 0x83, n }, { 0x81, 0x83, n } }
+
+    // indexed by op (OP_ADD through OP_MOV) and form
+    static const Encoding encodings[OP_MOV + 1][NUM_FORMS] = {
+        ALU_ENCODINGS(0), ALU_ENCODINGS(1), ALU_ENCODINGS(2), ALU_ENCODINGS(3),
+        ALU_ENCODINGS(4), ALU_ENCODINGS(5), ALU_ENCODINGS(6), ALU_ENCODINGS(7),
+        { { 0x89, 0, 0 }, { 0x8b, 0, 0 }, { 0x89, 0, 0 }, { 0xc7, 0, 0 }, { 0xc7, 0, 0 } }
+    };
+
+    #undef ALU_ENCODINGS
+
+    static bool fits_i8(i64 i) {
+        return i >= -0x80 && i <= 0x7f;
+    }
+
+    static bool fits_i32(i64 i) {
+        return i >= -0x80000000l && i <= 0x7fffffffl;
+    }
+
+    static u8* write_i32(u8* out, i64 value) {
+        for (u32 i = 0; i < 4; i ++) *out ++ = u8(value >> (i * 8));
+        return out;
+    }
+
+    static bool encode_table(Op op, const Arg& dest, const Arg& src, Size size) {
+        if (!table_enabled || (size != AUTO && size != QWORD)) return false;
+        Form form = forms[operand_class(dest.type)][operand_class(src.type)];
+        if (form == FORM_NONE) return false;
+        if (size == AUTO && operand_size(dest.type) != QWORD 
+            && operand_size(src.type) != QWORD) return false; // let the general path complain
+
+        const Arg& rm = form == FORM_RM ? src : dest;
+        const Arg* reg = form == FORM_RR || form == FORM_MR ? &src 
+            : form == FORM_RM ? &dest : nullptr;
+        const Encoding& encoding = encodings[op][form];
+
+        u8 opcode = encoding.opcode;
+        i64 imm = 0;
+        bool short_imm = false;
+        if (!reg) {
+            imm = immediate_value(src);
+            if (!fits_i32(imm)) return false;
+            short_imm = encoding.imm8_opcode && fits_i8(imm);
+            if (short_imm) opcode = encoding.imm8_opcode;
+        }
+
+        u8 rex = 0x48, modrm, sib = 0;
+        u8 reg_field = reg ? u8(reg->data.reg) : encoding.ext;
+        if (reg_field & 8) rex |= 4;
+        bool has_sib = false;
+        i64 disp = 0;
+        u8 mod = 0xc0;
+        if (is_register(rm.type)) {
+            if (rm.data.reg & 8) rex |= 1;
+            modrm = rm.data.reg & 7;
+        }
+        else {
+            Register base;
+            if (is_scaled_addressing(rm.type)) {
+                base = rm.data.scaled_index.base, disp = rm.data.scaled_index.offset;
+                if (rm.data.scaled_index.index & 8) rex |= 2;
+                sib = rm.data.scaled_index.scale << 6 | (rm.data.scaled_index.index & 7) << 3;
+                has_sib = true;
+            }
+            else {
+                base = rm.data.register_offset.base, disp = rm.data.register_offset.offset;
+                has_sib = (base & 7) == RSP; // rsp and r12 need a sib byte
+                sib = RSP << 3;
+            }
+            if (!fits_i32(disp)) return false;
+            if (base & 8) rex |= 1;
+            sib |= base & 7;
+            if (disp == 0 && (base & 7) != RBP) mod = 0x00; // rbp and r13 always take a disp
+            else mod = fits_i8(disp) ? 0x40 : 0x80;
+            modrm = has_sib ? RSP : base & 7;
+        }
+        modrm |= mod | (reg_field & 7) << 3;
+
+        u8* start = target->code().reserve(16);
+        u8* out = start;
+        *out ++ = rex;
+        *out ++ = opcode;
+        *out ++ = modrm;
+        if (has_sib) *out ++ = sib;
+        if (mod == 0x40) *out ++ = u8(disp);
+        else if (mod == 0x80) out = write_i32(out, disp);
+        if (!reg && short_imm) *out ++ = u8(imm);
+        else if (!reg) out = write_i32(out, imm);
+        target->code().commit(out - start);
+        return true;
+    }
+
     void add(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_ADD, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_ADD, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -765,7 +940,9 @@ namespace x64 {
     }
 
     void or_(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_OR, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_OR, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -773,7 +950,9 @@ namespace x64 {
     }
 
     void adc(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_ADC, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_ADC, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -781,7 +960,9 @@ namespace x64 {
     }
 
     void sbb(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_SBB, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_SBB, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -789,7 +970,9 @@ namespace x64 {
     }
 
     void and_(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_AND, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_AND, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -797,7 +980,9 @@ namespace x64 {
     }
 
     void sub(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_SUB, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_SUB, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -805,7 +990,9 @@ namespace x64 {
     }
 
     void xor_(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_XOR, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_XOR, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -813,7 +1000,9 @@ namespace x64 {
     }
 
     void cmp(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_CMP, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_CMP, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -821,7 +1010,9 @@ namespace x64 {
     }
 
     void mov(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_MOV, dest, src, size)) return;
         verify_buffer();
+        if (encode_table(OP_MOV, dest, src, size)) return;
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
 
@@ -856,6 +1047,7 @@ namespace x64 {
     }
 
     void imul(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_IMUL, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size actual_size = resolve_size(dest, src, size);
@@ -918,6 +1110,7 @@ namespace x64 {
     }
 
 		void rol(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_ROL, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -926,6 +1119,7 @@ namespace x64 {
 		}
 
     void ror(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_ROR, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -934,6 +1128,7 @@ namespace x64 {
 		}
 
     void rcl(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_RCL, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -942,6 +1137,7 @@ namespace x64 {
 		}
 
     void rcr(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_RCR, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -950,6 +1146,7 @@ namespace x64 {
 		}
 
     void shl(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_SHL, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -958,6 +1155,7 @@ namespace x64 {
 		}
 
     void shr(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_SHR, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -966,6 +1164,7 @@ namespace x64 {
 		}
 
     void sar(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_SAR, dest, src, size)) return;
         verify_buffer();
         verify_args(dest, src);
         Size dest_size = resolve_size(dest, size);
@@ -973,7 +1172,24 @@ namespace x64 {
         encode_shift(dest, src, dest_size, 7);
 		}
 
+    void imul(const Arg& src, Size size) {
+        if (record(OP_IMUL_WIDE, src, imm(0), size)) return;
+        verify_buffer();
+        Size actual_size = resolve_size(src, size);
+
+        if (is_immediate(src.type)) {
+            fprintf(stderr, "[ERROR] Invalid operand; immediate not permitted "
+                "in unary 'imul' instruction.\n");
+            exit(1);
+        }
+
+        emitprefix(src, actual_size);
+				target->code().write<u8>(actual_size == BYTE ? 0xf6 : 0xf7);
+        emitargs(src, actual_size, 5);
+    }
+
     void idiv(const Arg& src, Size size) {
+        if (record(OP_IDIV, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 
@@ -989,6 +1205,7 @@ namespace x64 {
     }
 
 		void not_(const Arg& src, Size size) {
+        if (record(OP_NOT, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 				
@@ -1004,6 +1221,7 @@ namespace x64 {
 		}
 
 		void inc(const Arg& src, Size size) {
+        if (record(OP_INC, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 				
@@ -1019,6 +1237,7 @@ namespace x64 {
 		}
 
 		void dec(const Arg& src, Size size) {
+        if (record(OP_DEC, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 				
@@ -1034,10 +1253,11 @@ namespace x64 {
 		}
 
     void push(const Arg& src, Size size) {
+        if (record(OP_PUSH, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 
-        emitprefix(src, actual_size);
+        emitprefix(src, actual_size == QWORD ? DWORD : actual_size); // 64-bit by default
         if (is_immediate(src.type)) {
             if (actual_size == BYTE) target->code().write<u8>(0x6a);
             else target->code().write<u8>(0x68);
@@ -1053,10 +1273,11 @@ namespace x64 {
     }
 
     void pop(const Arg& src, Size size) {
+        if (record(OP_POP, src, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(src, size);
 
-        emitprefix(src, actual_size);
+        emitprefix(src, actual_size == QWORD ? DWORD : actual_size); // 64-bit by default
         if (is_immediate(src.type)) {
             fprintf(stderr, "[ERROR] Invalid operand; immediate not permitted "
                 "in 'pop' instruction.\n");
@@ -1072,6 +1293,7 @@ namespace x64 {
     }
 
     void lea(const Arg& dest, const Arg& src, Size size) {
+				if (record(OP_LEA, dest, src, size)) return;
 				verify_buffer();
 				Size actual_size = resolve_size(dest, src, size);
 
@@ -1102,24 +1324,41 @@ namespace x64 {
 		}
 
     void cdq() {
+        if (record(OP_CDQ, imm(0), imm(0), AUTO)) return;
         verify_buffer();
 
         target->code().write<u8>(0x99);
     }
 
+    void cqo() {
+        if (record(OP_CQO, imm(0), imm(0), AUTO)) return;
+        verify_buffer();
+
+        target->code().write<u8>(0x48, 0x99);
+    }
+
     void ret() {
+        if (record(OP_RET, imm(0), imm(0), AUTO)) return;
         verify_buffer();
 
         target->code().write<u8>(0xc3);
     }
 
     void syscall() {
+        if (record(OP_SYSCALL, imm(0), imm(0), AUTO)) return;
         verify_buffer();
 
         target->code().write<u8>(0x0f, 0x05);
     }
 
     void label(Symbol symbol) {
+        if (captured) {
+            Insn insn;
+            insn.op = OP_LABEL;
+            insn.symbol = symbol;
+            captured->push(insn);
+            return;
+        }
         target->define(symbol);
     }
 
@@ -1128,6 +1367,7 @@ namespace x64 {
     }
 
     void jmp(const Arg& dest, Size size) {
+        if (record(OP_JMP, dest, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(dest, size);
 
@@ -1159,6 +1399,7 @@ namespace x64 {
     }
 
     void jcc(const Arg& dest, Condition condition) {
+        if (record(OP_JCC, dest, imm(0), AUTO, condition)) return;
         verify_buffer();
         Size size = operand_size(dest.type);
         if (is_label(dest.type) || is_immediate(dest.type)) {
@@ -1196,6 +1437,7 @@ namespace x64 {
     }
 
     void call(const Arg& dest, Size size) {
+        if (record(OP_CALL, dest, imm(0), size)) return;
         verify_buffer();
         Size actual_size = resolve_size(dest, size);
         if (actual_size <= BYTE) actual_size = WORD; // cannot call by smaller than dword
@@ -1223,6 +1465,7 @@ namespace x64 {
     }
 
 		void setcc(const Arg& dest, Condition condition, Size size) {
+        if (record(OP_SETCC, dest, imm(0), size, condition)) return;
         verify_buffer();
         Size actual_size = resolve_size(dest, size);
 
@@ -1237,8 +1480,205 @@ namespace x64 {
             exit(1);
         }
         else {
+            emitprefix(dest, BYTE); // setcc only writes the low byte
             target->code().write<u8>(0x0f, 0x90 + (u8)condition);
             emitargs(dest, actual_size, 0);
         }
 		}
-}
\ No newline at end of file
+
+		void cmov(const Arg& dest, const Arg& src, Condition condition, Size size) {
+        if (record(OP_CMOV, dest, src, size, condition)) return;
+        verify_buffer();
+        verify_args(dest, src);
+        Size actual_size = resolve_size(dest, src, size);
+
+        if (is_immediate(src.type)) {
+            fprintf(stderr, "[ERROR] Invalid operand; immediate not permitted "
+                "in 'cmov' instruction.\n");
+            exit(1);
+        }
+        else if (!is_register(dest.type)) {
+            fprintf(stderr, "[ERROR] Invalid operand; destination in 'cmov' "
+                "instruction must be register.\n");
+            exit(1);
+        }
+        else if (actual_size == BYTE) {
+            fprintf(stderr, "[ERROR] Invalid operand size; 'cmov' cannot "
+                "move a single byte.\n");
+            exit(1);
+        }
+        else { // same operand order as binary imul
+            emitprefix(src, dest, actual_size);
+            target->code().write<u8>(0x0f, 0x40 + (u8)condition);
+            emitargs(src, dest, actual_size);
+        }
+		}
+
+		void movzx(const Arg& dest, const Arg& src, Size size) {
+        if (record(OP_MOVZX, dest, src, size)) return;
+        verify_buffer();
+        Size actual_size = resolve_size(dest, size);
+        Size src_size = operand_size(src.type);
+
+        if (!is_register(dest.type)) {
+            fprintf(stderr, "[ERROR] Invalid operand; destination in 'movzx' "
+                "instruction must be register.\n");
+            exit(1);
+        }
+        else if (src_size != BYTE && src_size != WORD) {
+            fprintf(stderr, "[ERROR] Invalid operand; source in 'movzx' "
+                "instruction must be a byte or word.\n");
+            exit(1);
+        }
+        else if (actual_size <= src_size) {
+            fprintf(stderr, "[ERROR] Invalid operand size; 'movzx' must "
+                "widen its source.\n");
+            exit(1);
+        }
+        else {
+            if (actual_size == WORD) target->code().write<u8>(0x66);
+            u8 rex = 0x40;
+            if (is_64bit_register(dest.data.reg)) rex |= 4; // 64-bit reg field
+            if (is_64bit_register(base_register(src))) rex |= 1; // 64-bit r/m field
+            if (is_scaled_addressing(src.type) && 
+                is_64bit_register(src.data.scaled_index.index)) rex |= 2; // 64-bit SIB index
+            if (actual_size == QWORD) rex |= 8;
+            if (rex > 0x40 || needs_byte_rex(src, src_size)) target->code().write(rex);
+            target->code().write<u8>(0x0f, src_size == BYTE ? 0xb6 : 0xb7);
+            emitargs(src, dest, actual_size);
+        }
+		}
+
+    void capture(vector<Insn>* insns) {
+        captured = insns;
+    }
+
+    void encode(const Insn& insn) {
+        switch (insn.op) {
+            case OP_ADD: return add(insn.dest, insn.src, insn.size);
+            case OP_OR: return or_(insn.dest, insn.src, insn.size);
+            case OP_ADC: return adc(insn.dest, insn.src, insn.size);
+            case OP_SBB: return sbb(insn.dest, insn.src, insn.size);
+            case OP_AND: return and_(insn.dest, insn.src, insn.size);
+            case OP_SUB: return sub(insn.dest, insn.src, insn.size);
+            case OP_XOR: return xor_(insn.dest, insn.src, insn.size);
+            case OP_CMP: return cmp(insn.dest, insn.src, insn.size);
+            case OP_MOV: return mov(insn.dest, insn.src, insn.size);
+            case OP_IMUL: return imul(insn.dest, insn.src, insn.size);
+            case OP_ROL: return rol(insn.dest, insn.src, insn.size);
+            case OP_ROR: return ror(insn.dest, insn.src, insn.size);
+            case OP_RCL: return rcl(insn.dest, insn.src, insn.size);
+            case OP_RCR: return rcr(insn.dest, insn.src, insn.size);
+            case OP_SHL: return shl(insn.dest, insn.src, insn.size);
+            case OP_SHR: return shr(insn.dest, insn.src, insn.size);
+            case OP_SAR: return sar(insn.dest, insn.src, insn.size);
+            case OP_IDIV: return idiv(insn.dest, insn.size);
+            case OP_IMUL_WIDE: return imul(insn.dest, insn.size);
+            case OP_NOT: return not_(insn.dest, insn.size);
+            case OP_INC: return inc(insn.dest, insn.size);
+            case OP_DEC: return dec(insn.dest, insn.size);
+            case OP_PUSH: return push(insn.dest, insn.size);
+            case OP_POP: return pop(insn.dest, insn.size);
+            case OP_LEA: return lea(insn.dest, insn.src, insn.size);
+            case OP_CDQ: return cdq();
+            case OP_CQO: return cqo();
+            case OP_RET: return ret();
+            case OP_SYSCALL: return syscall();
+            case OP_LABEL: return label(insn.symbol);
+            case OP_JMP: return jmp(insn.dest, insn.size);
+            case OP_JCC: return jcc(insn.dest, insn.condition);
+            case OP_CALL: return call(insn.dest, insn.size);
+            case OP_SETCC: return setcc(insn.dest, insn.condition, insn.size);
+            case OP_CMOV: return cmov(insn.dest, insn.src, insn.condition, insn.size);
+            case OP_MOVZX: return movzx(insn.dest, insn.src, insn.size);
+        }
+    }
+
+    u32 assemble(const vector<Insn>& insns, bool relax) {
+        verify_buffer();
+        map<Symbol, u32> labels; // label -> index of the insn defining it
+        for (u32 i = 0; i < insns.size(); i ++)
+            if (insns[i].op == OP_LABEL) labels.put(insns[i].symbol, i);
+
+        // everything but labels and local jumps is encoded once, off to the
+        // side, which gives its size. the bytes are moved into place around
+        // the jumps once those are sized.
+        Object* out = target;
+        Object side(out->architecture());
+        writeto(side);
+
+        // every jump to a local label starts out short, and is lengthened
+        // for as long as some of them are out of range. jumps only ever
+        // grow, so this settles.
+        vector<i64> targets; // index of each local jump's label, or -1
+        vector<u64> sizes, offsets, starts; // starts: where each insn's bytes are on the side
+        for (const Insn& insn : insns) {
+            auto it = labels.end();
+            if ((insn.op == OP_JMP || insn.op == OP_JCC) && is_label(insn.dest.type))
+                it = labels.find(insn.dest.data.label);
+            targets.push(it == labels.end() ? -1 : i64(it->second));
+            starts.push(side.code().size());
+            if (it != labels.end()) sizes.push(!relax ? (insn.op == OP_JMP ? 5 : 6) : 2);
+            else {
+                if (insn.op != OP_LABEL) encode(insn);
+                sizes.push(side.code().size() - starts.back());
+            }
+            offsets.push(0);
+        }
+        starts.push(side.code().size());
+        offsets.push(0);
+        writeto(*out);
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (u32 i = 0; i < insns.size(); i ++) offsets[i + 1] = offsets[i] + sizes[i];
+            for (u32 i = 0; i < insns.size(); i ++) {
+                if (targets[i] < 0 || sizes[i] != 2) continue;
+                i64 disp = i64(offsets[targets[i]]) - i64(offsets[i + 1]);
+                if (disp < -128 || disp > 127) {
+                    sizes[i] = insns[i].op == OP_JMP ? 5 : 6;
+                    changed = true;
+                }
+            }
+        }
+
+        // references are made just after the field they patch, so each
+        // lies within the bytes of the insn that made it
+        vector<const SymbolRef*> refs;
+        for (u64 i = 0; i <= starts.back(); i ++) refs.push(nullptr);
+        for (const auto& ref : side.references()) refs[ref.first] = &ref.second;
+        auto move = [&](u64 length) {
+            if (!length) return;
+            u8* dest = out->code().reserve(length);
+            side.code().read((char*)dest, length);
+            out->code().commit(length);
+        };
+
+        u32 short_jumps = 0;
+        for (u32 i = 0; i < insns.size(); i ++) {
+            if (insns[i].op == OP_LABEL) {
+                encode(insns[i]);
+                continue;
+            }
+            if (targets[i] < 0) {
+                u64 from = starts[i];
+                for (u64 j = starts[i] + 1; j <= starts[i + 1]; j ++) {
+                    if (!refs[j]) continue;
+                    move(j - from), from = j;
+                    out->reference(refs[j]->symbol, refs[j]->type, refs[j]->field_offset);
+                }
+                move(starts[i + 1] - from);
+                continue;
+            }
+            i64 disp = i64(offsets[targets[i]]) - i64(offsets[i + 1]);
+            bool near = sizes[i] == 2;
+            if (near) short_jumps ++;
+            Arg rel = imm(disp); // jmp and jcc read the whole immediate, sized by its type
+            rel.type = near ? IMM8 : IMM32;
+            if (insns[i].op == OP_JMP) jmp(rel, near ? BYTE : DWORD);
+            else jcc(rel, insns[i].condition);
+        }
+        return short_jumps;
+    }
+}
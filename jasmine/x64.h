@@ -156,6 +156,8 @@ namespace x64 {
     bool is_immediate(ArgType type);
     bool is_memory(ArgType type);
     bool is_label(ArgType type);
+    bool is_scaled_addressing(ArgType type);
+    Register base_register(const Arg& arg);
 		
     void writeto(jasmine::Object& obj);
 
@@ -220,6 +222,7 @@ namespace x64 {
     void shl(const Arg& dest, const Arg& src, Size size = AUTO);
     void shr(const Arg& dest, const Arg& src, Size size = AUTO);
     void sar(const Arg& dest, const Arg& src, Size size = AUTO);
+    void imul(const Arg& src, Size size = AUTO); // rdx:rax = rax * src
     void idiv(const Arg& src, Size size = AUTO);
     void not_(const Arg& src, Size size = AUTO);
     void inc(const Arg& src, Size size = AUTO);
@@ -228,6 +231,7 @@ namespace x64 {
     void pop(const Arg& src, Size size = AUTO);
     void lea(const Arg& dest, const Arg& src, Size size = AUTO);
     void cdq();
+    void cqo();
     void ret();
     void syscall();
     void label(jasmine::Symbol symbol);
@@ -236,6 +240,41 @@ namespace x64 {
     void jcc(const Arg& dest, Condition condition);
     void call(const Arg& dest, Size size = AUTO);
 		void setcc(const Arg& dest, Condition condition, Size size = AUTO);
+		void cmov(const Arg& dest, const Arg& src, Condition condition, Size size = AUTO);
+		void movzx(const Arg& dest, const Arg& src, Size size = AUTO); // src is a byte or word
+
+    enum Op : u8 {
+        OP_ADD, OP_OR, OP_ADC, OP_SBB, OP_AND, OP_SUB, OP_XOR, OP_CMP, 
+        OP_MOV, OP_IMUL, OP_ROL, OP_ROR, OP_RCL, OP_RCR, OP_SHL, OP_SHR, 
+        OP_SAR, OP_IDIV, OP_NOT, OP_INC, OP_DEC, OP_PUSH, OP_POP, OP_LEA, 
+        OP_CDQ, OP_CQO, OP_RET, OP_SYSCALL, OP_LABEL, OP_JMP, OP_JCC, 
+        OP_CALL, OP_SETCC, OP_IMUL_WIDE, OP_CMOV, OP_MOVZX
+    };
+
+    // An instruction that has been recorded but not yet encoded. Unary
+    // instructions keep their operand in dest.
+    struct Insn {
+        Op op;
+        Condition condition;
+        Size size;
+        Arg dest, src;
+        jasmine::Symbol symbol; // label defined by OP_LABEL
+    };
+
+    // While capturing, the functions above append to insns instead of
+    // writing machine code. Pass nullptr to resume encoding.
+    void capture(vector<Insn>* insns);
+    void encode(const Insn& insn);
+
+    // Whether the common 64-bit forms of mov and the binary ALU ops are
+    // encoded from tables, rather than through the general encoder.
+    void table_encoding(bool enabled);
+
+    // Encodes a captured function body. Jumps to labels it defines are
+    // resolved here instead of left to the object's relocations, and use
+    // the short rel8 form wherever their target ends up in range. Returns
+    // how many jumps were encoded short.
+    u32 assemble(const vector<Insn>& insns, bool relax = true);
 }
 
 #endif
\ No newline at end of file
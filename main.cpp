@@ -3,6 +3,11 @@
 #include "values.h"
 #include "driver.h"
 #include "ast.h"
+#include "peephole.h"
+#include "inline.h"
+#include "escape.h"
+#include "opt.h"
+#include "native.h"
 #include "unistd.h"
 
 using namespace basil;
@@ -97,7 +102,33 @@ Value repl_help(ref<Env> env, const Value& args) {
 
 int intro();
 
+bool parse_option(const string& opt) {
+	if (opt == "--regalloc=stack") ssa_allocator(STACK_ALLOCATOR);
+	else if (opt == "--regalloc=linear") ssa_allocator(LINEAR_ALLOCATOR);
+	else if (opt == "--no-peephole") peephole_enabled(false);
+	else if (opt == "--no-inline") inline_enabled(false);
+	else if (opt == "--no-cse") cse_enabled(false);
+	else if (opt == "--no-relax") ssa_relax_jumps(false);
+	else if (opt == "--no-inline-alloc") ssa_inline_alloc(false);
+	else if (opt == "--no-escape") escape_enabled(false);
+	else if (opt == "--no-simd") simd_enabled(false);
+	else if (opt == "--stats") basil::print_stats(true);
+	else if (opt == "--gc-stats") basil::print_gc_stats(true);
+	else if (opt.size() > 5 && string(opt[{0, 5}]) == "--no-")
+		return opt_enabled(opt[{5, opt.size()}], false);
+	else return false;
+	return true;
+}
+
 int main(int argc, char** argv) {
+	while (argc > 1 && argv[1][0] == '-' && argv[1][1] == '-') { // leading options
+		if (!parse_option(argv[1])) {
+			println(BOLDRED, "Unknown option '", (const char*)argv[1], "'.", RESET);
+			return 1;
+		}
+		argc --, argv ++;
+	}
+
 	if (argc == 1) { // repl mode
 		print_banner();
 		println(BOLDGREEN, "Enter any Basil expression at the prompt, or '", 
@@ -153,6 +184,21 @@ int main(int argc, char** argv) {
 	println(" - basil intro           => runs interactive introduction.");
 	println(" - basil exec <code...>  => executes <code...>.");
 	println("");
+	println("Options (before any command): ");
+	println(" - --regalloc=<mode>     => selects register allocator, 'linear' (default) or 'stack'.");
+	println(" - --no-peephole         => disables the machine code peephole pass.");
+	println(" - --no-inline           => disables inlining of small functions.");
+	println(" - --no-cse              => disables reuse of common pure subexpressions.");
+	println(" - --no-relax            => encodes every jump within a function with a 32-bit offset.");
+	println(" - --no-inline-alloc     => calls into the runtime for every list cell.");
+	println(" - --no-escape           => allocates every list cell on the heap.");
+	println(" - --no-simd             => runs reductions with scalar loops instead of vector kernels.");
+	println(" - --no-<pass>           => disables an optimization pass: 'tail-calls', 'mem2reg', 'sccp',");
+	println("                            'copy-prop', 'dce', 'licm', 'ivs', 'intrinsics', 'coalesce',");
+	println("                            'fold-addresses', 'fuse-branches', or 'layout'.");
+	println(" - --stats               => prints optimization statistics after compiling.");
+	println(" - --gc-stats            => prints heap statistics after running.");
+	println("");
 }
 
 static bool running_intro = false;
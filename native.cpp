@@ -1,26 +1,36 @@
 #include "native.h"
+#include "gc.h"
 #include "values.h"
 #include "util/io.h"
 #include <cstdlib>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 namespace basil {
 	using namespace jasmine;
 
+	// Natives are called through an 8-byte slot holding their address, 
+	// placed after the code that calls them.
 	void add_native_function(Object& object, const string& name, void* function) {
 		using namespace x64;
 		writeto(object);
-		Symbol sym = global((const char*)name.raw());
-		label(sym);
-		mov(r64(RAX), imm(i64(function)));
-		call(r64(RAX));
-		ret();
+		while (object.code().size() % 8) object.code().write<u8>(0xcc); // int3
+		label(global((const char*)name.raw()));
+		object.code().write(u64(function));
 	}
 
 	void* _cons(i64 value, void* next) {
-		void* result = malloc(sizeof(i64) + sizeof(void*));
-		*(i64*)result = value;
-		*((void**)result + 1) = next;
-		return result;
+		return gc_alloc_cell(value, next, __builtin_frame_address(0));
+	}
+
+	void* _new_array(i64 capacity) {
+		return gc_alloc_array(capacity, __builtin_frame_address(0));
+	}
+
+	void _grow_array(Array* array) {
+		gc_grow_array(array, __builtin_frame_address(0));
 	}
 
   i64 _listlen(void* list) {
@@ -85,6 +95,34 @@ namespace basil {
 		println(")");
 	}
 
+	template<typename T>
+	void _display_array(const Array* array) {
+		print("[");
+		for (i64 i = 0; i < array->length; i ++) print(i ? " " : "", (T)array->elements[i]);
+		println("]");
+	}
+
+	void _display_symbol_array(const Array* array) {
+		print("[");
+		for (i64 i = 0; i < array->length; i ++) print(i ? " " : "", symbol_for(array->elements[i]));
+		println("]");
+	}
+
+	void _display_native_string_array(const Array* array) {
+		print("[");
+		for (i64 i = 0; i < array->length; i ++) print(i ? " \"" : "\"", (const char*)array->elements[i], '"');
+		println("]");
+	}
+
+	void display_native_array(const Type* t, const void* array) {
+		if (t->kind() != KIND_ARRAY) return;
+		const Type* elt = ((const ArrayType*)t)->element();
+		if (elt == INT) _display_array<i64>((const Array*)array);
+		else if (elt == SYMBOL) _display_symbol_array((const Array*)array);
+		else if (elt == BOOL) _display_array<bool>((const Array*)array);
+		else if (elt == STRING) _display_native_string_array((const Array*)array);
+	}
+
 	void display_native_list(const Type* t, void* list) {
 		if (t->kind() != KIND_LIST) return;
 		const Type* elt = ((const ListType*)t)->element();
@@ -109,7 +147,7 @@ namespace basil {
   const u8* _read_line() {
     string s;
     while (_stdin.peek() != '\n') { s += _stdin.read(); }
-		u8* buf = new u8[s.size() + 1];
+		u8* buf = (u8*)gc_alloc_string(s.size() + 1, __builtin_frame_address(0));
 		for (u32 i = 0; i < s.size(); i ++) buf[i] = s[i];
 		buf[s.size()] = '\0';
     return buf;
@@ -124,7 +162,7 @@ namespace basil {
   const u8* _read_word() {
     string s;
 		read(_stdin, s);
-		u8* buf = new u8[s.size() + 1];
+		u8* buf = (u8*)gc_alloc_string(s.size() + 1, __builtin_frame_address(0));
 		for (u32 i = 0; i < s.size(); i ++) buf[i] = s[i];
 		buf[s.size()] = '\0';
     return buf;
@@ -136,24 +174,427 @@ namespace basil {
 
   // const u8* _substr(const char *s, i64 start, i64 end)
 
+	// Reduction kernels, over runs of ints or bytes. Each has a scalar
+	// version, and SSE2 and AVX2 ones where the instructions exist for it;
+	// the best the CPU supports is picked when the program starts.
+	struct Kernels {
+		const char* name;
+		i64 (*sum)(const i64* v, u64 n);
+		i64 (*min)(const i64* v, u64 n);
+		i64 (*max)(const i64* v, u64 n);
+		i64 (*count)(const i64* v, u64 n, i64 item);
+		i64 (*dot)(const i64* a, const i64* b, u64 n);
+		i64 (*sum_bytes)(const u8* v, u64 n);
+		i64 (*min_bytes)(const u8* v, u64 n);
+		i64 (*max_bytes)(const u8* v, u64 n);
+		i64 (*count_bytes)(const u8* v, u64 n, u8 item);
+	};
+
+	// Sums and products wrap, like the code we generate for + and *.
+	static i64 wrap_add(i64 a, i64 b) {
+		return i64(u64(a) + u64(b));
+	}
+
+	static i64 wrap_mul(i64 a, i64 b) {
+		return i64(u64(a) * u64(b));
+	}
+
+	static i64 scalar_sum(const i64* v, u64 n) {
+		i64 sum = 0;
+		for (u64 i = 0; i < n; i ++) sum = wrap_add(sum, v[i]);
+		return sum;
+	}
+
+	static i64 scalar_min(const i64* v, u64 n) {
+		i64 min = v[0];
+		for (u64 i = 1; i < n; i ++) if (v[i] < min) min = v[i];
+		return min;
+	}
+
+	static i64 scalar_max(const i64* v, u64 n) {
+		i64 max = v[0];
+		for (u64 i = 1; i < n; i ++) if (v[i] > max) max = v[i];
+		return max;
+	}
+
+	static i64 scalar_count(const i64* v, u64 n, i64 item) {
+		i64 count = 0;
+		for (u64 i = 0; i < n; i ++) count += v[i] == item;
+		return count;
+	}
+
+	static i64 scalar_dot(const i64* a, const i64* b, u64 n) {
+		i64 dot = 0;
+		for (u64 i = 0; i < n; i ++) dot = wrap_add(dot, wrap_mul(a[i], b[i]));
+		return dot;
+	}
+
+	static i64 scalar_sum_bytes(const u8* v, u64 n) {
+		i64 sum = 0;
+		for (u64 i = 0; i < n; i ++) sum += v[i];
+		return sum;
+	}
+
+	static i64 scalar_min_bytes(const u8* v, u64 n) {
+		u8 min = v[0];
+		for (u64 i = 1; i < n; i ++) if (v[i] < min) min = v[i];
+		return min;
+	}
+
+	static i64 scalar_max_bytes(const u8* v, u64 n) {
+		u8 max = v[0];
+		for (u64 i = 1; i < n; i ++) if (v[i] > max) max = v[i];
+		return max;
+	}
+
+	static i64 scalar_count_bytes(const u8* v, u64 n, u8 item) {
+		i64 count = 0;
+		for (u64 i = 0; i < n; i ++) count += v[i] == item;
+		return count;
+	}
+
+	static const Kernels SCALAR_KERNELS = {
+		"scalar", scalar_sum, scalar_min, scalar_max, scalar_count, scalar_dot,
+		scalar_sum_bytes, scalar_min_bytes, scalar_max_bytes, scalar_count_bytes
+	};
+
+#ifdef __x86_64__
+	// SSE2 has no 64-bit compares, so min and max stay scalar; equality
+	// is found from the two 32-bit halves.
+	static i64 sse2_sum(const i64* v, u64 n) {
+		__m128i acc = _mm_setzero_si128();
+		u64 i = 0;
+		for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*)(v + i)));
+		i64 lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return wrap_add(wrap_add(lanes[0], lanes[1]), scalar_sum(v + i, n - i));
+	}
+
+	static i64 sse2_count(const i64* v, u64 n, i64 item) {
+		__m128i acc = _mm_setzero_si128(), x = _mm_set1_epi64x(item);
+		u64 i = 0;
+		for (; i + 2 <= n; i += 2) {
+			__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(v + i)), x);
+			acc = _mm_sub_epi64(acc, _mm_and_si128(eq, _mm_shuffle_epi32(eq, 0xb1)));
+		}
+		i64 lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return lanes[0] + lanes[1] + scalar_count(v + i, n - i, item);
+	}
+
+	// The low 64 bits of each product, from 32-bit multiplies.
+	static __m128i sse2_mul(__m128i a, __m128i b) {
+		__m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+			_mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+		return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+	}
+
+	static i64 sse2_dot(const i64* a, const i64* b, u64 n) {
+		__m128i acc = _mm_setzero_si128();
+		u64 i = 0;
+		for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, sse2_mul(
+			_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+		i64 lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return wrap_add(wrap_add(lanes[0], lanes[1]), scalar_dot(a + i, b + i, n - i));
+	}
+
+	static i64 sse2_sum_bytes(const u8* v, u64 n) {
+		__m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+		u64 i = 0;
+		for (; i + 16 <= n; i += 16)
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(v + i)), zero));
+		i64 lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return lanes[0] + lanes[1] + scalar_sum_bytes(v + i, n - i);
+	}
+
+	static i64 sse2_min_bytes(const u8* v, u64 n) {
+		if (n < 16) return scalar_min_bytes(v, n);
+		__m128i acc = _mm_loadu_si128((const __m128i*)v);
+		for (u64 i = 16; i + 16 <= n; i += 16) acc = _mm_min_epu8(acc, _mm_loadu_si128((const __m128i*)(v + i)));
+		acc = _mm_min_epu8(acc, _mm_loadu_si128((const __m128i*)(v + n - 16))); // overlaps what's left
+		u8 lanes[16];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return scalar_min_bytes(lanes, 16);
+	}
+
+	static i64 sse2_max_bytes(const u8* v, u64 n) {
+		if (n < 16) return scalar_max_bytes(v, n);
+		__m128i acc = _mm_loadu_si128((const __m128i*)v);
+		for (u64 i = 16; i + 16 <= n; i += 16) acc = _mm_max_epu8(acc, _mm_loadu_si128((const __m128i*)(v + i)));
+		acc = _mm_max_epu8(acc, _mm_loadu_si128((const __m128i*)(v + n - 16)));
+		u8 lanes[16];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return scalar_max_bytes(lanes, 16);
+	}
+
+	static i64 sse2_count_bytes(const u8* v, u64 n, u8 item) {
+		__m128i x = _mm_set1_epi8(char(item));
+		i64 count = 0;
+		u64 i = 0;
+		for (; i + 16 <= n; i += 16) count += __builtin_popcount(
+			_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(v + i)), x)));
+		return count + scalar_count_bytes(v + i, n - i, item);
+	}
+
+	static const Kernels SSE2_KERNELS = {
+		"sse2", sse2_sum, scalar_min, scalar_max, sse2_count, sse2_dot,
+		sse2_sum_bytes, sse2_min_bytes, sse2_max_bytes, sse2_count_bytes
+	};
+
+#define AVX2 __attribute__((target("avx2")))
+
+	AVX2 static i64 avx2_total(__m256i acc) {
+		i64 lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		return wrap_add(wrap_add(lanes[0], lanes[1]), wrap_add(lanes[2], lanes[3]));
+	}
+
+	AVX2 static i64 avx2_sum(const i64* v, u64 n) {
+		__m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+		u64 i = 0;
+		for (; i + 8 <= n; i += 8) {
+			a = _mm256_add_epi64(a, _mm256_loadu_si256((const __m256i*)(v + i)));
+			b = _mm256_add_epi64(b, _mm256_loadu_si256((const __m256i*)(v + i + 4)));
+		}
+		return wrap_add(avx2_total(_mm256_add_epi64(a, b)), sse2_sum(v + i, n - i));
+	}
+
+	AVX2 static i64 avx2_min(const i64* v, u64 n) {
+		if (n < 4) return scalar_min(v, n);
+		__m256i acc = _mm256_loadu_si256((const __m256i*)v);
+		for (u64 i = 4; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+			acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+		}
+		__m256i x = _mm256_loadu_si256((const __m256i*)(v + n - 4)); // overlaps what's left
+		acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+		i64 lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		return scalar_min(lanes, 4);
+	}
+
+	AVX2 static i64 avx2_max(const i64* v, u64 n) {
+		if (n < 4) return scalar_max(v, n);
+		__m256i acc = _mm256_loadu_si256((const __m256i*)v);
+		for (u64 i = 4; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+			acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+		}
+		__m256i x = _mm256_loadu_si256((const __m256i*)(v + n - 4));
+		acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+		i64 lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		return scalar_max(lanes, 4);
+	}
+
+	AVX2 static i64 avx2_count(const i64* v, u64 n, i64 item) {
+		__m256i acc = _mm256_setzero_si256(), x = _mm256_set1_epi64x(item);
+		u64 i = 0;
+		for (; i + 4 <= n; i += 4)
+			acc = _mm256_sub_epi64(acc, _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(v + i)), x));
+		return avx2_total(acc) + scalar_count(v + i, n - i, item);
+	}
+
+	AVX2 static __m256i avx2_mul(__m256i a, __m256i b) {
+		__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+			_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+		return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+	}
+
+	AVX2 static i64 avx2_dot(const i64* a, const i64* b, u64 n) {
+		__m256i acc = _mm256_setzero_si256();
+		u64 i = 0;
+		for (; i + 4 <= n; i += 4) acc = _mm256_add_epi64(acc, avx2_mul(
+			_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+		return wrap_add(avx2_total(acc), scalar_dot(a + i, b + i, n - i));
+	}
+
+	AVX2 static i64 avx2_sum_bytes(const u8* v, u64 n) {
+		__m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+		u64 i = 0;
+		for (; i + 32 <= n; i += 32)
+			acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(v + i)), zero));
+		return avx2_total(acc) + sse2_sum_bytes(v + i, n - i);
+	}
+
+	AVX2 static i64 avx2_count_bytes(const u8* v, u64 n, u8 item) {
+		__m256i x = _mm256_set1_epi8(char(item));
+		i64 count = 0;
+		u64 i = 0;
+		for (; i + 32 <= n; i += 32) count += __builtin_popcount(
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(v + i)), x)));
+		return count + sse2_count_bytes(v + i, n - i, item);
+	}
+
+#undef AVX2
+
+	static const Kernels AVX2_KERNELS = {
+		"avx2", avx2_sum, avx2_min, avx2_max, avx2_count, avx2_dot,
+		avx2_sum_bytes, sse2_min_bytes, sse2_max_bytes, avx2_count_bytes
+	};
+
+	static const Kernels* best_kernels() {
+		__builtin_cpu_init(); // we may run before the runtime has set it up
+		return __builtin_cpu_supports("avx2") ? &AVX2_KERNELS : &SSE2_KERNELS;
+	}
+#else
+	static const Kernels* best_kernels() {
+		return &SCALAR_KERNELS;
+	}
+#endif
+
+	static const Kernels* kernels = best_kernels();
+
+	void simd_enabled(bool enabled) {
+		kernels = enabled ? best_kernels() : &SCALAR_KERNELS;
+	}
+
+	const char* simd_kernels() {
+		return kernels->name;
+	}
+
+	// Lists are reduced a chunk at a time, copying the values out of their
+	// cells so the kernels can run over them contiguously.
+	static const u64 PACK_SIZE = 256;
+
+	// Copies values from up to PACK_SIZE cells starting at list into buf,
+	// and returns the cell after the last one copied.
+	static void* pack(void* list, i64* buf, u64& n) {
+		for (n = 0; list && n < PACK_SIZE; n ++) {
+			buf[n] = *(i64*)list;
+			list = *((void**)list + 1);
+		}
+		return list;
+	}
+
+	i64 _list_sum(void* list) {
+		i64 buf[PACK_SIZE], sum = 0;
+		u64 n;
+		while (list) list = pack(list, buf, n), sum = wrap_add(sum, kernels->sum(buf, n));
+		return sum;
+	}
+
+	i64 _list_min(void* list) {
+		if (!list) return 0;
+		i64 buf[PACK_SIZE], min = *(i64*)list;
+		u64 n;
+		while (list) {
+			list = pack(list, buf, n);
+			i64 x = kernels->min(buf, n);
+			if (x < min) min = x;
+		}
+		return min;
+	}
+
+	i64 _list_max(void* list) {
+		if (!list) return 0;
+		i64 buf[PACK_SIZE], max = *(i64*)list;
+		u64 n;
+		while (list) {
+			list = pack(list, buf, n);
+			i64 x = kernels->max(buf, n);
+			if (x > max) max = x;
+		}
+		return max;
+	}
+
+	i64 _list_count(void* list, i64 item) {
+		i64 buf[PACK_SIZE], count = 0;
+		u64 n;
+		while (list) list = pack(list, buf, n), count += kernels->count(buf, n, item);
+		return count;
+	}
+
+	// Stops at the end of the shorter list.
+	i64 _list_dot(void* a, void* b) {
+		i64 abuf[PACK_SIZE], bbuf[PACK_SIZE], dot = 0;
+		u64 an, bn;
+		while (a && b) {
+			a = pack(a, abuf, an), b = pack(b, bbuf, bn);
+			dot = wrap_add(dot, kernels->dot(abuf, bbuf, an < bn ? an : bn));
+		}
+		return dot;
+	}
+
+	i64 _str_sum(const char* s) {
+		return kernels->sum_bytes((const u8*)s, strlen(s));
+	}
+
+	i64 _str_min(const char* s) {
+		return *s ? kernels->min_bytes((const u8*)s, strlen(s)) : 0;
+	}
+
+	i64 _str_max(const char* s) {
+		return *s ? kernels->max_bytes((const u8*)s, strlen(s)) : 0;
+	}
+
+	i64 _str_count(const char* s, i64 item) {
+		if (item < 1 || item > 255) return 0; // never in a string
+		return kernels->count_bytes((const u8*)s, strlen(s), u8(item));
+	}
+
+	// Pure natives only read their arguments, and safe ones can be called
+	// on any valid arguments without trapping.
+	static const struct {
+		const char* name; void* function; bool allocates, pure, safe;
+	} NATIVES[] = {
+		{ "_cons", (void*)_cons, true, false, false },
+		{ "_strcmp", (void*)_strcmp, false, true, true },
+		{ "_strlen", (void*)_strlen, false, true, true },
+		{ "_read_line", (void*)_read_line, true, false, false },
+		{ "_read_int", (void*)_read_int, false, false, false },
+		{ "_read_word", (void*)_read_word, true, false, false },
+		{ "_char_at", (void*)_char_at, false, true, false },
+		{ "_listlen", (void*)_listlen, false, true, true },
+		{ "_list_sum", (void*)_list_sum, false, true, true },
+		{ "_list_min", (void*)_list_min, false, true, true },
+		{ "_list_max", (void*)_list_max, false, true, true },
+		{ "_list_count", (void*)_list_count, false, true, true },
+		{ "_list_dot", (void*)_list_dot, false, true, true },
+		{ "_str_sum", (void*)_str_sum, false, true, true },
+		{ "_str_min", (void*)_str_min, false, true, true },
+		{ "_str_max", (void*)_str_max, false, true, true },
+		{ "_str_count", (void*)_str_count, false, true, true },
+		{ "_new_array", (void*)_new_array, true, false, false },
+		{ "_grow_array", (void*)_grow_array, true, false, false },
+		{ "_display_int", (void*)_display_int, false, false, false },
+		{ "_display_symbol", (void*)_display_symbol, false, false, false },
+		{ "_display_bool", (void*)_display_bool, false, false, false },
+		{ "_display_string", (void*)_display_string, false, false, false },
+		{ "_display_int_list", (void*)_display_list<i64>, false, false, false },
+		{ "_display_symbol_list", (void*)_display_symbol_list, false, false, false },
+		{ "_display_bool_list", (void*)_display_list<bool>, false, false, false },
+		{ "_display_string_list", (void*)_display_list<const char*>, false, false, false },
+		{ "_display_int_array", (void*)_display_array<i64>, false, false, false },
+		{ "_display_symbol_array", (void*)_display_symbol_array, false, false, false },
+		{ "_display_bool_array", (void*)_display_array<bool>, false, false, false },
+		{ "_display_string_array", (void*)_display_array<const char*>, false, false, false }
+	};
+
+	bool is_native(const string& name) {
+		for (const auto& native : NATIVES) if (name == native.name) return true;
+		return false;
+	}
+
+	bool native_allocates(const string& name) {
+		for (const auto& native : NATIVES) if (name == native.name) return native.allocates;
+		return false;
+	}
+
+	bool native_pure(const string& name) {
+		for (const auto& native : NATIVES) if (name == native.name) return native.pure;
+		return false;
+	}
+
+	bool native_safe(const string& name) {
+		for (const auto& native : NATIVES) if (name == native.name) return native.safe;
+		return false;
+	}
+
 	void add_native_functions(Object& object) {
-		add_native_function(object, "_cons", (void*)_cons);
-
-    add_native_function(object, "_strcmp", (void*)_strcmp);
-    add_native_function(object, "_strlen", (void*)_strlen);
-    add_native_function(object, "_read_line", (void*)_read_line);
-    add_native_function(object, "_read_int", (void*)_read_int);
-    add_native_function(object, "_read_word", (void*)_read_word);
-    add_native_function(object, "_char_at", (void*)_char_at);
-    add_native_function(object, "_listlen", (void*)_listlen);
-
-		add_native_function(object, "_display_int", (void*)_display_int);
-		add_native_function(object, "_display_symbol", (void*)_display_symbol);
-		add_native_function(object, "_display_bool", (void*)_display_bool);
-		add_native_function(object, "_display_string", (void*)_display_string);
-		add_native_function(object, "_display_int_list", (void*)_display_list<i64>);
-		add_native_function(object, "_display_symbol_list", (void*)_display_symbol_list);
-		add_native_function(object, "_display_bool_list", (void*)_display_list<bool>);
-		add_native_function(object, "_display_string_list", (void*)_display_list<const char*>);
+		for (const auto& native : NATIVES) add_native_function(object, native.name, native.function);
+		add_native_function(object, "_region", gc_region()); // for inline allocation, on this thread
 	}
 }
\ No newline at end of file
@@ -7,7 +7,14 @@
 
 namespace basil {
 	void display_native_list(const Type* t, void* list);
+	void display_native_array(const Type* t, const void* array);
 	void add_native_functions(jasmine::Object& object);
+	bool is_native(const string& name); // called through a slot, not directly
+	bool native_allocates(const string& name); // and so may collect
+	bool native_pure(const string& name); // only reads its arguments
+	bool native_safe(const string& name); // and never traps, so may be called speculatively
+	void simd_enabled(bool enabled); // or run reductions with scalar loops
+	const char* simd_kernels(); // the instruction set reductions run with
   const u8* _read_line();
 }
 
@@ -0,0 +1,1729 @@
+#include "opt.h"
+#include "util/bitset.h"
+#include "util/hash.h"
+#include "native.h"
+
+namespace basil {
+	// Locals that can't be reasoned about from within a single function:
+	// those referenced by a function other than their owner, and those
+	// whose address is taken.
+	static set<u32> escaping;
+
+	// Dense ids for the locals a function owns and may optimize.
+	struct Locals {
+		map<u32, u32> ids;
+		vector<Location> locations; // id -> local
+		u32 count, seen; // locals of the function looked at so far
+
+		Locals(Function& fn): count(0), seen(0) {
+			update(fn);
+		}
+
+		// Picks up locals the function has created since.
+		void update(Function& fn) {
+			const vector<Location>& all = fn.locals();
+			for (; seen < all.size(); seen ++) {
+				if (escaping.find(all[seen].local_index) != escaping.end()) continue;
+				ids.put(all[seen].local_index, count ++);
+				locations.push(all[seen]);
+			}
+		}
+
+		i64 id(const Location* loc) const {
+			if (!loc || loc->type != SSA_LOCAL) return -1;
+			auto it = ids.find(loc->local_index);
+			return it == ids.end() ? -1 : i64(it->second);
+		}
+	};
+
+	static void find_escaping(Function& fn) {
+		set<u32> owned;
+		for (const Location& loc : fn.locals()) owned.insert(loc.local_index);
+		vector<Location*> operands;
+		for (Insn* insn : fn.insns()) {
+			operands.clear();
+			insn->uses(operands);
+			if (insn->def()) operands.push(insn->def());
+			for (Location* loc : operands) {
+				if (loc->type != SSA_LOCAL) continue;
+				if (owned.find(loc->local_index) == owned.end() || insn->kind() == INSN_ADDRESS)
+					escaping.insert(loc->local_index);
+			}
+		}
+		for (Function* f : fn.functions()) find_escaping(*f);
+	}
+
+	// Deletes every insn for which remove is set.
+	static void compact(Function& fn, const vector<bool>& remove) {
+		vector<Insn*>& insns = fn.insns();
+		u32 j = 0;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			if (remove[i]) delete insns[i];
+			else insns[j ++] = insns[i];
+		}
+		while (insns.size() > j) insns.pop();
+	}
+
+	static bool same_local(const Location& a, const Location& b) {
+		return a.type == SSA_LOCAL && b.type == SSA_LOCAL && a.local_index == b.local_index;
+	}
+
+	// whether kind is a conditional branch on a single value
+	static bool is_test(InsnKind kind) {
+		return kind == INSN_IF_ZERO || kind == INSN_IF_NONZERO;
+	}
+
+	static bool is_foldable(InsnKind kind) {
+		return kind == INSN_LOAD || kind == INSN_SELECT 
+			|| (kind >= INSN_ADD && kind <= INSN_GREATER_EQUAL);
+	}
+
+	static bool fits_i32(i64 i) {
+		return i >= -0x80000000l && i <= 0x7fffffffl;
+	}
+
+	// Emits the parallel copy dests[i] = srcs[i] as a sequence of copies,
+	// breaking cycles through a temporary.
+	static void sequentialize(Function& fn, vector<Location>& dests, vector<Location>& srcs, 
+		vector<Insn*>& out) {
+		vector<bool> done;
+		u32 left = 0;
+		for (u32 i = 0; i < dests.size(); i ++) {
+			done.push(same_local(dests[i], srcs[i]));
+			if (!done[i]) left ++;
+		}
+		while (left) {
+			bool progress = false;
+			for (u32 i = 0; i < dests.size(); i ++) {
+				if (done[i]) continue;
+				bool read = false;
+				for (u32 j = 0; j < dests.size(); j ++) 
+					if (!done[j] && j != i && same_local(srcs[j], dests[i])) read = true;
+				if (read) continue;
+				out.push(new StoreInsn(dests[i], srcs[i], true));
+				done[i] = true, left --, progress = true;
+			}
+			if (progress) continue;
+
+			// everything left is part of a cycle
+			u32 i = 0;
+			while (done[i]) i ++;
+			Location temp = fn.create_local(ssa_type(dests[i]));
+			out.push(new StoreInsn(temp, dests[i], true));
+			for (u32 j = 0; j < dests.size(); j ++)
+				if (!done[j] && same_local(srcs[j], dests[i])) srcs[j] = temp;
+		}
+	}
+
+	// Turns calls a function makes to itself in tail position - where the
+	// call's result goes straight to the function's return - into 
+	// assignments to its parameters and a jump back to the top of its body.
+	// Calls whose result is consed onto and returned are turned into loops
+	// too, each iteration filling in the tail of the previous cell.
+	static u32 tail_calls(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		vector<Location> params;
+		u32 body = 0;
+		while (body < insns.size() && insns[body]->kind() == INSN_LOAD_ARGUMENT) {
+			if (((LoadArgumentInsn*)insns[body])->index() != params.size()) return 0;
+			params.push(insns[body ++]->loc());
+		}
+		map<u32, u32> labels; // label -> position
+		u32 ret = insns.size(); // the return ending the function, if there is one
+		for (u32 i = 0; i < insns.size(); i ++) {
+			if (insns[i]->kind() == INSN_LABEL) labels.put(((Label*)insns[i])->label(), i);
+			else ret = insns[i]->kind() == INSN_RET ? i : insns.size();
+		}
+		if (ret == insns.size()) return 0;
+
+		vector<Location*> operands;
+		auto returned = [&](u32 i, Location value) -> bool {
+			for (u32 steps = 0; steps < insns.size() && i < insns.size(); steps ++) {
+				InsnKind kind = insns[i]->kind();
+				if (kind == INSN_LABEL) i ++;
+				else if (kind == INSN_GOTO) {
+					auto it = labels.find(((BranchInsn*)insns[i])->label());
+					if (it == labels.end()) return false;
+					i = it->second;
+				}
+				else if (kind == INSN_LOAD || kind == INSN_STORE || kind == INSN_RET) {
+					operands.clear();
+					insns[i]->uses(operands);
+					if (!same_local(*operands[0], value)) return false;
+					if (kind == INSN_RET) return i == ret;
+					value = *insns[i]->def();
+					if (escaping.find(value.local_index) != escaping.end()) return false;
+					i ++;
+				}
+				else return false;
+			}
+			return false;
+		};
+
+		// cons cells built in tail position are linked through these: head is
+		// the first cell built, and last the one whose tail is still unset
+		Location head = ssa_none(), last = ssa_none();
+		u32 cons = ssa_find_label("_cons");
+		auto is_call_to = [&](u32 i, u32 label) -> bool {
+			if (i >= insns.size() || insns[i]->kind() != INSN_CALL) return false;
+			operands.clear();
+			insns[i]->uses(operands);
+			return operands[0]->type == SSA_LABEL && operands[0]->label_index == label;
+		};
+		auto is_argument = [&](u32 i, u32 index, Location* src) -> bool {
+			if (i >= insns.size() || insns[i]->kind() != INSN_STORE_ARGUMENT 
+				|| ((StoreArgumentInsn*)insns[i])->index() != index) return false;
+			operands.clear();
+			insns[i]->uses(operands);
+			if (src) *src = *operands[0];
+			return true;
+		};
+
+		vector<vector<Insn*>> replacements; // inserted before each insn
+		vector<bool> remove;
+		for (u32 i = 0; i <= insns.size(); i ++) replacements.push(vector<Insn*>()), remove.push(false);
+		u32 entry = 0, converted = 0;
+		vector<Location> srcs;
+		for (u32 c = body; c < insns.size(); c ++) {
+			if (!is_call_to(c, fn.label())) continue;
+			
+			// either the call is returned directly, or the list cell it's 
+			// consed onto is: c, $0 = value, $1 = c, cell = _cons()
+			Location rest;
+			bool modulo_cons = is_argument(c + 1, 0, nullptr) && is_argument(c + 2, 1, &rest)
+				&& same_local(rest, insns[c]->loc()) && is_call_to(c + 3, cons) 
+				&& returned(c + 4, insns[c + 3]->loc());
+			if (!modulo_cons && !returned(c + 1, insns[c]->loc())) continue;
+
+			// the argument stores right before the call, possibly between
+			// taking the addresses of function arguments
+			srcs.clear();
+			for (u32 i = 0; i < params.size(); i ++) srcs.push(ssa_none());
+			u32 found = 0;
+			i64 first = i64(c) - 1;
+			for (; first >= body && found < params.size(); first --) {
+				InsnKind kind = insns[first]->kind();
+				if (kind == INSN_ADDRESS) continue;
+				if (kind != INSN_STORE_ARGUMENT) break;
+				u32 index = ((StoreArgumentInsn*)insns[first])->index();
+				if (index >= params.size() || srcs[index].type != SSA_NONE) break;
+				operands.clear();
+				insns[first]->uses(operands);
+				srcs[index] = *operands[0], found ++;
+			}
+			if (found < params.size()) continue;
+
+			for (i64 i = first + 1; i < c; i ++)
+				if (insns[i]->kind() == INSN_STORE_ARGUMENT) remove[i] = true;
+			remove[c] = true;
+			if (!entry) entry = ssa_next_label();
+			vector<Insn*>& out = replacements[modulo_cons ? c + 4 : c];
+			if (modulo_cons) {
+				// allocate the cell with an empty tail, and link it to the last
+				Location cell = insns[c + 3]->loc();
+				if (head.type == SSA_NONE) 
+					head = fn.create_local(ssa_type(cell)), last = fn.create_local(ssa_type(cell));
+				operands.clear();
+				insns[c + 2]->uses(operands);
+				*operands[0] = ssa_immediate(0);
+				u32 link = ssa_next_label(), join = ssa_next_label();
+				out.push(new IfNonZeroInsn(link, last));
+				out.push(new StoreInsn(head, cell, true));
+				out.push(new GotoInsn(join));
+				out.push(new Label(link));
+				out.push(new StorePtrInsn(last, cell, 8));
+				out.push(new Label(join));
+				out.push(new StoreInsn(last, cell, true));
+			}
+			sequentialize(fn, params, srcs, out);
+			out.push(new GotoInsn(entry));
+			converted ++;
+		}
+		if (!converted) return 0;
+
+		if (head.type != SSA_NONE) {
+			// the value returned at the end of the chain becomes the last tail
+			replacements[body].push(new StoreInsn(head, ssa_immediate(0), true));
+			replacements[body].push(new StoreInsn(last, ssa_immediate(0), true));
+			operands.clear();
+			insns[ret]->uses(operands);
+			Location value = *operands[0], result = fn.create_local(ssa_type(head));
+			u32 done = ssa_next_label();
+			replacements[ret].push(new StoreInsn(result, value, true));
+			replacements[ret].push(new IfZeroInsn(done, last));
+			replacements[ret].push(new StorePtrInsn(last, value, 8));
+			replacements[ret].push(new StoreInsn(result, head, true));
+			replacements[ret].push(new Label(done));
+			*operands[0] = result;
+		}
+
+		vector<Insn*> result;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			for (Insn* insn : replacements[i]) result.push(insn);
+			if (i == body) result.push(new Label(entry));
+			if (remove[i]) delete insns[i];
+			else result.push(insns[i]);
+		}
+		fn.set_insns(result);
+		return converted;
+	}
+
+	// Puts the function into SSA form. Each def of a local written more than
+	// once gets a fresh version, and phis are placed on the dominance
+	// frontiers of its defs wherever versions meet. Locals that are never
+	// read across a block boundary don't need phis at all.
+	static u32 mem2reg(Function& fn) {
+		if (fn.insns().size() == 0) return 0;
+		Locals locals(fn);
+		Blocks blocks;
+		ssa_find_blocks(fn.insns(), blocks);
+
+		// every value reaching a phi comes from some predecessor, so give
+		// loops at the very start of the function an empty entry block
+		if (blocks.preds[0].size()) {
+			vector<Insn*> insns;
+			insns.push(new Label(ssa_next_label()));
+			for (Insn* insn : fn.insns()) insns.push(insn);
+			fn.set_insns(insns);
+			ssa_find_blocks(fn.insns(), blocks);
+		}
+
+		vector<Insn*>& insns = fn.insns();
+		u32 n = blocks.size();
+		vector<u32> defs;
+		vector<vector<u32>> sites; // blocks defining each local
+		for (u32 i = 0; i < locals.count; i ++) defs.push(0), sites.push(vector<u32>());
+		bitset global(locals.count), promoted(locals.count);
+		vector<Location*> operands;
+		for (u32 b = 0; b < n; b ++) {
+			bitset killed(locals.count);
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				operands.clear();
+				insns[i]->uses(operands);
+				for (Location* loc : operands) {
+					i64 id = locals.id(loc);
+					if (id >= 0 && !killed.contains(id)) global.insert(id);
+				}
+				i64 id = locals.id(insns[i]->def());
+				if (id < 0) continue;
+				defs[id] ++, killed.insert(id);
+				if (sites[id].size() == 0 || sites[id].back() != b) sites[id].push(b);
+			}
+		}
+		bool any = false;
+		for (u32 i = 0; i < locals.count; i ++) 
+			if (defs[i] > 1) promoted.insert(i), any = true;
+		if (!any) return 0;
+
+		vector<vector<u32>> frontier;
+		for (u32 b = 0; b < n; b ++) frontier.push(vector<u32>());
+		for (u32 b : blocks.order) {
+			if (blocks.preds[b].size() < 2) continue;
+			for (u32 p : blocks.preds[b]) {
+				if (!blocks.reachable(p)) continue;
+				for (i64 r = p; r != blocks.idom[b]; r = blocks.idom[r])
+					if (frontier[r].size() == 0 || frontier[r].back() != b) frontier[r].push(b);
+			}
+		}
+
+		// locals needing a phi at the start of each block
+		vector<vector<u32>> phi_vars;
+		for (u32 b = 0; b < n; b ++) phi_vars.push(vector<u32>());
+		for (u32 v = 0; v < locals.count; v ++) {
+			if (!promoted.contains(v) || !global.contains(v)) continue;
+			bitset placed(n), queued(n);
+			vector<u32> worklist;
+			for (u32 b : sites[v]) queued.insert(b), worklist.push(b);
+			while (worklist.size()) {
+				u32 b = worklist.back();
+				worklist.pop();
+				for (u32 f : frontier[b]) {
+					if (placed.contains(f)) continue;
+					placed.insert(f), phi_vars[f].push(v);
+					if (!queued.contains(f)) queued.insert(f), worklist.push(f);
+				}
+			}
+		}
+
+		// phis refer to their predecessors by label, so make sure they have one
+		bitset needs_label(n);
+		for (u32 b = 0; b < n; b ++) {
+			if (phi_vars[b].size() == 0) continue;
+			needs_label.insert(b);
+			for (u32 p : blocks.preds[b]) needs_label.insert(p);
+		}
+		vector<Insn*> result;
+		vector<u32> labels;
+		vector<vector<PhiInsn*>> phis;
+		for (u32 b = 0; b < n; b ++) {
+			u32 i = blocks.starts[b];
+			if (insns[i]->kind() == INSN_LABEL) labels.push(((Label*)insns[i])->label()), result.push(insns[i ++]);
+			else if (needs_label.contains(b)) labels.push(ssa_next_label()), result.push(new Label(labels.back()));
+			else labels.push(0);
+			phis.push(vector<PhiInsn*>());
+			for (u32 v : phi_vars[b]) {
+				phis[b].push(new PhiInsn(locals.locations[v]));
+				result.push(phis[b].back());
+			}
+			for (; i < blocks.end(b); i ++) result.push(insns[i]);
+		}
+		fn.set_insns(result);
+		ssa_find_blocks(insns, blocks); // adds no blocks, just moves their starts
+
+		// rename along the dominator tree, with a stack of versions per local
+		vector<vector<Location>> stacks;
+		vector<vector<u32>> pushed; // locals versioned in each block
+		for (u32 v = 0; v < locals.count; v ++) stacks.push(vector<Location>());
+		for (u32 b = 0; b < n; b ++) pushed.push(vector<u32>());
+		u32 renamed = 0;
+		vector<i64> worklist;
+		worklist.push(0);
+		while (worklist.size()) {
+			i64 item = worklist.back();
+			worklist.pop();
+			if (item < 0) {
+				for (u32 v : pushed[~item]) stacks[v].pop();
+				continue;
+			}
+			u32 b = item;
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				if (insns[i]->kind() != INSN_PHI) {
+					operands.clear();
+					insns[i]->uses(operands);
+					for (Location* loc : operands) {
+						i64 id = locals.id(loc);
+						if (id >= 0 && promoted.contains(id) && stacks[id].size()) *loc = stacks[id].back();
+					}
+				}
+				i64 id = locals.id(insns[i]->def());
+				if (id < 0 || !promoted.contains(id)) continue;
+				Location version = fn.next_local(locals.locations[id]);
+				*insns[i]->def() = version;
+				stacks[id].push(version), pushed[b].push(id), renamed ++;
+			}
+			for (u32 succ : blocks.succs[b]) {
+				for (u32 k = 0; k < phis[succ].size(); k ++) {
+					u32 v = phi_vars[succ][k];
+					phis[succ][k]->add(labels[b], stacks[v].size() ? stacks[v].back() : locals.locations[v]);
+				}
+			}
+			worklist.push(~i64(b));
+			for (u32 child : blocks.children[b]) worklist.push(child);
+		}
+		return renamed;
+	}
+
+	// Sparse conditional constant propagation. The locals here can have
+	// several defs, so each one's value is the meet over all defs in
+	// blocks found to be executable.
+	enum LatticeKind {
+		LATTICE_TOP,
+		LATTICE_CONST,
+		LATTICE_BOTTOM
+	};
+
+	struct Lattice {
+		LatticeKind kind;
+		i64 value;
+	};
+
+	static const Lattice TOP = { LATTICE_TOP, 0 }, BOTTOM = { LATTICE_BOTTOM, 0 };
+
+	static Lattice constant(i64 value) {
+		return { LATTICE_CONST, value };
+	}
+
+	static Lattice meet(const Lattice& a, const Lattice& b) {
+		if (a.kind == LATTICE_TOP) return b;
+		if (b.kind == LATTICE_TOP) return a;
+		if (a.kind == LATTICE_CONST && b.kind == LATTICE_CONST && a.value == b.value) return a;
+		return BOTTOM;
+	}
+
+	static bool fold(InsnKind kind, i64 l, i64 r, i64& result) {
+		switch (kind) {
+			case INSN_ADD: result = i64(u64(l) + u64(r)); return true;
+			case INSN_SUB: result = i64(u64(l) - u64(r)); return true;
+			case INSN_MUL: result = i64(u64(l) * u64(r)); return true;
+			case INSN_DIV:
+			case INSN_REM:
+				if (r == 0 || (r == -1 && l == (i64)0x8000000000000000ul)) return false; // leave the trap to runtime
+				result = kind == INSN_DIV ? l / r : l % r;
+				return true;
+			case INSN_AND: result = l & r; return true;
+			case INSN_OR: result = l | r; return true;
+			case INSN_XOR: result = l ^ r; return true;
+			case INSN_EQUAL: result = l == r; return true;
+			case INSN_INEQUAL: result = l != r; return true;
+			case INSN_LESS: result = l < r; return true;
+			case INSN_LESS_EQUAL: result = l <= r; return true;
+			case INSN_GREATER: result = l > r; return true;
+			case INSN_GREATER_EQUAL: result = l >= r; return true;
+			default: return false;
+		}
+	}
+
+	static u32 sccp(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		if (insns.size() == 0) return 0;
+		Locals locals(fn);
+		Blocks blocks;
+		ssa_find_blocks(insns, blocks);
+
+		// locals never written in this function keep whatever they hold
+		vector<Lattice> values;
+		bitset defined(locals.count);
+		for (Insn* insn : insns) {
+			i64 id = locals.id(insn->def());
+			if (id >= 0) defined.insert(id);
+		}
+		for (u32 i = 0; i < locals.count; i ++) values.push(defined.contains(i) ? TOP : BOTTOM);
+
+		auto value_of = [&](const Location* loc) -> Lattice {
+			if (loc->type == SSA_IMMEDIATE) return constant(loc->immediate);
+			i64 id = locals.id(loc);
+			return id >= 0 ? values[id] : BOTTOM;
+		};
+
+		auto evaluate = [&](Insn* insn, vector<Location*>& operands) -> Lattice {
+			InsnKind kind = insn->kind();
+			if (kind == INSN_LOAD || kind == INSN_STORE) return value_of(operands[0]);
+			if (kind == INSN_NOT) {
+				Lattice src = value_of(operands[0]);
+				return src.kind == LATTICE_CONST ? constant(!src.value) : src;
+			}
+			if (kind >= INSN_ADD && kind <= INSN_GREATER_EQUAL) {
+				Lattice l = value_of(operands[0]), r = value_of(operands[1]);
+				if (l.kind == LATTICE_BOTTOM || r.kind == LATTICE_BOTTOM) return BOTTOM;
+				if (l.kind == LATTICE_TOP || r.kind == LATTICE_TOP) return TOP;
+				i64 result;
+				return fold(kind, l.value, r.value, result) ? constant(result) : BOTTOM;
+			}
+			if (kind == INSN_SELECT) {
+				Lattice l = value_of(operands[0]), r = value_of(operands[1]);
+				Lattice t = value_of(operands[2]), f = value_of(operands[3]);
+				i64 holds;
+				if (l.kind == LATTICE_CONST && r.kind == LATTICE_CONST)
+					return fold(((SelectInsn*)insn)->compare(), l.value, r.value, holds) && holds ? t : f;
+				if (l.kind == LATTICE_TOP || r.kind == LATTICE_TOP) return TOP;
+				return meet(t, f);
+			}
+			return BOTTOM;
+		};
+
+		// a branch on a value no executable def reaches is treated as unknown
+		auto taken = [&](u32 b, u32 succ) -> bool {
+			Insn* last = insns[blocks.end(b) - 1];
+			if (!is_test(last->kind()) || blocks.succs[b].size() == 1) return true;
+			vector<Location*> operands;
+			last->uses(operands);
+			Lattice cond = value_of(operands[0]);
+			if (cond.kind != LATTICE_CONST) return true;
+			bool jumps = (cond.value == 0) == (last->kind() == INSN_IF_ZERO);
+			return succ == blocks.labels[((BranchInsn*)last)->label()] ? jumps : !jumps;
+		};
+
+		// a phi only sees values along edges found to be executable
+		bitset executable(blocks.size());
+		auto incoming = [&](PhiInsn* phi, u32 b) -> Lattice {
+			Lattice v = TOP;
+			for (u32 k = 0; k < phi->size(); k ++) {
+				auto it = blocks.labels.find(phi->pred(k));
+				if (it == blocks.labels.end() || !executable.contains(it->second)) continue;
+				bool edge = false;
+				for (u32 succ : blocks.succs[it->second]) if (succ == b) edge = true;
+				if (edge && taken(it->second, b)) v = meet(v, value_of(&phi->arg(k)));
+			}
+			return v;
+		};
+
+		executable.insert(0);
+		vector<Location*> operands;
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (u32 b = 0; b < blocks.size(); b ++) {
+				if (!executable.contains(b)) continue;
+				for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+					i64 id = locals.id(insns[i]->def());
+					if (id < 0) continue;
+					operands.clear();
+					insns[i]->uses(operands);
+					Lattice v = meet(values[id], insns[i]->kind() == INSN_PHI 
+						? incoming((PhiInsn*)insns[i], b) : evaluate(insns[i], operands));
+					if (v.kind != values[id].kind || v.value != values[id].value)
+						values[id] = v, changed = true;
+				}
+				for (u32 succ : blocks.succs[b]) {
+					if (!executable.contains(succ) && taken(b, succ))
+						executable.insert(succ), changed = true;
+				}
+			}
+		}
+
+		// rewrite constant results, operands, and branches
+		u32 rewritten = 0;
+		vector<bool> remove;
+		for (u32 i = 0; i < insns.size(); i ++) remove.push(false);
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			if (!executable.contains(b)) {
+				for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) remove[i] = true, rewritten ++;
+				continue;
+			}
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				Insn* insn = insns[i];
+				InsnKind kind = insn->kind();
+				i64 id = locals.id(insn->def());
+				if (id >= 0 && values[id].kind == LATTICE_CONST && is_foldable(kind)) {
+					operands.clear();
+					insn->uses(operands);
+					if (kind == INSN_LOAD && operands[0]->type == SSA_IMMEDIATE) continue;
+					fn.replace(i, new LoadInsn(ssa_immediate(values[id].value)));
+					rewritten ++;
+					continue;
+				}
+				if (kind == INSN_ADDRESS || kind == INSN_LOAD_PTR || kind == INSN_CALL) continue;
+				if (kind == INSN_SELECT) { // the comparison might be known even if the result isn't
+					operands.clear();
+					insn->uses(operands);
+					Lattice l = value_of(operands[0]), r = value_of(operands[1]);
+					i64 holds;
+					if (l.kind == LATTICE_CONST && r.kind == LATTICE_CONST) {
+						fold(((SelectInsn*)insn)->compare(), l.value, r.value, holds);
+						fn.replace(i, new LoadInsn(*operands[holds ? 2 : 3]));
+						rewritten ++;
+						continue;
+					}
+				}
+
+				bool any_size = kind == INSN_STORE || kind == INSN_STORE_ARGUMENT || kind == INSN_RET
+					|| kind == INSN_IF_ZERO || kind == INSN_IF_NONZERO || kind == INSN_PHI;
+				operands.clear();
+				insn->uses(operands);
+				if (kind == INSN_STORE_PTR) operands[0] = operands[1], operands.pop(); // keep the pointer
+				for (Location* loc : operands) {
+					Lattice v = value_of(loc);
+					if (loc->type == SSA_LOCAL && v.kind == LATTICE_CONST && (any_size || fits_i32(v.value)))
+						*loc = ssa_immediate(v.value), rewritten ++;
+				}
+
+				if (is_test(kind) && operands[0]->type == SSA_IMMEDIATE) {
+					if ((operands[0]->immediate == 0) != (kind == INSN_IF_ZERO)) remove[i] = true;
+					else fn.replace(i, new GotoInsn(((BranchInsn*)insn)->label()));
+					rewritten ++;
+				}
+			}
+		}
+		compact(fn, remove);
+		return rewritten;
+	}
+
+	// Copy propagation. Given a copy t = s, where t is defined only there,
+	// uses of t become uses of s so long as no path from the copy to a use
+	// of t redefines s.
+	static u32 copy_propagation(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		Locals locals(fn);
+		Blocks blocks;
+		ssa_find_blocks(insns, blocks);
+		vector<u32> block_of;
+		for (u32 b = 0; b < blocks.size(); b ++)
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) block_of.push(b);
+
+		// where each local is defined, and the operands that read it
+		vector<u32> defs, def_at;
+		vector<vector<u32>> use_at;
+		vector<vector<Location*>> use_locs;
+		for (u32 i = 0; i < locals.count; i ++) 
+			defs.push(0), def_at.push(0), use_at.push(vector<u32>()), use_locs.push(vector<Location*>());
+		vector<Location*> operands;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			i64 id = locals.id(insns[i]->def());
+			if (id >= 0) defs[id] ++, def_at[id] = i;
+			operands.clear();
+			insns[i]->uses(operands);
+			for (Location* loc : operands) {
+				i64 used = locals.id(loc);
+				if (used >= 0) use_at[used].push(i), use_locs[used].push(loc);
+			}
+		}
+
+		// whether insn a runs before b on every path to b
+		auto before = [&](u32 a, u32 b) -> bool {
+			return block_of[a] == block_of[b] ? a < b : blocks.dominates(block_of[a], block_of[b]);
+		};
+
+		// positions are insn indices, doubled to track whether s was redefined
+		auto walk = [&](u32 copy, i64 t, i64 s) -> bool {
+			u32 n = insns.size();
+			bitset visited(2 * n);
+			vector<u32> worklist;
+			auto visit = [&](u32 i, bool killed) {
+				if (i >= n || i == copy) return; // the copy itself restores t = s
+				if (!visited.contains(2 * i + killed)) visited.insert(2 * i + killed), worklist.push(2 * i + killed);
+			};
+			visit(copy + 1, false);
+			while (worklist.size()) {
+				u32 pos = worklist.back();
+				worklist.pop();
+				u32 i = pos / 2;
+				bool killed = pos % 2;
+				operands.clear();
+				insns[i]->uses(operands);
+				for (Location* loc : operands) if (killed && locals.id(loc) == t) return false;
+				if (locals.id(insns[i]->def()) == s) killed = true;
+				if (i + 1 < blocks.end(block_of[i])) visit(i + 1, killed);
+				else for (u32 succ : blocks.succs[block_of[i]]) visit(blocks.starts[succ], killed);
+			}
+			return true;
+		};
+
+		// In SSA form, s is defined once, before the copy, and the copy comes
+		// before every use of t - any path from the copy back through the
+		// definition of s to a use of t passes the copy again.
+		auto safe = [&](u32 copy, i64 t, i64 s) -> bool {
+			if (defs[s] == 0) return true;
+			if (defs[s] == 1 && before(def_at[s], copy)) {
+				bool dominated = true;
+				for (u32 use : use_at[t]) if (use != copy && !before(copy, use)) dominated = false;
+				if (dominated) return true;
+			}
+			return walk(copy, t, s);
+		};
+
+		u32 propagated = 0;
+		for (u32 c = 0; c < insns.size(); c ++) {
+			InsnKind kind = insns[c]->kind();
+			if (kind != INSN_LOAD && kind != INSN_STORE) continue;
+			operands.clear();
+			insns[c]->uses(operands);
+			Location src = *operands[0];
+			i64 t = locals.id(insns[c]->def()), s = locals.id(&src);
+			if (t < 0 || s < 0 || t == s || defs[t] != 1 || !safe(c, t, s)) continue;
+
+			// the uses of t are now uses of s, should s itself be a copy
+			for (u32 u = 0; u < use_at[t].size(); u ++) {
+				if (use_at[t][u] == c) continue;
+				*use_locs[t][u] = src, propagated ++;
+				use_at[s].push(use_at[t][u]), use_locs[s].push(use_locs[t][u]);
+			}
+			use_at[t].clear(), use_locs[t].clear();
+		}
+		return propagated;
+	}
+
+	// Dead code elimination: removes side-effect-free insns whose results
+	// are never read.
+	static u32 dce(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		Locals locals(fn);
+		vector<u32> uses;
+		for (u32 i = 0; i < locals.count; i ++) uses.push(0);
+		vector<Location*> operands;
+		for (Insn* insn : insns) {
+			operands.clear();
+			insn->uses(operands);
+			for (Location* loc : operands) {
+				i64 id = locals.id(loc);
+				if (id >= 0) uses[id] ++;
+			}
+		}
+
+		vector<bool> remove;
+		for (u32 i = 0; i < insns.size(); i ++) remove.push(false);
+		u32 removed = 0;
+		bool progress = true;
+		while (progress) {
+			progress = false;
+			for (i64 i = i64(insns.size()) - 1; i >= 0; i --) {
+				if (remove[i]) continue;
+				InsnKind kind = insns[i]->kind();
+				operands.clear();
+				insns[i]->uses(operands);
+				bool pure = kind == INSN_LOAD || kind == INSN_STORE || kind == INSN_LOAD_PTR
+					|| kind == INSN_ADDRESS || kind == INSN_LOAD_ARGUMENT || kind == INSN_NOT
+					|| kind == INSN_PHI || kind == INSN_SELECT || (kind >= INSN_ADD && kind <= INSN_GREATER_EQUAL
+						&& kind != INSN_DIV && kind != INSN_REM);
+				if (kind == INSN_DIV || kind == INSN_REM) // may trap unless the divisor is known
+					pure = operands[1]->type == SSA_IMMEDIATE && operands[1]->immediate != 0
+						&& operands[1]->immediate != -1;
+				i64 id = locals.id(insns[i]->def());
+				if (!pure || id < 0 || uses[id]) continue;
+
+				remove[i] = true, progress = true, removed ++;
+				for (Location* loc : operands) {
+					i64 used = locals.id(loc);
+					if (used >= 0) uses[used] --;
+				}
+			}
+		}
+		compact(fn, remove);
+		return removed;
+	}
+
+	// A natural loop: its header, and every block that can reach one of the
+	// header's back edges without passing through the header.
+	struct Loop {
+		u32 header;
+		bitset body;
+		vector<u32> latches, entries; // preds of the header inside and outside
+	};
+
+	static bool find_loop(const Blocks& blocks, u32 label, Loop& loop) {
+		auto it = blocks.labels.find(label);
+		if (it == blocks.labels.end()) return false;
+		u32 h = it->second;
+		loop.header = h, loop.body = bitset(blocks.size());
+		loop.latches.clear(), loop.entries.clear();
+		loop.body.insert(h);
+		vector<u32> worklist;
+		for (u32 p : blocks.preds[h]) {
+			if (!blocks.reachable(p)) continue;
+			if (blocks.dominates(h, p)) loop.latches.push(p), worklist.push(p);
+			else loop.entries.push(p);
+		}
+		while (worklist.size()) {
+			u32 b = worklist.back();
+			worklist.pop();
+			if (loop.body.contains(b)) continue;
+			loop.body.insert(b);
+			for (u32 p : blocks.preds[b]) 
+				if (blocks.reachable(p) && !loop.body.contains(p)) worklist.push(p);
+		}
+		return loop.latches.size() > 0;
+	}
+
+	// Labels of every loop header, outermost first.
+	static void find_headers(const vector<Insn*>& insns, const Blocks& blocks, vector<u32>& headers) {
+		for (u32 b : blocks.order) {
+			Insn* first = insns[blocks.starts[b]];
+			if (first->kind() != INSN_LABEL) continue;
+			for (u32 p : blocks.preds[b]) {
+				if (blocks.reachable(p) && blocks.dominates(b, p)) {
+					headers.push(((Label*)first)->label());
+					break;
+				}
+			}
+		}
+	}
+
+	// Finds a block that runs right before every entry into the loop, and 
+	// the position in it where code can be hoisted to. If the loop's only
+	// entering block doesn't do, a new one is made in front of the header.
+	static bool preheader(Function& fn, Blocks& blocks, Loop& loop, u32& label, u32& pos) {
+		vector<Insn*>& insns = fn.insns();
+		Insn* first = insns[blocks.starts[loop.header]];
+		if (loop.entries.size() != 1 || first->kind() != INSN_LABEL) return false;
+		u32 e = loop.entries[0], h = loop.header, header_label = ((Label*)first)->label();
+		Insn *start = insns[blocks.starts[e]], *last = insns[blocks.end(e) - 1];
+		if (blocks.succs[e].size() == 1 && start->kind() == INSN_LABEL) {
+			label = ((Label*)start)->label();
+			pos = ssa_is_branch(last->kind()) ? blocks.end(e) - 1 : blocks.end(e);
+			return true;
+		}
+
+		label = ssa_next_label();
+		if (ssa_is_branch(last->kind()) && ((BranchInsn*)last)->label() == header_label)
+			((BranchInsn*)last)->retarget(label);
+		if (start->kind() == INSN_LABEL) {
+			for (u32 i = blocks.starts[h] + 1; i < blocks.end(h) && insns[i]->kind() == INSN_PHI; i ++)
+				((PhiInsn*)insns[i])->retarget(((Label*)start)->label(), label);
+		}
+		// a latch falling through into the header now has to jump over us
+		InsnKind before = h > 0 ? insns[blocks.end(h - 1) - 1]->kind() : INSN_GOTO;
+		bool jump = h > 0 && loop.body.contains(h - 1) && before != INSN_GOTO && before != INSN_RET;
+		vector<Insn*> result;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			if (i == blocks.starts[h]) {
+				if (jump) result.push(new GotoInsn(header_label));
+				result.push(new Label(label));
+			}
+			result.push(insns[i]);
+		}
+		fn.set_insns(result);
+		ssa_insert_preheader(blocks, h, e, label, jump);
+		find_loop(blocks, header_label, loop);
+		pos = blocks.starts[loop.header];
+		return true;
+	}
+
+	// Moves block starts to where their insns went when the function was
+	// rebuilt: at[i] is the new position of old insn i, or of the next one
+	// kept if it was dropped. Blocks left empty make it rescan.
+	static void renumber(Function& fn, Blocks& blocks, const vector<u32>& at) {
+		for (u32& start : blocks.starts) start = at[start];
+		blocks.num_insns = fn.insns().size();
+		for (u32 b = 0; b < blocks.size(); b ++)
+			if (blocks.starts[b] == blocks.end(b)) return ssa_find_blocks(fn.insns(), blocks);
+	}
+
+	// What licm and induction_variables know about a function, kept up to
+	// date from one loop to the next rather than recomputed for each.
+	struct Loops {
+		Blocks blocks;
+		Locals locals;
+		vector<u32> defs; // number of definitions of each local
+		vector<u32> headers; // labels of loop headers, outermost first
+
+		Loops(Function& fn): locals(fn) {
+			ssa_find_blocks(fn.insns(), blocks);
+			find_headers(fn.insns(), blocks, headers);
+			define(fn, fn.insns());
+		}
+
+		// Counts the definitions made by insns new to the function.
+		void define(Function& fn, const vector<Insn*>& added) {
+			locals.update(fn);
+			while (defs.size() < locals.count) defs.push(0);
+			for (Insn* insn : added) {
+				i64 id = locals.id(insn->def());
+				if (id >= 0) defs[id] ++;
+			}
+		}
+	};
+
+	// Returns 0 if insn isn't a call to a pure native, 1 if it might trap,
+	// and 2 if it's safe to call speculatively.
+	static u32 pure_call(Insn* insn) {
+		if (insn->kind() != INSN_CALL) return 0;
+		vector<Location*> operands;
+		insn->uses(operands);
+		if (operands[0]->type != SSA_LABEL) return 0;
+		const string& name = ssa_label_name(operands[0]->label_index);
+		if (!native_pure(name)) return 0;
+		return native_safe(name) ? 2 : 1;
+	}
+
+	// Whether load reads a list cell or a string, which never change once
+	// built, rather than an array.
+	static bool immutable(LoadPtrInsn* load) {
+		const Indirect& src = load->src();
+		if (src.chain.size()) return false;
+		const Type* t = ssa_type(src.base)->concretify();
+		return t->kind() == KIND_LIST || t == STRING;
+	}
+
+	// Moves insns computing the same value on every iteration of the loop
+	// into its preheader.
+	static u32 hoist(Function& fn, Loops& loops, Loop& loop) {
+		vector<Insn*>& insns = fn.insns();
+		Blocks& blocks = loops.blocks;
+		const Locals& locals = loops.locals;
+		const vector<u32>& defs = loops.defs;
+		bitset varies(locals.count); // defined within the loop
+		bool stores = false; // writes through a pointer somewhere in the loop
+		bool calls = false; // calls something that might write to or collect an array
+		vector<u32> exits; // blocks with a successor outside the loop
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			if (!loop.body.contains(b)) continue;
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				i64 id = locals.id(insns[i]->def());
+				if (id >= 0) varies.insert(id);
+				if (insns[i]->kind() == INSN_STORE_PTR) stores = true;
+				if (insns[i]->kind() == INSN_CALL && !pure_call(insns[i])) calls = true;
+			}
+			for (u32 succ : blocks.succs[b]) 
+				if (!loop.body.contains(succ)) { exits.push(b); break; }
+		}
+
+		// insns that might trap are only moved if they'd run anyway
+		auto always = [&](u32 b) -> bool {
+			for (u32 exit : exits) if (!blocks.dominates(b, exit)) return false;
+			return true;
+		};
+		vector<Location*> operands;
+		auto invariant = [&](Insn* insn) -> bool {
+			operands.clear();
+			insn->uses(operands);
+			for (Location* loc : operands) {
+				if (loc->type == SSA_IMMEDIATE || loc->type == SSA_LABEL) continue;
+				i64 id = locals.id(loc);
+				if (id < 0 || varies.contains(id)) return false;
+			}
+			return true;
+		};
+		// number of insns, starting at i, that can be moved together
+		auto movable = [&](u32 i, u32 b) -> u32 {
+			InsnKind kind = insns[i]->kind();
+			u32 n = 1;
+			if (kind == INSN_STORE_ARGUMENT) { // the arguments to a pure call
+				while (i + n < blocks.end(b) && insns[i + n]->kind() == INSN_STORE_ARGUMENT) n ++;
+				u32 call = i + n < blocks.end(b) ? pure_call(insns[i + n]) : 0;
+				if (!call || stores || (call == 1 && !always(b))) return 0;
+				for (u32 j = 0; j < n; j ++) 
+					if (((StoreArgumentInsn*)insns[i + j])->index() != j || !invariant(insns[i + j])) return 0;
+				n ++;
+			}
+			else if (kind == INSN_DIV || kind == INSN_REM) {
+				operands.clear();
+				insns[i]->uses(operands);
+				bool safe = operands[1]->type == SSA_IMMEDIATE && operands[1]->immediate != 0
+					&& operands[1]->immediate != -1;
+				if (!safe && !always(b)) return 0;
+			}
+			else if (kind == INSN_LOAD_PTR) {
+				if (stores || (calls && !immutable((LoadPtrInsn*)insns[i])) || !always(b)) return 0;
+			}
+			else if (kind != INSN_NOT && kind != INSN_SELECT 
+				&& (kind < INSN_ADD || kind > INSN_GREATER_EQUAL)) return 0;
+			i64 id = locals.id(insns[i + n - 1]->def());
+			if (id < 0 || defs[id] != 1 || !invariant(insns[i + n - 1])) return 0;
+			return n;
+		};
+
+		vector<Insn*> hoisted;
+		set<Insn*> moved;
+		bool progress = true;
+		while (progress) {
+			progress = false;
+			for (u32 b = 0; b < blocks.size(); b ++) {
+				if (!loop.body.contains(b)) continue;
+				for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+					u32 n = moved.find(insns[i]) != moved.end() ? 0 : movable(i, b);
+					if (!n) continue;
+					for (u32 j = i; j < i + n; j ++) moved.insert(insns[j]), hoisted.push(insns[j]);
+					varies.erase(locals.id(insns[i + n - 1]->def()));
+					progress = true;
+				}
+			}
+		}
+		if (!hoisted.size()) return 0;
+
+		u32 label, pos;
+		if (!preheader(fn, blocks, loop, label, pos)) return 0;
+		vector<Insn*> result;
+		vector<u32> at;
+		for (u32 i = 0; i <= insns.size(); i ++) {
+			if (i == pos) for (Insn* insn : hoisted) result.push(insn);
+			at.push(result.size());
+			if (i < insns.size() && moved.find(insns[i]) == moved.end()) result.push(insns[i]);
+		}
+		fn.set_insns(result);
+		renumber(fn, blocks, at);
+		return hoisted.size();
+	}
+
+	static u32 licm(Function& fn) {
+		if (fn.insns().size() == 0) return 0;
+		Loops loops(fn);
+		u32 hoisted = 0;
+		Loop loop;
+		for (i64 i = i64(loops.headers.size()) - 1; i >= 0; i --) // inner loops first
+			if (find_loop(loops.blocks, loops.headers[i], loop)) hoisted += hoist(fn, loops, loop);
+		return hoisted;
+	}
+
+	// A basic induction variable: a phi in the loop header, stepped by a
+	// constant once per iteration.
+	struct Induction {
+		Location var, next; // the phi, and its value for the next iteration
+		u32 increment; // the add or subtract computing next
+		i64 step;
+	};
+
+	// A multiply of an induction variable by a constant.
+	struct Product {
+		u32 insn, induction;
+		bool of_next;
+		i64 factor;
+	};
+
+	static void find_inductions(Function& fn, Loops& loops, Loop& loop, 
+		vector<Induction>& inductions, vector<Product>& products) {
+		inductions.clear(), products.clear();
+		vector<Insn*>& insns = fn.insns();
+		const Blocks& blocks = loops.blocks;
+		if (loop.latches.size() != 1) return;
+		u32 h = loop.header, latch = loop.latches[0];
+		if (insns[blocks.starts[latch]]->kind() != INSN_LABEL) return;
+		u32 latch_label = ((Label*)insns[blocks.starts[latch]])->label();
+
+		const Locals& locals = loops.locals;
+		const vector<u32>& defs = loops.defs;
+		map<u32, u32> def_at, block_of; // of locals defined within the loop
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			if (!loop.body.contains(b)) continue;
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				i64 id = locals.id(insns[i]->def());
+				if (id >= 0) def_at.put(id, i), block_of.put(id, b);
+			}
+		}
+
+		vector<Location*> operands;
+		for (u32 i = blocks.starts[h] + 1; i < blocks.end(h) && insns[i]->kind() == INSN_PHI; i ++) {
+			PhiInsn* phi = (PhiInsn*)insns[i];
+			if (phi->size() != 2) continue;
+			u32 k = phi->pred(0) == latch_label ? 0 : 1;
+			Location next = phi->arg(k), var = phi->loc();
+			i64 id = locals.id(&next), var_id = locals.id(&var);
+			if (phi->pred(k) != latch_label || id < 0 || defs[id] != 1 || var_id < 0 || defs[var_id] != 1) continue;
+			auto it = def_at.find(id);
+			if (it == def_at.end() || !blocks.dominates(block_of[id], latch)) continue;
+			u32 d = it->second;
+
+			InsnKind kind = insns[d]->kind();
+			operands.clear();
+			insns[d]->uses(operands);
+			if (kind != INSN_ADD && kind != INSN_SUB) continue;
+			if (kind == INSN_ADD && operands[0]->type == SSA_IMMEDIATE) 
+				operands.push(operands[0]), operands[0] = operands[1], operands[1] = operands[2];
+			if (!same_local(*operands[0], var) || operands[1]->type != SSA_IMMEDIATE) continue;
+			i64 step = operands[1]->immediate;
+			inductions.push({ var, next, d, kind == INSN_ADD ? step : i64(-u64(step)) });
+		}
+		if (!inductions.size()) return;
+
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			if (!loop.body.contains(b)) continue;
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				if (insns[i]->kind() != INSN_MUL || locals.id(insns[i]->def()) < 0) continue;
+				operands.clear();
+				insns[i]->uses(operands);
+				if (operands[0]->type == SSA_IMMEDIATE) 
+					operands.push(operands[0]), operands[0] = operands[1], operands[1] = operands[2];
+				if (operands[1]->type != SSA_IMMEDIATE) continue;
+				for (u32 k = 0; k < inductions.size(); k ++) {
+					bool of_var = same_local(*operands[0], inductions[k].var);
+					bool of_next = same_local(*operands[0], inductions[k].next);
+					i64 step = i64(u64(inductions[k].step) * u64(operands[1]->immediate));
+					if ((of_var || of_next) && fits_i32(step)) 
+						products.push({ i, k, of_next, operands[1]->immediate });
+				}
+			}
+		}
+	}
+
+	// Gives a new insn its result, without leaving it in the function.
+	static Location detached(Function& fn, Insn* insn) {
+		Location result = fn.add(insn);
+		fn.insns().pop();
+		return result;
+	}
+
+	// Strength-reduces multiplies of induction variables by constants: each
+	// becomes a new induction variable, stepped by the product of the step
+	// and the constant, so iterations add instead of multiplying.
+	static u32 reduce_inductions(Function& fn, Loops& loops, Loop& loop) {
+		Blocks& blocks = loops.blocks;
+		vector<Induction> inductions;
+		vector<Product> products;
+		find_inductions(fn, loops, loop, inductions, products);
+		u32 label, pos;
+		if (!products.size() || !preheader(fn, blocks, loop, label, pos)) return 0;
+		find_inductions(fn, loops, loop, inductions, products); // the preheader moved things
+		vector<Insn*>& insns = fn.insns();
+		u32 latch_label = ((Label*)insns[blocks.starts[loop.latches[0]]])->label();
+
+		struct Reduced {
+			u32 induction;
+			i64 factor;
+			Location var, next;
+		};
+		vector<Reduced> reduced;
+		vector<Insn*> preheader_insns, phis;
+		map<u32, vector<Insn*>> after; // new increments, after the old ones
+		for (const Product& p : products) {
+			const Induction& iv = inductions[p.induction];
+			u32 r = 0;
+			while (r < reduced.size() && (reduced[r].induction != p.induction || reduced[r].factor != p.factor)) r ++;
+			if (r == reduced.size()) {
+				PhiInsn* phi = nullptr;
+				for (u32 i = blocks.starts[loop.header] + 1; insns[i]->kind() == INSN_PHI; i ++)
+					if (same_local(insns[i]->loc(), iv.var)) phi = (PhiInsn*)insns[i];
+				Location init = phi->arg(phi->pred(0) == latch_label ? 1 : 0), start;
+				if (init.type == SSA_IMMEDIATE) 
+					start = ssa_immediate(i64(u64(init.immediate) * u64(p.factor)));
+				else {
+					Insn* mul = new MulInsn(init, ssa_immediate(p.factor));
+					start = detached(fn, mul);
+					preheader_insns.push(mul);
+				}
+				Location var = fn.create_local(ssa_type(iv.var));
+				Insn* add = new AddInsn(var, ssa_immediate(i64(u64(iv.step) * u64(p.factor))));
+				detached(fn, add);
+				PhiInsn* reduced_phi = new PhiInsn(var);
+				reduced_phi->add(label, start);
+				reduced_phi->add(latch_label, add->loc());
+				phis.push(reduced_phi);
+				after[iv.increment].push(add);
+				reduced.push({ p.induction, p.factor, var, add->loc() });
+			}
+			fn.replace(p.insn, new LoadInsn(p.of_next ? reduced[r].next : reduced[r].var));
+		}
+
+		vector<Insn*> result, added;
+		vector<u32> at;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			if (i == pos) for (Insn* insn : preheader_insns) result.push(insn), added.push(insn);
+			at.push(result.size());
+			result.push(insns[i]);
+			if (i == blocks.starts[loop.header]) for (Insn* insn : phis) result.push(insn), added.push(insn);
+			auto it = after.find(i);
+			if (it != after.end()) for (Insn* insn : it->second) result.push(insn), added.push(insn);
+		}
+		fn.set_insns(result);
+		renumber(fn, blocks, at);
+		loops.define(fn, added);
+		return products.size();
+	}
+
+	static u32 induction_variables(Function& fn) {
+		if (fn.insns().size() == 0) return 0;
+		Loops loops(fn);
+		u32 reduced = 0;
+		Loop loop;
+		for (u32 label : loops.headers)
+			if (find_loop(loops.blocks, label, loop)) reduced += reduce_inductions(fn, loops, loop);
+		return reduced;
+	}
+
+	// Leaves SSA form, replacing each phi with copies on the edges into its
+	// block. An edge from a conditional branch to the phi's block is split,
+	// so its copies run only when the branch is taken.
+	static u32 out_of_ssa(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		Blocks blocks;
+		ssa_find_blocks(insns, blocks);
+		u32 n = insns.size(), copies = 0;
+		vector<vector<Insn*>> before, after;
+		vector<bool> remove;
+		for (u32 i = 0; i < n; i ++) before.push(vector<Insn*>()), after.push(vector<Insn*>()), remove.push(false);
+		vector<Insn*> appended;
+		vector<Location> dests, srcs;
+		for (u32 s = 0; s < blocks.size(); s ++) {
+			u32 first = blocks.starts[s], last;
+			if (insns[first]->kind() != INSN_LABEL) continue;
+			for (last = ++ first; last < blocks.end(s) && insns[last]->kind() == INSN_PHI; last ++) 
+				remove[last] = true;
+			if (first == last) continue;
+
+			u32 label = ((Label*)insns[first - 1])->label();
+			for (u32 p : blocks.preds[s]) {
+				Insn* start = insns[blocks.starts[p]];
+				if (start->kind() != INSN_LABEL) continue; // phis have no values from it
+				dests.clear(), srcs.clear();
+				for (u32 i = first; i < last; i ++) {
+					PhiInsn* phi = (PhiInsn*)insns[i];
+					for (u32 k = 0; k < phi->size(); k ++)
+						if (phi->pred(k) == ((Label*)start)->label()) dests.push(phi->loc()), srcs.push(phi->arg(k));
+				}
+				if (dests.size() == 0) continue;
+				copies += dests.size();
+
+				u32 end = blocks.end(p) - 1;
+				InsnKind kind = insns[end]->kind();
+				if (kind == INSN_GOTO) {
+					sequentialize(fn, dests, srcs, before[end]);
+					continue;
+				}
+				bool jumps = ssa_is_conditional(kind) && blocks.labels[((BranchInsn*)insns[end])->label()] == s;
+				if (p + 1 == s) { // falls through
+					vector<Location> dests_copy = dests, srcs_copy = srcs;
+					sequentialize(fn, dests_copy, srcs_copy, after[end]);
+				}
+				if (jumps) {
+					u32 split = ssa_next_label();
+					((BranchInsn*)insns[end])->retarget(split);
+					appended.push(new Label(split));
+					sequentialize(fn, dests, srcs, appended);
+					appended.push(new GotoInsn(label));
+				}
+			}
+		}
+
+		vector<Insn*> result;
+		for (u32 i = 0; i < n; i ++) {
+			for (Insn* insn : before[i]) result.push(insn);
+			if (remove[i]) delete insns[i];
+			else result.push(insns[i]);
+			for (Insn* insn : after[i]) result.push(insn);
+		}
+		if (appended.size()) {
+			if (result.back()->kind() != INSN_GOTO) {
+				u32 end = ssa_next_label();
+				result.push(new GotoInsn(end));
+				appended.push(new Label(end));
+			}
+			for (Insn* insn : appended) result.push(insn);
+		}
+		fn.set_insns(result);
+		return copies;
+	}
+
+	static Location push_insn(Function& fn, vector<Insn*>& out, Insn* insn) {
+		out.push(insn);
+		return detached(fn, insn);
+	}
+
+	static Location byte_at(Function& fn, vector<Insn*>& out, Location s, Location i) {
+		Indirect ind(s, 0);
+		ind.index = i;
+		return push_insn(fn, out, new LoadPtrInsn(ind, INT, x64::BYTE));
+	}
+
+	static void increment(Function& fn, vector<Insn*>& out, Location var) {
+		out.push(new StoreInsn(var, push_insn(fn, out, new AddInsn(var, ssa_immediate(1))), true));
+	}
+
+	// s[i], as one zero-extending byte load.
+	static Location expand_char_at(Function& fn, vector<Insn*>& out, const Location* args) {
+		return byte_at(fn, out, args[0], args[1]);
+	}
+
+	static const u32 UNROLL = 4;
+
+	// Counts up to the terminating nul, testing UNROLL bytes per trip
+	// around the loop.
+	static Location expand_strlen(Function& fn, vector<Insn*>& out, const Location* args) {
+		Location n = fn.create_local(INT);
+		u32 loop = ssa_next_label(), done = ssa_next_label();
+		out.push(new StoreInsn(n, ssa_immediate(0), true));
+		out.push(new Label(loop));
+		for (u32 k = 0; k < UNROLL; k ++) {
+			out.push(new IfZeroInsn(done, byte_at(fn, out, args[0], n)));
+			increment(fn, out, n);
+		}
+		out.push(new GotoInsn(loop));
+		out.push(new Label(done));
+		return n;
+	}
+
+	// Walks the tail pointers (the second word of each cell) until the empty
+	// list, UNROLL cells per trip around the loop.
+	static Location expand_listlen(Function& fn, vector<Insn*>& out, const Location* args) {
+		Location n = fn.create_local(INT), p = fn.create_local(ssa_type(args[0]));
+		u32 loop = ssa_next_label(), done = ssa_next_label();
+		out.push(new StoreInsn(n, ssa_immediate(0), true));
+		out.push(new StoreInsn(p, args[0], true));
+		out.push(new Label(loop));
+		for (u32 k = 0; k < UNROLL; k ++) {
+			out.push(new IfZeroInsn(done, p));
+			increment(fn, out, n);
+			out.push(new StoreInsn(p, push_insn(fn, out, new LoadPtrInsn(p, ssa_type(args[0]), 8)), true));
+		}
+		out.push(new GotoInsn(loop));
+		out.push(new Label(done));
+		return n;
+	}
+
+	// Natives simple enough to expand inline at each call, instead of
+	// paying for the call and the argument registers it clobbers.
+	static const struct { 
+		const char* name; 
+		u32 args; 
+		Location (*expand)(Function&, vector<Insn*>&, const Location*); 
+	} INTRINSICS[] = {
+		{ "_char_at", 2, expand_char_at },
+		{ "_strlen", 1, expand_strlen },
+		{ "_listlen", 1, expand_listlen }
+	};
+
+	// Expands calls to intrinsics into inline code. This runs after leaving
+	// SSA form, so calls of them have already been hoisted out of loops or
+	// reused by the passes before it, and the loops it makes can count in
+	// place.
+	static u32 expand_intrinsics(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		vector<Insn*> result;
+		vector<Location*> operands;
+		u32 expanded = 0;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			result.push(insns[i]);
+			if (insns[i]->kind() != INSN_CALL) continue;
+			operands.clear();
+			insns[i]->uses(operands);
+			if (operands[0]->type != SSA_LABEL) continue;
+			for (const auto& intrinsic : INTRINSICS) {
+				if (operands[0]->label_index != ssa_find_label(intrinsic.name)) continue;
+				if (i < intrinsic.args) break;
+				Location args[2];
+				bool matches = true;
+				for (u32 k = 0; k < intrinsic.args && matches; k ++) {
+					Insn* arg = insns[i - intrinsic.args + k];
+					if (arg->kind() != INSN_STORE_ARGUMENT || ((StoreArgumentInsn*)arg)->index() != k) {
+						matches = false;
+						break;
+					}
+					operands.clear();
+					arg->uses(operands);
+					args[k] = *operands[0];
+					if (args[k].type != SSA_LOCAL && args[k].type != SSA_IMMEDIATE) matches = false;
+				}
+				if (!matches || args[0].type != SSA_LOCAL) break;
+
+				Location dest = insns[i]->loc();
+				for (u32 k = 0; k <= intrinsic.args; k ++) delete result.back(), result.pop();
+				result.push(new StoreInsn(dest, intrinsic.expand(fn, result, args), true));
+				expanded ++;
+				break;
+			}
+		}
+		fn.set_insns(result);
+		return expanded;
+	}
+
+	// Merges the locals on either side of a copy when they're never live at
+	// the same time, then deletes the copies this turns into no-ops.
+	static u32 coalesce(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		if (insns.size() == 0) return 0;
+		Locals locals(fn);
+		Blocks blocks;
+		ssa_find_blocks(insns, blocks);
+		u32 k = locals.count, n = blocks.size();
+
+		vector<Location*> operands;
+		auto copied = [&](Insn* insn) -> i64 {
+			if (insn->kind() != INSN_LOAD && insn->kind() != INSN_STORE) return -1;
+			operands.clear();
+			insn->uses(operands);
+			return locals.id(operands[0]);
+		};
+
+		vector<bitset> uses, defs, live_in, live_out;
+		for (u32 b = 0; b < n; b ++) {
+			uses.push(bitset(k)), defs.push(bitset(k));
+			live_in.push(bitset(k)), live_out.push(bitset(k));
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				operands.clear();
+				insns[i]->uses(operands);
+				for (Location* loc : operands) {
+					i64 id = locals.id(loc);
+					if (id >= 0 && !defs[b].contains(id)) uses[b].insert(id);
+				}
+				i64 id = locals.id(insns[i]->def());
+				if (id >= 0) defs[b].insert(id);
+			}
+		}
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (i64 b = i64(n) - 1; b >= 0; b --) {
+				for (u32 succ : blocks.succs[b]) live_out[b] |= live_in[succ];
+				bitset in = live_out[b];
+				in -= defs[b];
+				in |= uses[b];
+				if (in != live_in[b]) live_in[b] = in, changed = true;
+			}
+		}
+
+		// a def interferes with everything live past it, except the source
+		// of a copy, which holds the same value
+		vector<bitset> interferes;
+		for (u32 i = 0; i < k; i ++) interferes.push(bitset(k));
+		for (u32 b = 0; b < n; b ++) {
+			bitset live = live_out[b];
+			for (i64 i = i64(blocks.end(b)) - 1; i >= i64(blocks.starts[b]); i --) {
+				i64 id = locals.id(insns[i]->def()), src = copied(insns[i]);
+				if (id >= 0) {
+					live.each([&](u32 l) {
+						if (l != id && l != src) interferes[id].insert(l), interferes[l].insert(id);
+					});
+					live.erase(id);
+				}
+				operands.clear();
+				insns[i]->uses(operands);
+				for (Location* loc : operands) {
+					i64 used = locals.id(loc);
+					if (used >= 0) live.insert(used);
+				}
+			}
+		}
+
+		// union-find, keeping interference up to date for each representative
+		vector<u32> parent;
+		for (u32 i = 0; i < k; i ++) parent.push(i);
+		auto find = [&](u32 i) -> u32 {
+			while (parent[i] != i) i = parent[i] = parent[parent[i]];
+			return i;
+		};
+		bool merged = false;
+		for (Insn* insn : insns) {
+			i64 dest = locals.id(insn->def()), src = copied(insn);
+			if (dest < 0 || src < 0) continue;
+			u32 a = find(dest), b = find(src);
+			if (a == b || interferes[a].contains(b)) continue;
+			parent[b] = a, merged = true;
+			interferes[a] |= interferes[b];
+			interferes[b].each([&](u32 l) { interferes[l].insert(a); });
+		}
+		if (!merged) return 0;
+
+		vector<bool> remove;
+		u32 removed = 0;
+		for (Insn* insn : insns) {
+			operands.clear();
+			insn->uses(operands);
+			if (insn->def()) operands.push(insn->def());
+			for (Location* loc : operands) {
+				i64 id = locals.id(loc);
+				if (id >= 0) *loc = locals.locations[find(id)];
+			}
+			bool copy = insn->kind() == INSN_LOAD || insn->kind() == INSN_STORE;
+			remove.push(copy && same_local(*insn->def(), *operands[0]));
+			if (remove.back()) removed ++;
+		}
+		compact(fn, remove);
+		return removed;
+	}
+
+	// The insn defining the local at operand, if it is in the same block as
+	// insn i, defined nowhere else, used nowhere but i, and nothing between
+	// the two would change what it computes if it were moved down to i.
+	static i64 foldable_def(const vector<Insn*>& insns, const vector<bool>& remove, 
+		const Locals& locals, const vector<u32>& uses, const vector<u32>& defs, u32 i, Location* operand) {
+		i64 id = locals.id(operand);
+		if (id < 0 || uses[id] != 1 || defs[id] != 1) return -1;
+		i64 d = i - 1;
+		for (; d >= 0; d --) {
+			InsnKind kind = insns[d]->kind();
+			if (kind == INSN_LABEL || ssa_is_branch(kind)) return -1;
+			if (!remove[d] && locals.id(insns[d]->def()) == id) break;
+		}
+		if (d < 0) return -1;
+
+		vector<Location*> operands;
+		insns[d]->uses(operands);
+		bool load = insns[d]->kind() == INSN_LOAD_PTR;
+		for (u32 k = d + 1; k < i; k ++) {
+			if (remove[k]) continue;
+			InsnKind kind = insns[k]->kind();
+			if (load && (kind == INSN_STORE_PTR || kind == INSN_CALL)) return -1;
+			for (Location* loc : operands)
+				if (insns[k]->def() && same_local(*insns[k]->def(), *loc)) return -1;
+		}
+		return d;
+	}
+
+	static i64 scale_for(i64 factor) {
+		switch (factor) {
+			case 1: return x64::SCALE1;
+			case 2: return x64::SCALE2;
+			case 4: return x64::SCALE4;
+			case 8: return x64::SCALE8;
+			default: return -1;
+		}
+	}
+
+	// Folds insn, which computes the base of ind, into ind.
+	static bool fold_base(Insn* insn, Indirect& ind) {
+		vector<Location*> operands;
+		insn->uses(operands);
+		if (insn->kind() == INSN_LOAD_PTR) { // *(*(p + a) + b)
+			Indirect& inner = ((LoadPtrInsn*)insn)->src();
+			if (inner.index.type != SSA_NONE || ((LoadPtrInsn*)insn)->size() != x64::QWORD) return false;
+			vector<i32> chain = inner.chain;
+			chain.push(inner.disp);
+			for (i32 offset : ind.chain) chain.push(offset);
+			ind.base = inner.base, ind.chain = chain;
+			return true;
+		}
+		if (insn->kind() != INSN_ADD) return false;
+		Location l = *operands[0], r = *operands[1];
+		if (l.type == SSA_IMMEDIATE) l = *operands[1], r = *operands[0];
+		if (r.type == SSA_IMMEDIATE && fits_i32(ind.disp + r.immediate)) { // *(p + a)
+			ind.base = l, ind.disp += r.immediate;
+			return true;
+		}
+		if (r.type == SSA_LOCAL && l.type == SSA_LOCAL && ind.index.type == SSA_NONE) { // *(p + i)
+			ind.base = l, ind.index = r, ind.scale = x64::SCALE1;
+			return true;
+		}
+		return false;
+	}
+
+	// Folds insn, which computes the index of ind, into ind.
+	static bool fold_index(Insn* insn, Indirect& ind) {
+		vector<Location*> operands;
+		insn->uses(operands);
+		if (insn->kind() != INSN_MUL && insn->kind() != INSN_ADD) return false;
+		Location l = *operands[0], r = *operands[1];
+		if (l.type == SSA_IMMEDIATE) l = *operands[1], r = *operands[0];
+		if (l.type != SSA_LOCAL || r.type != SSA_IMMEDIATE || r.immediate < 0) return false;
+		if (insn->kind() == INSN_MUL) { // *(p + i * a)
+			i64 scale = r.immediate > 8 ? -1 : scale_for(r.immediate << ind.scale);
+			if (scale < 0) return false;
+			ind.index = l, ind.scale = x64::Scale(scale);
+			return true;
+		}
+		if (r.immediate > 0x7fffffffl || !fits_i32(ind.disp + (r.immediate << ind.scale))) return false;
+		ind.index = l, ind.disp += r.immediate << ind.scale; // *(p + (i + a) * s)
+		return true;
+	}
+
+	// Folds the pointer loads and arithmetic that compute the address of a
+	// pointer load or store into its memory operand, tiling each tree of 
+	// them with one [base + index * scale + disp] access. Chains of loads
+	// like the head of a tail are followed through a scratch register, 
+	// rather than storing each pointer along the way to its own local.
+	static u32 fold_addresses(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		Locals locals(fn);
+		vector<u32> uses, defs;
+		for (u32 i = 0; i < locals.count; i ++) uses.push(0), defs.push(0);
+		vector<Location*> operands;
+		for (Insn* insn : insns) {
+			operands.clear();
+			insn->uses(operands);
+			for (Location* loc : operands) {
+				i64 id = locals.id(loc);
+				if (id >= 0) uses[id] ++;
+			}
+			i64 id = locals.id(insn->def());
+			if (id >= 0) defs[id] ++;
+		}
+
+		vector<bool> remove;
+		for (u32 i = 0; i < insns.size(); i ++) remove.push(false);
+		u32 folded = 0;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			InsnKind kind = insns[i]->kind();
+			if (kind != INSN_LOAD_PTR && kind != INSN_STORE_PTR) continue;
+			Indirect& ind = kind == INSN_LOAD_PTR ? ((LoadPtrInsn*)insns[i])->src() 
+				: ((StorePtrInsn*)insns[i])->dest();
+
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				i64 d = foldable_def(insns, remove, locals, uses, defs, i, &ind.base);
+				if (d >= 0 && fold_base(insns[d], ind)) remove[d] = true, changed = true, folded ++;
+				d = foldable_def(insns, remove, locals, uses, defs, i, &ind.index);
+				if (d >= 0 && fold_index(insns[d], ind)) remove[d] = true, changed = true, folded ++;
+			}
+		}
+		compact(fn, remove);
+		return folded;
+	}
+
+	// Fuses a compare into the conditional branch or select right after it,
+	// when that is its only use, so the boolean is never materialized.
+	static u32 fuse_branches(Function& fn) {
+		vector<Insn*>& insns = fn.insns();
+		Locals locals(fn);
+		vector<u32> uses;
+		for (u32 i = 0; i < locals.count; i ++) uses.push(0);
+		vector<Location*> operands;
+		for (Insn* insn : insns) {
+			operands.clear();
+			insn->uses(operands);
+			for (Location* loc : operands) {
+				i64 id = locals.id(loc);
+				if (id >= 0) uses[id] ++;
+			}
+		}
+
+		vector<bool> remove;
+		for (u32 i = 0; i < insns.size(); i ++) remove.push(false);
+		u32 fused = 0;
+		for (u32 i = 0; i + 1 < insns.size(); i ++) {
+			InsnKind kind = insns[i]->kind(), next = insns[i + 1]->kind();
+			if (kind < INSN_EQUAL || kind > INSN_GREATER_EQUAL) continue;
+			i64 id = locals.id(insns[i]->def());
+			operands.clear();
+			insns[i + 1]->uses(operands);
+			if (id < 0 || uses[id] != 1 || operands.size() == 0 || locals.id(operands[0]) != id) continue;
+
+			if (next == INSN_SELECT) { // cond != 0 ? t : f  =>  left <kind> right ? t : f
+				SelectInsn* select = (SelectInsn*)insns[i + 1];
+				if (select->compare() != INSN_INEQUAL || operands[1]->type != SSA_IMMEDIATE
+					|| operands[1]->immediate != 0) continue;
+				Location if_true = *operands[2], if_false = *operands[3];
+				operands.clear();
+				insns[i]->uses(operands);
+				fn.replace(i + 1, new SelectInsn(kind, *operands[0], *operands[1], 
+					if_true, if_false, select->type()));
+				remove[i] = true, fused ++;
+				continue;
+			}
+			if (!is_test(next)) continue;
+
+			operands.clear();
+			insns[i]->uses(operands);
+			InsnKind compare = next == INSN_IF_ZERO ? ssa_negate(kind) : kind;
+			u32 label = ((BranchInsn*)insns[i + 1])->label();
+			fn.replace(i + 1, new IfCompareInsn(label, compare, *operands[0], *operands[1]));
+			remove[i] = true, fused ++;
+		}
+		compact(fn, remove);
+		return fused;
+	}
+
+	static u32 layout(Function& fn) {
+		return fn.layout();
+	}
+
+	enum Stage {
+		BEFORE, // once, before and while putting the function into SSA form
+		REPEAT, // until no pass changes anything
+		AFTER // once, after leaving SSA form
+	};
+
+	struct Pass {
+		const char* name;
+		u32 (*run)(Function&); // returns the number of changes made
+		Stage stage;
+		bool enabled;
+		u64 changes;
+	};
+
+	static Pass passes[] = {
+		{ "tail-calls", tail_calls, BEFORE, true, 0 },
+		{ "mem2reg", mem2reg, BEFORE, true, 0 },
+		{ "sccp", sccp, REPEAT, true, 0 },
+		{ "copy-prop", copy_propagation, REPEAT, true, 0 },
+		{ "dce", dce, REPEAT, true, 0 },
+		{ "licm", licm, REPEAT, true, 0 },
+		{ "ivs", induction_variables, REPEAT, true, 0 },
+		{ "intrinsics", expand_intrinsics, AFTER, true, 0 },
+		{ "coalesce", coalesce, AFTER, true, 0 },
+		{ "fold-addresses", fold_addresses, AFTER, true, 0 },
+		{ "fuse-branches", fuse_branches, AFTER, true, 0 },
+		{ "layout", layout, AFTER, true, 0 }
+	};
+
+	static const u32 MAX_ROUNDS = 4;
+
+	bool opt_enabled(const string& pass, bool enabled) {
+		for (Pass& p : passes) {
+			if (pass == p.name) {
+				p.enabled = enabled;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void run_stage(Function& fn, Stage stage) {
+		for (Pass& p : passes)
+			if (p.enabled && p.stage == stage) p.changes += p.run(fn);
+	}
+
+	static void optimize_function(Function& fn) {
+		run_stage(fn, BEFORE);
+		for (u32 round = 0; round < MAX_ROUNDS; round ++) {
+			bool changed = false;
+			for (Pass& p : passes) {
+				u32 changes = p.enabled && p.stage == REPEAT ? p.run(fn) : 0;
+				if (changes) changed = true, p.changes += changes;
+			}
+			if (!changed) break;
+		}
+		out_of_ssa(fn); // not optional, since phis can't be emitted
+		run_stage(fn, AFTER);
+		for (Function* f : fn.functions()) optimize_function(*f);
+	}
+
+	void optimize(Function& fn) {
+		escaping = set<u32>();
+		find_escaping(fn);
+		optimize_function(fn);
+	}
+
+	void print_opt_stats(stream& io) {
+		for (const Pass& p : passes) {
+			write(io, p.name, ": ");
+			if (p.enabled) writeln(io, p.changes, " changes");
+			else writeln(io, "disabled");
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef BASIL_OPT_H
+#define BASIL_OPT_H
+
+#include "util/defs.h"
+#include "util/io.h"
+#include "ssa.h"
+
+namespace basil {
+	// Enables or disables the pass with the given name. Returns false if
+	// no such pass exists.
+	bool opt_enabled(const string& pass, bool enabled);
+
+	// Runs every enabled pass over fn and its nested functions, until
+	// none of them make further changes.
+	void optimize(Function& fn);
+
+	void print_opt_stats(stream& io);
+}
+
+#endif
@@ -0,0 +1,361 @@
+#include "peephole.h"
+
+namespace basil {
+	using namespace x64;
+
+	static bool _enabled = true;
+	static u64 _removed_insns = 0, _removed_bytes = 0;
+
+	void peephole_enabled(bool enabled) {
+		_enabled = enabled;
+	}
+
+	u64 peephole_removed_insns() {
+		return _removed_insns;
+	}
+
+	u64 peephole_removed_bytes() {
+		return _removed_bytes;
+	}
+
+	static jasmine::Object scratch;
+
+	// size of a single (non-branch) instruction once encoded
+	static i64 encoded_size(const Insn& insn) {
+		writeto(scratch);
+		scratch.code().clear();
+		encode(insn);
+		return scratch.code().size();
+	}
+
+	static void removed(const Insn& insn) {
+		_removed_insns ++;
+		_removed_bytes += encoded_size(insn);
+	}
+
+	static void replaced(const Insn& old, const Insn& insn) {
+		_removed_bytes += encoded_size(old) - encoded_size(insn);
+	}
+
+	static Insn make(Op op, const Arg& dest, const Arg& src, Size size = AUTO,
+		Condition condition = OVERFLOW) {
+		Insn insn;
+		insn.op = op;
+		insn.condition = condition;
+		insn.size = size;
+		insn.dest = dest;
+		insn.src = src;
+		return insn;
+	}
+
+	static bool is_register_offset(ArgType type) {
+		return (type >= REGISTER_OFFSET8 && type <= REGISTER_OFFSET64)
+			|| type == REGISTER_OFFSET_AUTO;
+	}
+
+	static bool is_reg64(const Arg& arg) {
+		return arg.type == REGISTER64;
+	}
+
+	static bool is_zero(const Arg& arg) {
+		return arg.type == IMM_AUTO && arg.data.imm64 == 0;
+	}
+
+	// a 64-bit frame slot, the only memory we track the contents of
+	static bool is_slot(const Arg& arg) {
+		return arg.type == REGISTER_OFFSET64 && arg.data.register_offset.base == RSP;
+	}
+
+	static bool same_operand(const Arg& a, const Arg& b) {
+		if (a.type != b.type) return false;
+		if (is_register(a.type)) return a.data.reg == b.data.reg;
+		if (a.type == IMM_AUTO || a.type == IMM64) return a.data.imm64 == b.data.imm64;
+		if (is_register_offset(a.type))
+			return a.data.register_offset.base == b.data.register_offset.base
+				&& a.data.register_offset.offset == b.data.register_offset.offset;
+		if (is_scaled_addressing(a.type))
+			return a.data.scaled_index.base == b.data.scaled_index.base
+				&& a.data.scaled_index.index == b.data.scaled_index.index
+				&& a.data.scaled_index.scale == b.data.scaled_index.scale
+				&& a.data.scaled_index.offset == b.data.scaled_index.offset;
+		return false;
+	}
+
+	// whether an operand reads r, either directly or to compute an address
+	static bool mentions(const Arg& arg, Register r) {
+		if (is_scaled_addressing(arg.type) && arg.data.scaled_index.index == r)
+			return true;
+		return base_register(arg) == r;
+	}
+
+	static bool is_caller_saved(Register r) {
+		return r == RAX || r == RCX || r == RDX || r == RSI || r == RDI
+			|| (r >= R8 && r <= R11);
+	}
+
+	static bool is_argument(Register r) {
+		return r == RDI || r == RSI || r == RDX || r == RCX || r == R8 || r == R9;
+	}
+
+	static bool reads_flags(Op op) {
+		return op == OP_JCC || op == OP_SETCC || op == OP_CMOV || op == OP_ADC 
+			|| op == OP_SBB || op == OP_RCL || op == OP_RCR;
+	}
+
+	// instructions that leave every status flag overwritten or undefined
+	static bool clobbers_flags(Op op) {
+		return op == OP_ADD || op == OP_OR || op == OP_AND || op == OP_SUB
+			|| op == OP_XOR || op == OP_CMP || op == OP_IMUL || op == OP_IMUL_WIDE
+			|| op == OP_IDIV || op == OP_CALL;
+	}
+
+	static bool reads(const Insn& insn, Register r) {
+		switch (insn.op) {
+			case OP_LABEL:
+			case OP_JCC:
+				return false;
+			case OP_CDQ:
+			case OP_CQO:
+				return r == RAX;
+			case OP_RET:
+				return r == RAX || r == RSP || !is_caller_saved(r);
+			case OP_SYSCALL:
+				return true;
+			case OP_CALL:
+				return is_argument(r) || r == RSP || mentions(insn.dest, r);
+			case OP_IMUL_WIDE:
+				return r == RAX || mentions(insn.dest, r);
+			case OP_IDIV:
+				return r == RAX || r == RDX || mentions(insn.dest, r);
+			case OP_PUSH:
+			case OP_POP:
+				return r == RSP || mentions(insn.dest, r);
+			case OP_JMP:
+				return mentions(insn.dest, r);
+			case OP_MOV:
+			case OP_MOVZX:
+			case OP_LEA:
+				return mentions(insn.src, r)
+					|| (is_memory(insn.dest.type) && mentions(insn.dest, r));
+			default: // setcc, cmov and read-modify-write ops read their destination
+				return mentions(insn.dest, r) || mentions(insn.src, r);
+		}
+	}
+
+	static bool writes(const Insn& insn, Register r) {
+		switch (insn.op) {
+			case OP_CDQ:
+			case OP_CQO:
+				return r == RDX;
+			case OP_IMUL_WIDE:
+			case OP_IDIV:
+				return r == RAX || r == RDX;
+			case OP_CALL:
+				return is_caller_saved(r);
+			case OP_CMP:
+			case OP_PUSH:
+			case OP_JMP:
+			case OP_JCC:
+			case OP_LABEL:
+			case OP_RET:
+				return false;
+			default:
+				return is_register(insn.dest.type) && insn.dest.data.reg == r;
+		}
+	}
+
+	// whether r's value after insns[i] can never be read. control flow is
+	// treated conservatively, since we don't know what a label's other
+	// predecessors left behind.
+	static bool dead_after(const vector<Insn>& insns, u32 i, Register r) {
+		for (u32 j = i + 1; j < insns.size(); j ++) {
+			if (reads(insns[j], r)) return false;
+			if (writes(insns[j], r)) return true;
+			if (insns[j].op == OP_RET) return true;
+			if (insns[j].op == OP_LABEL || insns[j].op == OP_JMP
+				|| insns[j].op == OP_JCC) return false;
+		}
+		return true;
+	}
+
+	// flags are never live across a label or jump, since every branch, 
+	// setcc or cmov we emit directly follows the compare that feeds it.
+	static bool flags_dead_after(const vector<Insn>& insns, u32 i) {
+		for (u32 j = i + 1; j < insns.size(); j ++) {
+			if (reads_flags(insns[j].op)) return false;
+			if (clobbers_flags(insns[j].op)) return true;
+			if (insns[j].op == OP_RET || insns[j].op == OP_LABEL 
+				|| insns[j].op == OP_JMP) return true;
+		}
+		return true;
+	}
+
+	struct CachedSlot {
+		Arg slot;
+		Register reg;
+	};
+
+	static void forget_register(vector<CachedSlot>& cache, Register r) {
+		for (i64 i = i64(cache.size()) - 1; i >= 0; i --) {
+			if (cache[i].reg == r || mentions(cache[i].slot, r)) {
+				cache[i] = cache.back();
+				cache.pop();
+			}
+		}
+	}
+
+	static void forget_slot(vector<CachedSlot>& cache, const Arg& slot) {
+		i64 offset = slot.data.register_offset.offset;
+		for (i64 i = i64(cache.size()) - 1; i >= 0; i --) {
+			i64 other = cache[i].slot.data.register_offset.offset;
+			if (other > offset - 8 && other < offset + 8) {
+				cache[i] = cache.back();
+				cache.pop();
+			}
+		}
+	}
+
+	static const CachedSlot* find_slot(const vector<CachedSlot>& cache, const Arg& slot) {
+		for (const CachedSlot& entry : cache)
+			if (same_operand(entry.slot, slot)) return &entry;
+		return nullptr;
+	}
+
+	// Tracks which registers hold copies of which frame slots within each
+	// straight-line run, and uses that to forward stores to later loads and
+	// to drop stores and moves that don't change anything.
+	static void forward_slots(vector<Insn>& insns) {
+		vector<Insn> out;
+		vector<CachedSlot> cache;
+		for (Insn insn : insns) {
+			Op op = insn.op;
+			if ((op == OP_MOV || op == OP_ADD || op == OP_SUB || op == OP_AND
+				|| op == OP_OR || op == OP_XOR || op == OP_CMP || op == OP_IMUL)
+				&& is_slot(insn.src) && (is_reg64(insn.dest) || op == OP_CMP)) {
+				const CachedSlot* entry = find_slot(cache, insn.src);
+				if (entry) {
+					Insn forwarded = insn;
+					forwarded.src = r64(entry->reg);
+					replaced(insn, forwarded);
+					insn = forwarded;
+				}
+			}
+
+			if (op == OP_CMP && is_slot(insn.dest)) {
+				const CachedSlot* entry = find_slot(cache, insn.dest);
+				if (entry) {
+					Insn forwarded = insn;
+					forwarded.dest = r64(entry->reg);
+					replaced(insn, forwarded);
+					insn = forwarded;
+				}
+			}
+
+			if (op == OP_MOV && is_reg64(insn.dest) && is_reg64(insn.src)
+				&& insn.dest.data.reg == insn.src.data.reg) {
+				removed(insn); // self-copy
+				continue;
+			}
+
+			if (op == OP_MOV && is_slot(insn.dest) && is_reg64(insn.src)) {
+				const CachedSlot* entry = find_slot(cache, insn.dest);
+				if (entry && entry->reg == insn.src.data.reg) {
+					removed(insn); // slot already holds this value
+					continue;
+				}
+			}
+
+			out.push(insn);
+
+			if (op == OP_LABEL || op == OP_JMP || op == OP_CALL || op == OP_RET
+				|| op == OP_SYSCALL) {
+				cache.clear();
+				continue;
+			}
+			for (u32 r = RAX; r <= R15; r ++)
+				if (writes(insn, (Register)r)) forget_register(cache, (Register)r);
+			if (op == OP_SETCC && is_register(insn.dest.type))
+				forget_register(cache, insn.dest.data.reg);
+			if (op == OP_PUSH || op == OP_POP) forget_register(cache, RSP);
+
+			if (is_memory(insn.dest.type) && op != OP_CMP && op != OP_JMP) {
+				if (is_slot(insn.dest)) forget_slot(cache, insn.dest);
+				else cache.clear(); // might alias anything
+			}
+			if (op == OP_PUSH) cache.clear();
+
+			if (op == OP_MOV && is_reg64(insn.dest) && is_slot(insn.src)
+				&& !mentions(insn.src, insn.dest.data.reg))
+				cache.push({ insn.src, insn.dest.data.reg });
+			else if (op == OP_MOV && is_slot(insn.dest) && is_reg64(insn.src))
+				cache.push({ insn.dest, insn.src.data.reg });
+		}
+		insns = out;
+	}
+
+	static bool can_compare(const Arg& a, const Arg& b) {
+		if (is_immediate(a.type) || is_label(a.type) || is_label(b.type)) return false;
+		if (is_memory(a.type) && is_memory(b.type)) return false;
+		return true;
+	}
+
+	// xor is shorter than mov reg, 0, but clobbers flags
+	static Insn zero(const Arg& reg) {
+		return make(OP_XOR, r32(reg.data.reg), r32(reg.data.reg));
+	}
+
+	// Merges the compare sequences emitted for comparison insns:
+	//   mov t, a; cmp t, b      =>  cmp a, b             (if t is dead)
+	//   cmp a, b; mov d, 0; setcc d  =>  xor d, d; cmp a, b; setcc d
+	// and replaces other zeroing moves with xor where flags are dead.
+	static void merge_compares(vector<Insn>& insns) {
+		vector<Insn> out;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			Insn insn = insns[i];
+			if (insn.op == OP_MOV && is_reg64(insn.dest) && i + 1 < insns.size()) {
+				const Insn& next = insns[i + 1];
+				Register t = insn.dest.data.reg;
+				if (next.op == OP_CMP && is_reg64(next.dest) && next.dest.data.reg == t
+					&& !mentions(next.src, t) && can_compare(insn.src, next.src)
+					&& dead_after(insns, i + 1, t)) {
+					Insn merged = make(OP_CMP, insn.src, next.src, next.size);
+					removed(insn);
+					replaced(next, merged);
+					insns[i + 1] = merged;
+					continue;
+				}
+			}
+
+			if (insn.op == OP_CMP && i + 2 < insns.size()
+				&& insns[i + 1].op == OP_MOV && is_reg64(insns[i + 1].dest)
+				&& is_zero(insns[i + 1].src) && insns[i + 2].op == OP_SETCC
+				&& is_register(insns[i + 2].dest.type)
+				&& insns[i + 2].dest.data.reg == insns[i + 1].dest.data.reg
+				&& !mentions(insn.dest, insns[i + 1].dest.data.reg)
+				&& !mentions(insn.src, insns[i + 1].dest.data.reg)) {
+				Insn cleared = zero(insns[i + 1].dest);
+				replaced(insns[i + 1], cleared);
+				out.push(cleared);
+				out.push(insn);
+				out.push(insns[i + 2]);
+				i += 2;
+				continue;
+			}
+
+			if (insn.op == OP_MOV && is_reg64(insn.dest) && is_zero(insn.src)
+				&& flags_dead_after(insns, i)) {
+				Insn cleared = zero(insn.dest);
+				replaced(insn, cleared);
+				insn = cleared;
+			}
+			out.push(insn);
+		}
+		insns = out;
+	}
+
+	void peephole(vector<Insn>& insns) {
+		if (!_enabled) return;
+		forward_slots(insns);
+		merge_compares(insns);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef BASIL_PEEPHOLE_H
+#define BASIL_PEEPHOLE_H
+
+#include "util/defs.h"
+#include "util/vec.h"
+#include "jasmine/x64.h"
+
+namespace basil {
+	void peephole_enabled(bool enabled);
+
+	// Rewrites a captured function body in place. Clobbers the current x64
+	// output object, so callers should call x64::writeto afterwards.
+	void peephole(vector<x64::Insn>& insns);
+
+	u64 peephole_removed_insns();
+	u64 peephole_removed_bytes();
+}
+
+#endif
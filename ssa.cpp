@@ -1,5 +1,9 @@
 #include "ssa.h"
 #include "util/hash.h"
+#include "util/bitset.h"
+#include "peephole.h"
+#include "native.h"
+#include "gc.h"
 
 namespace basil {
 	using namespace x64;
@@ -33,6 +37,14 @@ namespace basil {
 		return _loc;
 	}
 
+	void Insn::uses(vector<Location*>& locs) {
+		//
+	}
+
+	Location* Insn::def() {
+		return _loc.type == SSA_LOCAL ? &_loc : nullptr;
+	}
+
 	static u32 anonymous_locals = 0;
 	static u32 anonymous_labels = 0;
 	static vector<string> all_labels;
@@ -52,6 +64,10 @@ namespace basil {
 		return all_labels.size() - 1;
 	}
 
+	const string& ssa_label_name(u32 label) {
+		return all_labels[label];
+	}
+
 	u32 ssa_next_label() {
 		buffer b;
 		write(b, ".L", anonymous_labels ++);
@@ -107,7 +123,7 @@ namespace basil {
 	static map<string, u32> local_state_counts;
 
 	Location ssa_next_local_for(const Location& loc) {
-		const LocalInfo& info = all_locals[loc.local_index];
+		const LocalInfo info = all_locals[loc.local_index]; // pushing may move it
 		auto it = local_state_counts.find(info.name);
 		if (it == local_state_counts.end()) {
 			LocalInfo new_info = { info.name, 0, info.type, info.value };
@@ -143,6 +159,8 @@ namespace basil {
 				return INT; // close enough at this stage
 			case SSA_LABEL:
 				return INT; // ...close enough :p
+			case SSA_CELL:
+				return VOID; // only ever has its address taken
 		}
 	}
 
@@ -159,14 +177,16 @@ namespace basil {
 				return imm(loc.immediate);
 			case SSA_LABEL:
 				return label64(global((const char*)all_labels[loc.label_index].raw()));
+			case SSA_CELL:
+				return m64(RSP, 16 * loc.cell_index); // cells sit below the slots
 		}
 	}
 
 	Function::Function(u32 label):
-		_stack(0), _label(label) {}
+		_stack(0), _frame(0), _cells(0), _label(label) {}
 
 	Function::Function(const string& label):
-		_stack(0), _label(ssa_add_label(label)) {}
+		_stack(0), _frame(0), _cells(0), _label(ssa_add_label(label)) {}
 
 	Location Function::create_local(const Type* t) {
 		Location l = ssa_next_local(t);
@@ -211,39 +231,579 @@ namespace basil {
 		return next;
 	}
 
+	// Frames hold at most this many cells, so recursive functions that
+	// build them don't use up the stack much faster.
+	static const u32 MAX_CELLS = 32;
+	static u64 _stack_cells = 0;
+
+	u64 ssa_stack_cells() {
+		return _stack_cells;
+	}
+
+	Location Function::create_cell() {
+		if (_cells == MAX_CELLS) return ssa_none();
+		Location loc;
+		loc.type = SSA_CELL;
+		loc.cell_index = _cells ++;
+		_stack_cells ++;
+		return loc;
+	}
+
 	Location Function::add(Insn* insn) {
 		insn->setfunc(this);
 		_insns.push(insn);
 		return insn->loc();
 	}
 
+	void Function::replace(u32 i, Insn* insn) {
+		insn->setfunc(this);
+		insn->_loc = _insns[i]->_loc;
+		delete _insns[i];
+		_insns[i] = insn;
+	}
+
 	u32 Function::label() const {
 		return _label;
 	}
 
+	vector<Insn*>& Function::insns() {
+		return _insns;
+	}
+
+	void Function::set_insns(const vector<Insn*>& insns) {
+		_insns = insns;
+		for (Insn* insn : _insns) insn->setfunc(this), insn->loc();
+	}
+
+	i64 Function::frame() const {
+		return _frame;
+	}
+
+	const vector<Location>& Function::locals() const {
+		return _locals;
+	}
+
+	const vector<Function*>& Function::functions() const {
+		return _fns;
+	}
+
+	u32 Blocks::size() const {
+		return starts.size();
+	}
+
+	u32 Blocks::end(u32 block) const {
+		return block + 1 < starts.size() ? starts[block + 1] : num_insns;
+	}
+
+	bool Blocks::reachable(u32 block) const {
+		return block == 0 || idom[block] >= 0;
+	}
+
+	bool Blocks::dominates(u32 a, u32 b) const {
+		return reachable(a) && reachable(b) 
+			&& dom_pre[a] <= dom_pre[b] && dom_post[b] <= dom_post[a];
+	}
+
+	bool ssa_is_branch(InsnKind kind) {
+		return kind == INSN_GOTO || ssa_is_conditional(kind);
+	}
+
+	bool ssa_is_conditional(InsnKind kind) {
+		return kind == INSN_IF_ZERO || kind == INSN_IF_NONZERO || kind == INSN_IF_COMPARE;
+	}
+
+	InsnKind ssa_negate(InsnKind compare) {
+		switch (compare) {
+			case INSN_EQUAL: return INSN_INEQUAL;
+			case INSN_INEQUAL: return INSN_EQUAL;
+			case INSN_LESS: return INSN_GREATER_EQUAL;
+			case INSN_LESS_EQUAL: return INSN_GREATER;
+			case INSN_GREATER: return INSN_LESS_EQUAL;
+			case INSN_GREATER_EQUAL: return INSN_LESS;
+			default: return compare;
+		}
+	}
+
+	// Numbers the dominator tree in preorder and postorder, so a block
+	// dominates those numbered within its range.
+	static void number_dominators(Blocks& blocks) {
+		vector<u32> stack, next;
+		for (u32 b = 0; b < blocks.size(); b ++) next.push(0);
+		u32 counter = 0;
+		stack.push(0), blocks.dom_pre[0] = counter ++;
+		while (stack.size()) {
+			u32 b = stack.back();
+			if (next[b] < blocks.children[b].size()) {
+				u32 child = blocks.children[b][next[b] ++];
+				blocks.dom_pre[child] = counter ++;
+				stack.push(child);
+			}
+			else blocks.dom_post[b] = counter ++, stack.pop();
+		}
+	}
+
+	// iterative dominators, from Cooper, Harvey and Kennedy's "A Simple, 
+	// Fast Dominance Algorithm"
+	static void find_dominators(Blocks& blocks) {
+		u32 n = blocks.size();
+		vector<i64> rpo; // position of each block in blocks.order
+		vector<u32> postorder, stack, next;
+		vector<bool> visited;
+		for (u32 b = 0; b < n; b ++) {
+			rpo.push(-1), next.push(0), visited.push(false);
+			blocks.idom.push(-1), blocks.children.push({});
+			blocks.dom_pre.push(0), blocks.dom_post.push(0);
+		}
+
+		stack.push(0), visited[0] = true;
+		while (stack.size()) {
+			u32 b = stack.back();
+			if (next[b] < blocks.succs[b].size()) {
+				u32 succ = blocks.succs[b][next[b] ++];
+				if (!visited[succ]) visited[succ] = true, stack.push(succ);
+			}
+			else postorder.push(b), stack.pop();
+		}
+		for (i64 i = i64(postorder.size()) - 1; i >= 0; i --) {
+			rpo[postorder[i]] = blocks.order.size();
+			blocks.order.push(postorder[i]);
+		}
+
+		blocks.idom[0] = 0;
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (u32 i = 1; i < blocks.order.size(); i ++) {
+				u32 b = blocks.order[i];
+				i64 dom = -1;
+				for (u32 pred : blocks.preds[b]) {
+					if (blocks.idom[pred] < 0) continue;
+					if (dom < 0) { dom = pred; continue; }
+					i64 other = pred;
+					while (dom != other) {
+						while (rpo[dom] > rpo[other]) dom = blocks.idom[dom];
+						while (rpo[other] > rpo[dom]) other = blocks.idom[other];
+					}
+				}
+				if (dom != blocks.idom[b]) blocks.idom[b] = dom, changed = true;
+			}
+		}
+		blocks.idom[0] = -1;
+
+		for (u32 b : blocks.order) 
+			if (blocks.idom[b] >= 0) blocks.children[blocks.idom[b]].push(b);
+		number_dominators(blocks);
+	}
+
+	void ssa_find_blocks(const vector<Insn*>& insns, Blocks& blocks) {
+		blocks = Blocks();
+		blocks.num_insns = insns.size();
+		if (insns.size() == 0) return;
+		for (u32 i = 0; i < insns.size(); i ++) {
+			InsnKind kind = insns[i]->kind();
+			if (i == 0 || kind == INSN_LABEL || ssa_is_branch(insns[i - 1]->kind()))
+				blocks.starts.push(i);
+			if (kind == INSN_LABEL) 
+				blocks.labels.put(((Label*)insns[i])->label(), blocks.size() - 1);
+		}
+
+		for (u32 b = 0; b < blocks.size(); b ++) blocks.succs.push({}), blocks.preds.push({});
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			Insn* last = insns[blocks.end(b) - 1];
+			if (ssa_is_branch(last->kind()))
+				blocks.succs[b].push(blocks.labels[((BranchInsn*)last)->label()]);
+			if (last->kind() != INSN_GOTO && b + 1 < blocks.size()
+				&& (blocks.succs[b].size() == 0 || blocks.succs[b][0] != b + 1))
+				blocks.succs[b].push(b + 1);
+			for (u32 succ : blocks.succs[b]) blocks.preds[succ].push(b);
+		}
+		find_dominators(blocks);
+	}
+
+	template<typename T>
+	static void insert_at(vector<T>& v, u32 i, const T& t) {
+		v.push(t);
+		for (u32 j = v.size() - 1; j > i; j --) v[j] = v[j - 1];
+		v[i] = t;
+	}
+
+	void ssa_insert_preheader(Blocks& blocks, u32 h, u32 e, u32 label, bool jump) {
+		auto shift = [&](u32 b) -> u32 { return b < h ? b : b + 1; };
+		auto shift_all = [&](vector<u32>& v) { for (u32& b : v) b = shift(b); };
+		for (u32 b = 0; b < blocks.size(); b ++) {
+			shift_all(blocks.succs[b]), shift_all(blocks.preds[b]), shift_all(blocks.children[b]);
+			if (blocks.idom[b] >= 0) blocks.idom[b] = shift(blocks.idom[b]);
+		}
+		shift_all(blocks.order);
+		for (auto& entry : blocks.labels) entry.second = shift(entry.second);
+		u32 p = h, header = h + 1;
+		e = shift(e);
+
+		u32 start = blocks.starts[h] + (jump ? 1 : 0);
+		for (u32 b = h; b < blocks.size(); b ++) blocks.starts[b] += jump ? 2 : 1;
+		blocks.num_insns += jump ? 2 : 1;
+		insert_at(blocks.starts, p, start);
+		insert_at(blocks.succs, p, vector<u32>());
+		insert_at(blocks.preds, p, vector<u32>());
+		insert_at(blocks.children, p, vector<u32>());
+		insert_at(blocks.idom, p, i64(e));
+		insert_at(blocks.dom_pre, p, 0u);
+		insert_at(blocks.dom_post, p, 0u);
+		blocks.labels.put(label, p);
+
+		for (u32& succ : blocks.succs[e]) if (succ == header) succ = p;
+		for (u32& pred : blocks.preds[header]) if (pred == e) pred = p;
+		for (u32& child : blocks.children[e]) if (child == header) child = p;
+		blocks.succs[p].push(header), blocks.preds[p].push(e), blocks.children[p].push(header);
+		blocks.idom[header] = p;
+		for (u32 i = 0; i < blocks.order.size(); i ++) 
+			if (blocks.order[i] == header) { insert_at(blocks.order, i, p); break; }
+		number_dominators(blocks);
+	}
+
+	// Rotates loops so their bodies fall through from the top, and their
+	// exit tests sit at the bottom:
+	//     L: if not c goto E; body; goto L; E:
+	// becomes
+	//     goto L; B: body; L: if c goto B; E:
+	// leaving one taken branch per iteration. Branches are then fixed up 
+	// for the new block order, dropping any that jump to the next block.
+	u32 Function::layout() {
+		if (_insns.size() == 0) return 0;
+		Blocks blocks;
+		ssa_find_blocks(_insns, blocks);
+		u32 n = blocks.size(), changes = 0;
+		auto last = [&](u32 b) -> Insn* { return _insns[blocks.end(b) - 1]; };
+		auto target = [&](u32 b) -> u32 { return blocks.labels[((BranchInsn*)last(b))->label()]; };
+
+		vector<u32> order, position;
+		for (u32 b = 0; b < n; b ++) order.push(b), position.push(b);
+
+		// latches are visited in order, so inner loops rotate before outer ones
+		for (u32 l = 0; l + 1 < n; l ++) {
+			if (last(l)->kind() != INSN_GOTO) continue;
+			u32 h = target(l), c = h;
+			if (h >= l || !blocks.dominates(h, l)) continue;
+			while (c < l && !(ssa_is_conditional(last(c)->kind()) && target(c) == l + 1)) c ++;
+			if (c == l) continue;
+
+			u32 ph = position[h], pc = position[c], pl = position[l];
+			if (ph > pc || pc >= pl) continue;
+			vector<u32> rotated;
+			for (u32 p = pc + 1; p <= pl; p ++) rotated.push(order[p]);
+			for (u32 p = ph; p <= pc; p ++) rotated.push(order[p]);
+			for (u32 i = 0; i < rotated.size(); i ++) 
+				order[ph + i] = rotated[i], position[rotated[i]] = ph + i;
+			changes ++;
+		}
+
+		enum Fixup { KEEP, DROP, INVERT, JUMP };
+		vector<Fixup> fixups;
+		vector<u32> jumps; // where each block jumps to, once fixed up
+		vector<i64> labels; // label beginning each block, or -1
+		for (u32 b = 0; b < n; b ++) {
+			Insn* first = _insns[blocks.starts[b]];
+			fixups.push(KEEP), jumps.push(0);
+			labels.push(first->kind() == INSN_LABEL ? i64(((Label*)first)->label()) : -1);
+		}
+		auto label_of = [&](u32 b) -> u32 {
+			if (labels[b] < 0) labels[b] = ssa_next_label();
+			return labels[b];
+		};
+
+		// the last block never moves, so only it can fall off the end
+		for (u32 p = 0; p < n; p ++) {
+			u32 b = order[p];
+			i64 next = p + 1 < n ? i64(order[p + 1]) : -1;
+			InsnKind kind = last(b)->kind();
+			i64 fall = kind != INSN_GOTO && b + 1 < n ? i64(b + 1) : -1;
+			if (kind == INSN_GOTO && target(b) == next) fixups[b] = DROP, changes ++;
+			else if (fall < 0 || fall == next) continue;
+			else if (ssa_is_conditional(kind) && target(b) == next)
+				fixups[b] = INVERT, jumps[b] = label_of(fall), changes ++;
+			else fixups[b] = JUMP, jumps[b] = label_of(fall);
+		}
+
+		auto own = [&](Insn* insn) -> Insn* {
+			insn->setfunc(this);
+			insn->loc();
+			return insn;
+		};
+		vector<Insn*> insns;
+		vector<Location*> operands;
+		for (u32 b : order) {
+			if (labels[b] >= 0 && _insns[blocks.starts[b]]->kind() != INSN_LABEL)
+				insns.push(own(new Label(labels[b])));
+			for (u32 i = blocks.starts[b]; i + 1 < blocks.end(b); i ++) insns.push(_insns[i]);
+			Insn* term = last(b);
+			if (fixups[b] == DROP) delete term;
+			else if (fixups[b] == INVERT) {
+				operands.clear();
+				term->uses(operands);
+				if (term->kind() == INSN_IF_COMPARE) {
+					InsnKind compare = ssa_negate(((IfCompareInsn*)term)->compare());
+					insns.push(own(new IfCompareInsn(jumps[b], compare, *operands[0], *operands[1])));
+				}
+				else if (term->kind() == INSN_IF_ZERO) insns.push(own(new IfNonZeroInsn(jumps[b], *operands[0])));
+				else insns.push(own(new IfZeroInsn(jumps[b], *operands[0])));
+				delete term;
+			}
+			else {
+				insns.push(term);
+				if (fixups[b] == JUMP) insns.push(own(new GotoInsn(jumps[b])));
+			}
+		}
+		_insns = insns;
+		return changes;
+	}
+
+	static Allocator _allocator = LINEAR_ALLOCATOR;
+
+	void ssa_allocator(Allocator allocator) {
+		_allocator = allocator;
+	}
+
 	void Function::allocate() {
 		for (Function* fn : _fns) fn->allocate();
+		_stack = 16 * _cells;
+		_saved.clear();
+		_roots.clear();
+		if (_allocator == STACK_ALLOCATOR) allocate_stack();
+		else allocate_linear();
+	}
+
+	static bool may_collect(Insn* insn) {
+		return insn->kind() == INSN_CALL && ((CallInsn*)insn)->may_collect();
+	}
+
+	void Function::allocate_stack() {
+		vector<Location> pointers;
 		for (Location l : _locals) {
 			LocalInfo& info = all_locals[l.local_index];
-			info.value = x64::m64(RBP, -(_stack += 8)); // assumes everything is a word
+			info.value = x64::m64(RSP, (_stack += 8) - 8); // assumes everything is a word
+			if (gc_traced(info.type)) pointers.push(l);
+		}
+		for (Insn* insn : _insns)
+			if (may_collect(insn)) ((CallInsn*)insn)->set_live(pointers), _roots = pointers;
+	}
+
+	// RAX, RCX and RDX are scratch registers for insn emission, and the
+	// argument registers are written around calls, so neither are allocated.
+	// Heap pointers live across a call that may collect are kept in their
+	// stack slots, where the collector can find them.
+	static const x64::Register CALLEE_SAVED[] = { RBX, R12, R13, R14, R15 };
+	static const x64::Register CALLER_SAVED[] = { R10, R11 };
+
+	struct LiveInterval {
+		u32 start, end;
+		bool across_call, in_memory;
+		x64::Register reg;
+	};
+
+	// Positions are numbered in half-steps: insn i reads its operands at 2i
+	// and writes its result at 2i + 1, so a local may take the register of 
+	// another that dies in the same insn.
+	void Function::allocate_linear() {
+		u32 n = _insns.size(), k = _locals.size();
+		map<u32, u32> ids;
+		for (u32 i = 0; i < k; i ++) ids.put(_locals[i].local_index, i);
+		auto id_of = [&](const Location* loc) -> i64 {
+			if (!loc || loc->type != SSA_LOCAL) return -1;
+			auto it = ids.find(loc->local_index);
+			return it == ids.end() ? -1 : i64(it->second);
+		};
+
+		Blocks blocks;
+		ssa_find_blocks(_insns, blocks);
+		u32 nblocks = blocks.size();
+
+		// local use and def sets per block
+		vector<bitset> uses, defs, live_in, live_out;
+		vector<Location*> operands;
+		for (u32 b = 0; b < nblocks; b ++) {
+			uses.push(bitset(k)), defs.push(bitset(k));
+			live_in.push(bitset(k)), live_out.push(bitset(k));
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				operands.clear();
+				_insns[i]->uses(operands);
+				for (Location* loc : operands) {
+					i64 id = id_of(loc);
+					if (id >= 0 && !defs[b].contains(id)) uses[b].insert(id);
+				}
+				i64 id = id_of(_insns[i]->def());
+				if (id >= 0) defs[b].insert(id);
+			}
+		}
+
+		// backwards liveness to a fixed point
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (i64 b = i64(nblocks) - 1; b >= 0; b --) {
+				for (u32 succ : blocks.succs[b]) live_out[b] |= live_in[succ];
+				bitset in = live_out[b];
+				in -= defs[b];
+				in |= uses[b];
+				if (in != live_in[b]) live_in[b] = in, changed = true;
+			}
+		}
+
+		// build one interval per local, covering every point it's live
+		vector<LiveInterval> intervals;
+		for (u32 i = 0; i < k; i ++) intervals.push({ 0xffffffff, 0, false, false, INVALID });
+		auto extend = [&](u32 id, u32 pos) {
+			if (pos < intervals[id].start) intervals[id].start = pos;
+			if (pos > intervals[id].end) intervals[id].end = pos;
+		};
+		vector<u32> calls_before, safepoints_before; // calls, and those that may collect, before each insn
+		for (u32 b = 0; b < nblocks; b ++) {
+			live_in[b].each([&](u32 id) { extend(id, 2 * blocks.starts[b]); });
+			live_out[b].each([&](u32 id) { extend(id, 2 * blocks.end(b) - 1); });
+			for (u32 i = blocks.starts[b]; i < blocks.end(b); i ++) {
+				operands.clear();
+				_insns[i]->uses(operands);
+				for (Location* loc : operands) {
+					i64 id = id_of(loc);
+					if (id >= 0) extend(id, 2 * i);
+				}
+				i64 id = id_of(_insns[i]->def());
+				if (id >= 0) extend(id, 2 * i + 1);
+				calls_before.push(i == 0 ? 0 : calls_before[i - 1] 
+					+ (_insns[i - 1]->kind() == INSN_CALL ? 1 : 0));
+				safepoints_before.push(i == 0 ? 0 : safepoints_before[i - 1]
+					+ (may_collect(_insns[i - 1]) ? 1 : 0));
+			}
 		}
+		calls_before.push(n == 0 ? 0 : calls_before[n - 1]
+			+ (_insns[n - 1]->kind() == INSN_CALL ? 1 : 0));
+		safepoints_before.push(n == 0 ? 0 : safepoints_before[n - 1]
+			+ (may_collect(_insns[n - 1]) ? 1 : 0));
+
+		// sort live intervals by start position
+		vector<u32> counts, order;
+		for (u32 i = 0; i < 2 * n + 2; i ++) counts.push(0);
+		for (u32 i = 0; i < k; i ++) {
+			LiveInterval& it = intervals[i];
+			if (it.start > it.end) continue; // never referenced
+			u32 first = (it.start + 1) / 2, last = it.end / 2; // insns strictly inside
+			it.across_call = last > first && calls_before[last] > calls_before[first];
+			it.in_memory = last > first && safepoints_before[last] > safepoints_before[first]
+				&& gc_traced(all_locals[_locals[i].local_index].type);
+			counts[it.start] ++;
+		}
+		for (u32 i = 1; i < counts.size(); i ++) counts[i] += counts[i - 1];
+		for (u32 i = 0; i < counts.back(); i ++) order.push(0);
+		for (i64 i = i64(k) - 1; i >= 0; i --) 
+			if (intervals[i].start <= intervals[i].end) 
+				order[-- counts[intervals[i].start]] = i;
+
+		// linear scan, spilling whichever interval ends furthest away
+		vector<u32> active;
+		bool taken[16] = { false };
+		for (u32 id : order) {
+			LiveInterval& cur = intervals[id];
+			for (i64 i = i64(active.size()) - 1; i >= 0; i --) {
+				if (intervals[active[i]].end < cur.start) {
+					taken[intervals[active[i]].reg] = false;
+					active[i] = active.back();
+					active.pop();
+				}
+			}
+			if (cur.in_memory) continue;
+
+			if (!cur.across_call) for (x64::Register r : CALLER_SAVED)
+				if (!taken[r]) { cur.reg = r; break; }
+			if (cur.reg == INVALID) for (x64::Register r : CALLEE_SAVED)
+				if (!taken[r]) { cur.reg = r; break; }
+
+			if (cur.reg == INVALID) {
+				i64 victim = -1;
+				for (u32 i = 0; i < active.size(); i ++) {
+					const LiveInterval& other = intervals[active[i]];
+					if (cur.across_call && (other.reg == R10 || other.reg == R11)) continue;
+					if (victim < 0 || other.end > intervals[active[victim]].end) victim = i;
+				}
+				if (victim < 0 || intervals[active[victim]].end <= cur.end) continue;
+				cur.reg = intervals[active[victim]].reg;
+				intervals[active[victim]].reg = INVALID;
+				active[victim] = active.back();
+				active.pop();
+			}
+			taken[cur.reg] = true;
+			active.push(id);
+		}
+
+		// assign homes, placing spill slots at the bottom of the frame
+		bool used[16] = { false };
+		for (const LiveInterval& it : intervals) if (it.reg != INVALID) used[it.reg] = true;
+		for (x64::Register r : CALLEE_SAVED) if (used[r]) _saved.push(r);
+		for (u32 i = 0; i < k; i ++) {
+			LocalInfo& info = all_locals[_locals[i].local_index];
+			const LiveInterval& it = intervals[i];
+			if (it.reg != INVALID) info.value = x64::r64(it.reg);
+			else if (it.start <= it.end) info.value = x64::m64(RSP, (_stack += 8) - 8);
+			else info.value = x64::r64(RAX); // never referenced, so needs no slot
+		}
+
+		// record which of those slots hold heap pointers across each call
+		vector<Location> live;
+		vector<bool> root;
+		for (u32 j = 0; j < k; j ++) root.push(false);
+		for (u32 i = 0; i < n; i ++) {
+			if (!may_collect(_insns[i])) continue;
+			live.clear();
+			for (u32 j = 0; j < k; j ++)
+				if (intervals[j].in_memory && intervals[j].start < 2 * i + 1 && intervals[j].end > 2 * i + 1)
+					live.push(_locals[j]), root[j] = true;
+			((CallInsn*)_insns[i])->set_live(live);
+		}
+		for (u32 j = 0; j < k; j ++) if (root[j]) _roots.push(_locals[j]);
+	}
+
+	static bool _relax_jumps = true;
+	static u64 _short_jumps = 0;
+
+	void ssa_relax_jumps(bool relax) {
+		_relax_jumps = relax;
+	}
+
+	u64 ssa_short_jumps() {
+		return _short_jumps;
 	}
 
 	void Function::emit(Object& obj) {
 		for (Function* fn : _fns) fn->emit(obj);
 
-		writeto(obj);
+		vector<x64::Insn> code;
+		capture(&code);
 		Symbol label = global((const char*)all_labels[_label].raw());
 		x64::label(label);
-		push(r64(RBP));
-		mov(r64(RBP), r64(RSP));
-		sub(r64(RSP), imm(_stack));
+
+		// there's no frame pointer: nothing in the body moves rsp, so slots 
+		// are addressed from it directly. leaves with nothing spilled or
+		// saved get no prologue at all.
+		bool leaf = true;
+		for (Insn* i : _insns) if (i->kind() == INSN_CALL) leaf = false;
+		for (x64::Register r : _saved) push(r64(r));
+		i64 frame = _stack;
+		if (!leaf && (frame + 8 * _saved.size() + 8) % 16) frame += 8; // keep calls 16-byte aligned
+		if (frame) sub(r64(RSP), imm(frame));
+		_frame = frame + 8 * _saved.size();
+
+		// a slot may be read by the collector before anything is stored to
+		// it, on some paths, so it mustn't hold what was left on the stack
+		for (const Location& l : _roots) mov(x64_arg(l), imm(0));
 
 		for (Insn* i : _insns) i->emit();
 
-		mov(r64(RSP), r64(RBP));
-		pop(r64(RBP));
+		if (frame) x64::add(r64(RSP), imm(frame));
+		for (i64 i = i64(_saved.size()) - 1; i >= 0; i --) pop(r64(_saved[i]));
 		ret();
+
+		capture(nullptr);
+		peephole(code);
+		writeto(obj);
+		_short_jumps += assemble(code, _relax_jumps);
 	}
 
 	void Function::format(stream& io) const {
@@ -259,10 +819,31 @@ namespace basil {
 	LoadInsn::LoadInsn(Location src):
 		_src(src) {}
 
+	InsnKind LoadInsn::kind() const {
+		return INSN_LOAD;
+	}
+
+	void LoadInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
+	static bool same_register(const x64::Arg& a, const x64::Arg& b) {
+		return is_register(a.type) && is_register(b.type) && a.data.reg == b.data.reg;
+	}
+
+	// moves src into dst, going through rax only when both are in memory
+	void emit_move(const x64::Arg& dst, const x64::Arg& src) {
+		if (same_register(dst, src)) return;
+		if (is_memory(dst.type) && (is_memory(src.type) || (is_immediate(src.type)
+			&& (src.data.imm64 < -0x80000000l || src.data.imm64 > 0x7fffffffl)))) {
+			mov(r64(RAX), src);
+			mov(dst, r64(RAX));
+		}
+		else mov(dst, src);
+	}
+
 	void LoadInsn::emit() {
-		auto temp = r64(RAX), src = x64_arg(_src), dst = x64_arg(_loc);
-		mov(temp, src);
-		mov(dst, temp);
+		emit_move(x64_arg(_loc), x64_arg(_src));
 	}
 
 	void LoadInsn::format(stream& io) const {
@@ -277,50 +858,134 @@ namespace basil {
 	StoreInsn::StoreInsn(Location dest, Location src, bool init):
 		_dest(dest), _src(src), _init(init) {}
 
+	InsnKind StoreInsn::kind() const {
+		return INSN_STORE;
+	}
+
+	void StoreInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
+	Location* StoreInsn::def() {
+		return &_dest;
+	}
+
 	void StoreInsn::emit() {
-		auto temp = r64(RAX), src = x64_arg(_src), dst = x64_arg(_dest);
-		mov(temp, src);
-		mov(dst, temp);
+		emit_move(x64_arg(_dest), x64_arg(_src));
 	}
 
 	void StoreInsn::format(stream& io) const {
-		write(io, _loc, " = ", _src);
+		write(io, _dest, " = ", _src);
+	}
+
+	Indirect::Indirect(Location base_in, i32 disp_in):
+		base(base_in), index(ssa_none()), scale(SCALE1), disp(disp_in) {}
+
+	// Follows an indirect operand's chain of pointers and returns its final
+	// memory operand, putting the base in rax and the index in rcx if they 
+	// aren't already in registers.
+	static x64::Arg emit_indirect(const Indirect& ind, x64::Size size = QWORD) {
+		auto base = x64_arg(ind.base);
+		for (i32 offset : ind.chain) {
+			if (!is_register(base.type)) mov(r64(RAX), base);
+			mov(r64(RAX), m64(is_register(base.type) ? base.data.reg : RAX, offset));
+			base = r64(RAX);
+		}
+		if (!is_register(base.type)) mov(r64(RAX), base), base = r64(RAX);
+		i64 disp = ind.disp;
+		if (ind.index.type == SSA_IMMEDIATE) disp += ind.index.immediate << ind.scale;
+		if (ind.index.type == SSA_NONE || ind.index.type == SSA_IMMEDIATE) 
+			return size == BYTE ? m8(base.data.reg, disp) : m64(base.data.reg, disp);
+
+		auto index = x64_arg(ind.index);
+		if (!is_register(index.type)) mov(r64(RCX), index), index = r64(RCX);
+		return size == BYTE ? m8(base.data.reg, index.data.reg, ind.scale, disp)
+			: m64(base.data.reg, index.data.reg, ind.scale, disp);
+	}
+
+	static void format_indirect(stream& io, const Indirect& ind) {
+		if (ind.chain.size() == 0 && ind.index.type == SSA_NONE && ind.disp == 0)
+			return write(io, "*", ind.base);
+		for (u32 i = 0; i <= ind.chain.size(); i ++) write(io, "*(");
+		write(io, ind.base);
+		for (i32 offset : ind.chain) write(io, " + ", offset, ")");
+		if (ind.index.type != SSA_NONE) write(io, " + ", ind.index, " * ", 1 << ind.scale);
+		write(io, " + ", ind.disp, ")");
 	}
 
 	LoadPtrInsn::LoadPtrInsn(Location src, const Type* t, i32 offset):
-		_src(src), _type(t), _offset(offset) {}
+		_src(src, offset), _type(t), _size(QWORD) {}
+
+	LoadPtrInsn::LoadPtrInsn(const Indirect& src, const Type* t, x64::Size size):
+		_src(src), _type(t), _size(size) {}
 
 	Location LoadPtrInsn::lazy_loc() {
 		return _func->create_local(_type);
 	}
 
+	Indirect& LoadPtrInsn::src() {
+		return _src;
+	}
+
+	x64::Size LoadPtrInsn::size() const {
+		return _size;
+	}
+
+	InsnKind LoadPtrInsn::kind() const {
+		return INSN_LOAD_PTR;
+	}
+
+	void LoadPtrInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src.base);
+		if (_src.index.type != SSA_NONE) locs.push(&_src.index);
+	}
+
 	void LoadPtrInsn::emit() {
-		auto src = x64_arg(_src), dst = x64_arg(_loc);
-		mov(r64(RAX), src);
-		mov(r64(RDX), m64(RAX, _offset));
-		mov(dst, r64(RDX));
+		auto src = emit_indirect(_src, _size), dst = x64_arg(_loc);
+		auto temp = is_register(dst.type) ? dst : r64(RDX);
+		if (_size == BYTE) movzx(temp, src);
+		else mov(temp, src);
+		if (!is_register(dst.type)) mov(dst, temp);
 	}
 
 	void LoadPtrInsn::format(stream& io) const {
-		write(io, _loc, " = *", _src);
+		write(io, _loc, _size == BYTE ? " = byte " : " = ");
+		format_indirect(io, _src);
 	}
 
 	StorePtrInsn::StorePtrInsn(Location dest, Location src, i32 offset):
-		_dest(dest), _src(src), _offset(offset) {}
+		_dest(dest, offset), _src(src) {}
+
+	StorePtrInsn::StorePtrInsn(const Indirect& dest, Location src):
+		_dest(dest), _src(src) {}
 
 	Location StorePtrInsn::lazy_loc() {
 		return ssa_none();
 	}
 
+	Indirect& StorePtrInsn::dest() {
+		return _dest;
+	}
+
+	InsnKind StorePtrInsn::kind() const {
+		return INSN_STORE_PTR;
+	}
+
+	void StorePtrInsn::uses(vector<Location*>& locs) {
+		locs.push(&_dest.base);
+		locs.push(&_src);
+		if (_dest.index.type != SSA_NONE) locs.push(&_dest.index);
+	}
+
 	void StorePtrInsn::emit() {
-		auto src = x64_arg(_src), dst = x64_arg(_dest);
-		mov(r64(RAX), dst);
-		mov(r64(RDX), src);
-		mov(m64(RAX, _offset), r64(RDX));
+		auto src = x64_arg(_src);
+		if (!is_register(src.type)) mov(r64(RDX), src), src = r64(RDX);
+		mov(emit_indirect(_dest), src);
 	}
 
 	void StorePtrInsn::format(stream& io) const {
-		write(io, "*", _dest, " = ", _src);
+		format_indirect(io, _dest);
+		write(io, " = ", _src);
 	}
 
 	AddressInsn::AddressInsn(Location src, const Type* t):
@@ -330,6 +995,14 @@ namespace basil {
 		return _func->create_local(_type);
 	}
 
+	InsnKind AddressInsn::kind() const {
+		return INSN_ADDRESS;
+	}
+
+	void AddressInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
 	void AddressInsn::emit() {
 		auto src = x64_arg(_src), dst = x64_arg(_loc);
 		lea(r64(RAX), src);
@@ -344,17 +1017,29 @@ namespace basil {
 		Location dst, Location left, Location right, x64::Size size = AUTO) {
 		auto temp = r64(RAX), _left = x64_arg(left), 
 			_right = x64_arg(right), _dst = x64_arg(dst);
+		if (is_register(_dst.type) && !same_register(_dst, _right)) {
+			emit_move(_dst, _left); // operate on the destination register in place
+			op(_dst, _right, size);
+			return;
+		}
 		mov(temp, _left);
 		op(temp, _right, size);
 		mov(_dst, temp);
 	}
 
+	static void emit_cmp(Location left, Location right) {
+		auto _left = x64_arg(left), _right = x64_arg(right);
+		if (is_register(_left.type)) cmp(_left, _right);
+		else {
+			mov(r64(RAX), _left);
+			cmp(r64(RAX), _right);
+		}
+	}
+
 	void emit_compare(x64::Condition cond, Location dst, 
 		Location left, Location right) {
-		auto temp = r64(RAX), _left = x64_arg(left), 
-			_right = x64_arg(right), _dst = x64_arg(dst);
-		mov(temp, _left);
-		cmp(temp, _right);
+		auto temp = r64(RAX), _dst = x64_arg(dst);
+		emit_cmp(left, right);
 		if (is_memory(_dst.type)) {
 			mov(temp, imm(0));
 			setcc(temp, cond);
@@ -370,6 +1055,11 @@ namespace basil {
 		Location right):
 		_name(name), _left(left), _right(right) {}
 
+	void BinaryInsn::uses(vector<Location*>& locs) {
+		locs.push(&_left);
+		locs.push(&_right);
+	}
+
 	void BinaryInsn::format(stream& io) const {
 		write(io, _loc, " = ", _left, " ", _name, " ", _right);
 	}
@@ -385,6 +1075,10 @@ namespace basil {
 	AddInsn::AddInsn(Location left, Location right):
 		BinaryMathInsn("+", left, right) {}
 
+	InsnKind AddInsn::kind() const {
+		return INSN_ADD;
+	}
+
 	void AddInsn::emit() {
 		emit_binary(add, _loc, _left, _right);
 	}
@@ -392,18 +1086,89 @@ namespace basil {
 	SubInsn::SubInsn(Location left, Location right):
 		BinaryMathInsn("-", left, right) {}
 
+	InsnKind SubInsn::kind() const {
+		return INSN_SUB;
+	}
+
 	void SubInsn::emit() {
 		emit_binary(sub, _loc, _left, _right);
 	}
 
+	static bool is_power_of_two(i64 i) {
+		return i > 0 && (i & (i - 1)) == 0;
+	}
+
+	// Finds m and s such that n / d is the high half of n * m, shifted
+	// right by s and rounded toward zero (Hacker's Delight, 10-4). d > 1.
+	static void magic(i64 d, i64& m, u32& s) {
+		const u64 two63 = 1ul << 63;
+		u64 ad = d, anc = two63 - 1 - two63 % ad;
+		u64 q1 = two63 / anc, r1 = two63 - q1 * anc, q2 = two63 / ad, r2 = two63 - q2 * ad, delta;
+		u32 p = 63;
+		do {
+			p ++;
+			q1 *= 2, r1 *= 2;
+			if (r1 >= anc) q1 ++, r1 -= anc;
+			q2 *= 2, r2 *= 2;
+			if (r2 >= ad) q2 ++, r2 -= ad;
+			delta = ad - r2;
+		} while (q1 < delta || (q1 == delta && r1 == 0));
+		m = q2 + 1, s = p - 64;
+	}
+
+	// Leaves RCX / d in RAX, for a constant d > 1, without idiv.
+	static void emit_quotient(i64 d) {
+		auto rax = r64(RAX), rcx = r64(RCX), rdx = r64(RDX);
+		if (is_power_of_two(d)) {
+			u32 k = __builtin_ctzl(d);
+			mov(rax, rcx); // bias negative dividends by d - 1 to round toward zero
+			if (k > 1) sar(rax, imm(63));
+			shr(rax, imm(64 - k));
+			add(rax, rcx);
+			sar(rax, imm(k));
+			return;
+		}
+		i64 m;
+		u32 s;
+		magic(d, m, s);
+		mov(rax, imm(m));
+		imul(rcx);
+		if (m < 0) add(rdx, rcx);
+		if (s) sar(rdx, imm(s));
+		mov(rax, rcx); // add one for negative dividends
+		shr(rax, imm(63));
+		add(rax, rdx);
+	}
+
 	MulInsn::MulInsn(Location left, Location right):
 		BinaryMathInsn("*", left, right) {}
 
+	InsnKind MulInsn::kind() const {
+		return INSN_MUL;
+	}
+
 	void MulInsn::emit() {
-		auto temp = r64(RAX), left = x64_arg(_left), 
-			right = x64_arg(_right), dst = x64_arg(_loc);
+		Location l = _left, r = _right;
+		if (l.type == SSA_IMMEDIATE && r.type != SSA_IMMEDIATE) l = _right, r = _left;
+		auto temp = r64(RAX), left = x64_arg(l), 
+			right = x64_arg(r), dst = x64_arg(_loc);
+		if (r.type == SSA_IMMEDIATE && is_power_of_two(r.immediate)) {
+			u32 k = __builtin_ctzl(r.immediate);
+			auto target = is_register(dst.type) ? dst : temp;
+			emit_move(target, left);
+			if (k) shl(target, imm(k));
+			emit_move(dst, target);
+			return;
+		}
+		if (r.type == SSA_IMMEDIATE && (r.immediate == 3 || r.immediate == 5 || r.immediate == 9)) {
+			Scale scale = r.immediate == 3 ? SCALE2 : r.immediate == 5 ? SCALE4 : SCALE8;
+			mov(temp, left);
+			lea(temp, m64(RAX, RAX, scale, 0));
+			mov(dst, temp);
+			return;
+		}
 		mov(temp, left);
-		if (_right.type == SSA_IMMEDIATE) {
+		if (r.type == SSA_IMMEDIATE) {
 			mov(r64(RDX), right);
 			imul(temp, r64(RDX));
 		}
@@ -414,12 +1179,23 @@ namespace basil {
 	DivInsn::DivInsn(Location left, Location right):
 		BinaryMathInsn("/", left, right) {}
 
+	InsnKind DivInsn::kind() const {
+		return INSN_DIV;
+	}
+
 	void DivInsn::emit() {
 		auto rax = r64(RAX), rcx = r64(RCX), rdx = r64(RDX), 
 			left = x64_arg(_left), right = x64_arg(_right), 
 			dst = x64_arg(_loc);
+		if (_right.type == SSA_IMMEDIATE && _right.immediate == 1) return emit_move(dst, left);
+		if (_right.type == SSA_IMMEDIATE && _right.immediate > 1) {
+			mov(rcx, left);
+			emit_quotient(_right.immediate);
+			mov(dst, rax);
+			return;
+		}
 		mov(rax, left);
-		cdq();
+		cqo();
 		if (_right.type == SSA_IMMEDIATE) {
 			mov(rcx, right);
 			idiv(rcx);
@@ -431,12 +1207,29 @@ namespace basil {
 	RemInsn::RemInsn(Location left, Location right):
 		BinaryMathInsn("%", left, right) {}
 
+	InsnKind RemInsn::kind() const {
+		return INSN_REM;
+	}
+
 	void RemInsn::emit() {
 		auto rax = r64(RAX), rcx = r64(RCX), rdx = r64(RDX), 
 			left = x64_arg(_left), right = x64_arg(_right), 
 			dst = x64_arg(_loc);
+		if (_right.type == SSA_IMMEDIATE && _right.immediate == 1) return emit_move(dst, imm(0));
+		if (_right.type == SSA_IMMEDIATE && _right.immediate > 1) {
+			mov(rcx, left); // n - n / d * d
+			emit_quotient(_right.immediate);
+			if (is_power_of_two(_right.immediate)) shl(rax, imm(__builtin_ctzl(_right.immediate)));
+			else {
+				mov(rdx, right);
+				imul(rax, rdx);
+			}
+			sub(rcx, rax);
+			mov(dst, rcx);
+			return;
+		}
 		mov(rax, left);
-		cdq();
+		cqo();
 		if (_right.type == SSA_IMMEDIATE) {
 			mov(rcx, right);
 			idiv(rcx);
@@ -456,6 +1249,10 @@ namespace basil {
 	AndInsn::AndInsn(Location left, Location right):
 		BinaryLogicInsn("and", left, right) {}
 
+	InsnKind AndInsn::kind() const {
+		return INSN_AND;
+	}
+
 	void AndInsn::emit() {
 		emit_binary(and_, _loc, _left, _right);
 	}
@@ -463,6 +1260,10 @@ namespace basil {
 	OrInsn::OrInsn(Location left, Location right):
 		BinaryLogicInsn("or", left, right) {}
 
+	InsnKind OrInsn::kind() const {
+		return INSN_OR;
+	}
+
 	void OrInsn::emit() {
 		emit_binary(or_, _loc, _left, _right);
 	}
@@ -470,6 +1271,10 @@ namespace basil {
 	XorInsn::XorInsn(Location left, Location right):
 		BinaryLogicInsn("xor", left, right) {}
 
+	InsnKind XorInsn::kind() const {
+		return INSN_XOR;
+	}
+
 	void XorInsn::emit() {
 		emit_binary(xor_, _loc, _left, _right);
 	}
@@ -481,6 +1286,14 @@ namespace basil {
 		return _func->create_local(BOOL);
 	}
 
+	InsnKind NotInsn::kind() const {
+		return INSN_NOT;
+	}
+
+	void NotInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
 	void NotInsn::emit() {
 		auto src = x64_arg(_src), dst = x64_arg(_loc);
 		xor_(r64(RDX), r64(RDX));
@@ -505,6 +1318,10 @@ namespace basil {
 	EqualInsn::EqualInsn(Location left, Location right):
 		BinaryEqualityInsn("==", left, right) {}
 
+	InsnKind EqualInsn::kind() const {
+		return INSN_EQUAL;
+	}
+
 	void EqualInsn::emit() {
 		emit_compare(EQUAL, _loc, _left, _right);
 	}
@@ -512,6 +1329,10 @@ namespace basil {
 	InequalInsn::InequalInsn(Location left, Location right):
 		BinaryEqualityInsn("!=", left, right) {}
 
+	InsnKind InequalInsn::kind() const {
+		return INSN_INEQUAL;
+	}
+
 	void InequalInsn::emit() {
 		emit_compare(NOT_EQUAL, _loc, _left, _right);
 	}
@@ -527,6 +1348,10 @@ namespace basil {
 	LessInsn::LessInsn(Location left, Location right):
 		BinaryRelationInsn("<", left, right) {}
 
+	InsnKind LessInsn::kind() const {
+		return INSN_LESS;
+	}
+
 	void LessInsn::emit() {
 		emit_compare(LESS, _loc, _left, _right);
 	}
@@ -534,6 +1359,10 @@ namespace basil {
 	LessEqualInsn::LessEqualInsn(Location left, Location right):
 		BinaryRelationInsn("<=", left, right) {}
 
+	InsnKind LessEqualInsn::kind() const {
+		return INSN_LESS_EQUAL;
+	}
+
 	void LessEqualInsn::emit() {
 		emit_compare(LESS_OR_EQUAL, _loc, _left, _right);
 	}
@@ -541,6 +1370,10 @@ namespace basil {
 	GreaterInsn::GreaterInsn(Location left, Location right):
 		BinaryRelationInsn(">", left, right) {}
 
+	InsnKind GreaterInsn::kind() const {
+		return INSN_GREATER;
+	}
+
 	void GreaterInsn::emit() {
 		emit_compare(GREATER, _loc, _left, _right);
 	}
@@ -548,6 +1381,10 @@ namespace basil {
 	GreaterEqualInsn::GreaterEqualInsn(Location left, Location right):
 		BinaryRelationInsn(">=", left, right) {}
 
+	InsnKind GreaterEqualInsn::kind() const {
+		return INSN_GREATER_EQUAL;
+	}
+
 	void GreaterEqualInsn::emit() {
 		emit_compare(GREATER_OR_EQUAL, _loc, _left, _right);
 	}
@@ -559,9 +1396,17 @@ namespace basil {
 	RetInsn::RetInsn(Location src):
 		_src(src) {}
 
+	InsnKind RetInsn::kind() const {
+		return INSN_RET;
+	}
+
+	void RetInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
 	void RetInsn::emit() {
 		auto rax = r64(RAX), src = x64_arg(_src);
-		mov(rax, src);
+		emit_move(rax, src);
 	}
 
 	void RetInsn::format(stream& io) const {
@@ -575,10 +1420,18 @@ namespace basil {
 	LoadArgumentInsn::LoadArgumentInsn(u32 index, const Type* type):
 		_index(index), _type(type) {}
 
+	u32 LoadArgumentInsn::index() const {
+		return _index;
+	}
+
 	Location LoadArgumentInsn::lazy_loc() {
 		return _func->create_local(_type);
 	}
 
+	InsnKind LoadArgumentInsn::kind() const {
+		return INSN_LOAD_ARGUMENT;
+	}
+
 	void LoadArgumentInsn::emit() {
 		mov(x64_arg(_loc), r64(X64_ARG_REGISTERS[_index]));
 	}
@@ -590,12 +1443,24 @@ namespace basil {
 	StoreArgumentInsn::StoreArgumentInsn(Location src, u32 index, const Type* type):
 		_src(src), _index(index), _type(type) {}
 
+	u32 StoreArgumentInsn::index() const {
+		return _index;
+	}
+
 	Location StoreArgumentInsn::lazy_loc() {
 		return ssa_none();
 	}
 
+	InsnKind StoreArgumentInsn::kind() const {
+		return INSN_STORE_ARGUMENT;
+	}
+
+	void StoreArgumentInsn::uses(vector<Location*>& locs) {
+		locs.push(&_src);
+	}
+
 	void StoreArgumentInsn::emit() {
-		mov(r64(X64_ARG_REGISTERS[_index]), x64_arg(_src));
+		emit_move(r64(X64_ARG_REGISTERS[_index]), x64_arg(_src));
 	}
 
 	void StoreArgumentInsn::format(stream& io) const {
@@ -609,12 +1474,104 @@ namespace basil {
 		return _func->create_local(_ret);
 	}
 
+	InsnKind CallInsn::kind() const {
+		return INSN_CALL;
+	}
+
+	void CallInsn::uses(vector<Location*>& locs) {
+		locs.push(&_fn);
+	}
+
+	bool CallInsn::may_collect() const {
+		if (_fn.type != SSA_LABEL) return true;
+		const string& name = all_labels[_fn.label_index];
+		return !is_native(name) || native_allocates(name);
+	}
+
+	void CallInsn::set_live(const vector<Location>& live) {
+		_live = live;
+	}
+
+	struct PendingSafepoint {
+		Symbol ret;
+		Safepoint safepoint;
+	};
+
+	static vector<PendingSafepoint> pending_safepoints;
+
+	void CallInsn::safepoint() {
+		if (!may_collect()) return;
+		Safepoint safepoint;
+		safepoint.frame = _func->frame();
+		for (const Location& loc : _live) {
+			x64::Arg home = x64_arg(loc);
+			if (home.type == REGISTER_OFFSET64 && home.data.register_offset.base == RSP)
+				safepoint.roots.push({ home.data.register_offset.offset, ssa_type(loc)->concretify() });
+		}
+		bool cons = _fn.type == SSA_LABEL && all_labels[_fn.label_index] == "_cons";
+		safepoint.cons = cons ? _ret->concretify() : nullptr;
+		Symbol ret = symbol_for_label(ssa_next_label(), LOCAL_SYMBOL);
+		label(ret);
+		pending_safepoints.push({ ret, safepoint });
+	}
+
+	void ssa_resolve_safepoints(const Object& object) {
+		gc_clear_safepoints();
+		for (const PendingSafepoint& p : pending_safepoints) 
+			gc_add_safepoint(object.find(p.ret), p.safepoint);
+		pending_safepoints.clear();
+	}
+
+	static bool _inline_alloc = true;
+	static u64 _inline_allocs = 0;
+
+	void ssa_inline_alloc(bool enabled) {
+		_inline_alloc = enabled;
+	}
+
+	u64 ssa_inline_allocs() {
+		return _inline_allocs;
+	}
+
+	// Allocates a list cell by bumping the runtime's region pointer, and
+	// only calls _cons when the current chunk is full. The value and tail
+	// are already in the argument registers; the cell is left in rax.
+	static void emit_inline_cons(CallInsn& insn, Symbol cons) {
+		Symbol slow = symbol_for_label(ssa_next_label(), LOCAL_SYMBOL), 
+			done = symbol_for_label(ssa_next_label(), LOCAL_SYMBOL);
+		mov(r64(RAX), label64(global("_region")));
+		mov(r64(RDX), m64(RAX, 0));
+		lea(r64(RCX), m64(RDX, 16));
+		cmp(r64(RCX), m64(RAX, 8));
+		jcc(label64(slow), ABOVE);
+		mov(m64(RAX, 0), r64(RCX));
+		mov(m64(RDX, 0), r64(RDI));
+		mov(m64(RDX, 8), r64(RSI));
+		mov(r64(RAX), r64(RDX));
+		jmp(label64(done));
+		label(slow);
+		mov(r64(RAX), label64(cons));
+		call(r64(RAX));
+		insn.safepoint();
+		label(done);
+		_inline_allocs ++;
+	}
+
 	void CallInsn::emit() {
-		if (_fn.type == SSA_LABEL)
-			call(label64(symbol_for_label(_fn.label_index, GLOBAL_SYMBOL)));
+		if (_fn.type == SSA_LABEL && _inline_alloc && all_labels[_fn.label_index] == "_cons")
+			emit_inline_cons(*this, symbol_for_label(_fn.label_index, GLOBAL_SYMBOL));
 		else {
-			mov(r64(RAX), x64_arg(_fn));
-			call(r64(RAX));
+			if (_fn.type == SSA_LABEL && is_native(all_labels[_fn.label_index])) {
+				mov(r64(RAX), label64(symbol_for_label(_fn.label_index, GLOBAL_SYMBOL)));
+				call(r64(RAX));
+			}
+			else if (_fn.type == SSA_LABEL)
+				call(label64(symbol_for_label(_fn.label_index, GLOBAL_SYMBOL)));
+			else {
+				mov(r64(RAX), x64_arg(_fn));
+				call(r64(RAX));
+			}
+			safepoint();
 		}
 		mov(x64_arg(_loc), r64(RAX));
 	}
@@ -630,21 +1587,44 @@ namespace basil {
 		return ssa_none();
 	}
 
+	InsnKind Label::kind() const {
+		return INSN_LABEL;
+	}
+
+	u32 Label::label() const {
+		return _label;
+	}
+
 	void Label::emit() {
-		label(symbol_for_label(_label, LOCAL_SYMBOL));
+		x64::label(symbol_for_label(_label, LOCAL_SYMBOL));
 	}
 
 	void Label::format(stream& io) const {
 		write(io, "\b\b\b\b", all_labels[_label], ":");
 	}
 
-	GotoInsn::GotoInsn(u32 label):
+	BranchInsn::BranchInsn(u32 label):
 		_label(label) {}
 
-	Location GotoInsn::lazy_loc() {
+	Location BranchInsn::lazy_loc() {
 		return ssa_none();
 	}
 
+	u32 BranchInsn::label() const {
+		return _label;
+	}
+
+	void BranchInsn::retarget(u32 label) {
+		_label = label;
+	}
+
+	GotoInsn::GotoInsn(u32 label):
+		BranchInsn(label) {}
+
+	InsnKind GotoInsn::kind() const {
+		return INSN_GOTO;
+	}
+
 	void GotoInsn::emit() {
 		jmp(label64(symbol_for_label(_label, LOCAL_SYMBOL)));
 	}
@@ -653,26 +1633,199 @@ namespace basil {
 		write(io, "goto ", all_labels[_label]);
 	}
 
-	IfZeroInsn::IfZeroInsn(u32 label, Location cond):
-		_label(label), _cond(cond) {}
+	ConditionalBranchInsn::ConditionalBranchInsn(u32 label, Location cond):
+		BranchInsn(label), _cond(cond) {}
 
-	Location IfZeroInsn::lazy_loc() {
-		return ssa_none();
+	void ConditionalBranchInsn::uses(vector<Location*>& locs) {
+		locs.push(&_cond);
 	}
 
-	void IfZeroInsn::emit() {
-		auto cond = x64_arg(_cond);
-		if (is_immediate(cond.type)) {
-			mov(r64(RAX), cond);
+	static void emit_branch(Location cond, u32 label, x64::Condition condition) {
+		auto _cond = x64_arg(cond);
+		if (is_immediate(_cond.type)) {
+			mov(r64(RAX), _cond);
 			cmp(r64(RAX), imm(0));
 		}
-		else cmp(x64_arg(_cond), imm(0));
-		jcc(label64(symbol_for_label(_label, LOCAL_SYMBOL)), EQUAL);
+		else cmp(_cond, imm(0));
+		jcc(label64(symbol_for_label(label, LOCAL_SYMBOL)), condition);
+	}
+
+	IfZeroInsn::IfZeroInsn(u32 label, Location cond):
+		ConditionalBranchInsn(label, cond) {}
+
+	InsnKind IfZeroInsn::kind() const {
+		return INSN_IF_ZERO;
+	}
+
+	void IfZeroInsn::emit() {
+		emit_branch(_cond, _label, EQUAL);
 	}
 
 	void IfZeroInsn::format(stream& io) const {
 		write(io, "if not ", _cond, " goto ", all_labels[_label]);
 	}
+
+	IfNonZeroInsn::IfNonZeroInsn(u32 label, Location cond):
+		ConditionalBranchInsn(label, cond) {}
+
+	InsnKind IfNonZeroInsn::kind() const {
+		return INSN_IF_NONZERO;
+	}
+
+	void IfNonZeroInsn::emit() {
+		emit_branch(_cond, _label, NOT_EQUAL);
+	}
+
+	void IfNonZeroInsn::format(stream& io) const {
+		write(io, "if ", _cond, " goto ", all_labels[_label]);
+	}
+
+	IfCompareInsn::IfCompareInsn(u32 label, InsnKind compare, Location left, Location right):
+		BranchInsn(label), _compare(compare), _left(left), _right(right) {}
+
+	InsnKind IfCompareInsn::compare() const {
+		return _compare;
+	}
+
+	static x64::Condition condition_for(InsnKind compare) {
+		switch (compare) {
+			case INSN_EQUAL: return EQUAL;
+			case INSN_INEQUAL: return NOT_EQUAL;
+			case INSN_LESS: return LESS;
+			case INSN_LESS_EQUAL: return LESS_OR_EQUAL;
+			case INSN_GREATER: return GREATER;
+			default: return GREATER_OR_EQUAL;
+		}
+	}
+
+	static const char* compare_name(InsnKind compare) {
+		switch (compare) {
+			case INSN_EQUAL: return "==";
+			case INSN_INEQUAL: return "!=";
+			case INSN_LESS: return "<";
+			case INSN_LESS_EQUAL: return "<=";
+			case INSN_GREATER: return ">";
+			default: return ">=";
+		}
+	}
+
+	void IfCompareInsn::emit() {
+		emit_cmp(_left, _right);
+		jcc(label64(symbol_for_label(_label, LOCAL_SYMBOL)), condition_for(_compare));
+	}
+
+	InsnKind IfCompareInsn::kind() const {
+		return INSN_IF_COMPARE;
+	}
+
+	void IfCompareInsn::uses(vector<Location*>& locs) {
+		locs.push(&_left);
+		locs.push(&_right);
+	}
+
+	void IfCompareInsn::format(stream& io) const {
+		write(io, "if ", _left, " ", compare_name(_compare), " ", _right, 
+			" goto ", all_labels[_label]);
+	}
+
+	SelectInsn::SelectInsn(Location cond, Location if_true, Location if_false, 
+		const Type* type):
+		SelectInsn(INSN_INEQUAL, cond, ssa_immediate(0), if_true, if_false, type) {}
+
+	SelectInsn::SelectInsn(InsnKind compare, Location left, Location right, 
+		Location if_true, Location if_false, const Type* type):
+		_compare(compare), _left(left), _right(right), _if_true(if_true), 
+		_if_false(if_false), _type(type) {}
+
+	Location SelectInsn::lazy_loc() {
+		return _func->create_local(_type);
+	}
+
+	InsnKind SelectInsn::compare() const {
+		return _compare;
+	}
+
+	const Type* SelectInsn::type() const {
+		return _type;
+	}
+
+	void SelectInsn::emit() {
+		// cmov can't take an immediate, and needs a register to write to
+		auto dst = x64_arg(_loc), if_true = x64_arg(_if_true), temp = r64(RCX);
+		if (is_immediate(if_true.type)) {
+			mov(r64(RDX), if_true);
+			if_true = r64(RDX);
+		}
+		mov(temp, x64_arg(_if_false));
+		emit_cmp(_left, _right);
+		cmov(temp, if_true, condition_for(_compare));
+		mov(dst, temp);
+	}
+
+	InsnKind SelectInsn::kind() const {
+		return INSN_SELECT;
+	}
+
+	void SelectInsn::uses(vector<Location*>& locs) {
+		locs.push(&_left);
+		locs.push(&_right);
+		locs.push(&_if_true);
+		locs.push(&_if_false);
+	}
+
+	void SelectInsn::format(stream& io) const {
+		write(io, _loc, " = ", _left, " ", compare_name(_compare), " ", _right, 
+			" ? ", _if_true, " : ", _if_false);
+	}
+
+	PhiInsn::PhiInsn(Location dest):
+		_dest(dest) {}
+
+	Location PhiInsn::lazy_loc() {
+		return _dest;
+	}
+
+	void PhiInsn::add(u32 pred, Location arg) {
+		_preds.push(pred);
+		_args.push(arg);
+	}
+
+	void PhiInsn::retarget(u32 from, u32 to) {
+		for (u32& pred : _preds) if (pred == from) pred = to;
+	}
+
+	u32 PhiInsn::size() const {
+		return _args.size();
+	}
+
+	u32 PhiInsn::pred(u32 i) const {
+		return _preds[i];
+	}
+
+	const Location& PhiInsn::arg(u32 i) const {
+		return _args[i];
+	}
+
+	void PhiInsn::emit() {
+		//
+	}
+
+	InsnKind PhiInsn::kind() const {
+		return INSN_PHI;
+	}
+
+	void PhiInsn::uses(vector<Location*>& locs) {
+		for (Location& arg : _args) locs.push(&arg);
+	}
+
+	void PhiInsn::format(stream& io) const {
+		write(io, _loc, " = phi(");
+		for (u32 i = 0; i < _args.size(); i ++) {
+			if (i > 0) write(io, ", ");
+			write(io, all_labels[_preds[i]], ": ", _args[i]);
+		}
+		write(io, ")");
+	}
 }
 
 void write(stream& io, const basil::Location& loc) {
@@ -695,6 +1848,9 @@ void write(stream& io, const basil::Location& loc) {
 		case basil::SSA_CONSTANT:
 			write(io, basil::all_constants[loc.constant_index].name);
 			return;
+		case basil::SSA_CELL:
+			write(io, "cell ", loc.cell_index);
+			return;
 		default:
 			return;
 	}
@@ -17,7 +17,8 @@ namespace basil {
 		SSA_LOCAL,
 		SSA_IMMEDIATE,
 		SSA_CONSTANT,
-		SSA_LABEL
+		SSA_LABEL,
+		SSA_CELL // a list cell in the function's own frame
 	};
 
 	struct LocalInfo {
@@ -40,6 +41,7 @@ namespace basil {
 			i64 immediate;
 			u32 constant_index;
 			u32 label_index;
+			u32 cell_index;
 		};
 		LocationType type;
 
@@ -53,6 +55,40 @@ namespace basil {
 
 	class Function;
 
+	enum InsnKind {
+		INSN_LOAD,
+		INSN_STORE,
+		INSN_LOAD_PTR,
+		INSN_STORE_PTR,
+		INSN_ADDRESS,
+		INSN_ADD,
+		INSN_SUB,
+		INSN_MUL,
+		INSN_DIV,
+		INSN_REM,
+		INSN_AND,
+		INSN_OR,
+		INSN_XOR,
+		INSN_NOT,
+		INSN_EQUAL,
+		INSN_INEQUAL,
+		INSN_LESS,
+		INSN_LESS_EQUAL,
+		INSN_GREATER,
+		INSN_GREATER_EQUAL,
+		INSN_SELECT,
+		INSN_RET,
+		INSN_LOAD_ARGUMENT,
+		INSN_STORE_ARGUMENT,
+		INSN_CALL,
+		INSN_LABEL,
+		INSN_GOTO,
+		INSN_IF_ZERO,
+		INSN_IF_NONZERO,
+		INSN_IF_COMPARE,
+		INSN_PHI
+	};
+
 	class Insn {
 	protected:
 		Function* _func;
@@ -66,25 +102,77 @@ namespace basil {
 		virtual ~Insn();
 
 		Location loc();
+		virtual InsnKind kind() const = 0;
+		virtual void uses(vector<Location*>& locs); // locations read by this insn
+		virtual Location* def(); // local written by this insn, or null
 		virtual void emit() = 0;
 		virtual void format(stream& io) const = 0;
 	};
 
 	u32 ssa_find_label(const string& label);
 	u32 ssa_add_label(const string& label);
+	const string& ssa_label_name(u32 label);
 	u32 ssa_next_label();
 	Location ssa_next_local(const Type* t);
 	Location ssa_const(u32 label, const string& constant);
 	void ssa_emit_constants(Object& object);
+	void ssa_resolve_safepoints(const Object& object); // once it's loaded
+
+	// Basic blocks over a flat insn list, and the control flow graph between
+	// them. Blocks begin at labels and after branches. The entry block and
+	// any unreachable blocks have no immediate dominator.
+	struct Blocks {
+		vector<u32> starts;
+		vector<vector<u32>> succs, preds;
+		map<u32, u32> labels; // label -> block beginning with it
+		vector<u32> order; // reachable blocks, in reverse postorder
+		vector<i64> idom;
+		vector<vector<u32>> children; // dominator tree
+		vector<u32> dom_pre, dom_post; // dominator tree numbering
+		u32 num_insns;
+
+		u32 size() const;
+		u32 end(u32 block) const; // one past the block's last insn
+		bool reachable(u32 block) const;
+		bool dominates(u32 a, u32 b) const;
+	};
+
+	bool ssa_is_branch(InsnKind kind);
+	bool ssa_is_conditional(InsnKind kind);
+	InsnKind ssa_negate(InsnKind compare); // e.g. INSN_LESS -> INSN_GREATER_EQUAL
+	void ssa_find_blocks(const vector<Insn*>& insns, Blocks& blocks);
+
+	// Updates blocks for a new block, beginning with label, placed in front
+	// of loop header h and taking over the edge into it from e, the loop's
+	// only entry. If jump, block h - 1 now ends in a goto to the header.
+	void ssa_insert_preheader(Blocks& blocks, u32 h, u32 e, u32 label, bool jump);
+
+	enum Allocator {
+		STACK_ALLOCATOR, // one stack slot per local
+		LINEAR_ALLOCATOR // linear scan over liveness intervals
+	};
+
+	void ssa_allocator(Allocator allocator);
+
+	// Whether jumps within a function may use the short rel8 encoding.
+	void ssa_relax_jumps(bool relax);
+	u64 ssa_short_jumps(); // jumps encoded short so far
+	void ssa_inline_alloc(bool enabled);
+	u64 ssa_inline_allocs(); // list cells allocated without a call so far
+	u64 ssa_stack_cells(); // list cells placed in frames so far
 
 	class Function {
 		vector<Function*> _fns;
 		vector<Insn*> _insns;
-		i64 _stack;
-		vector<Location> _locals;
+		i64 _stack, _frame;
+		u32 _cells;
+		vector<Location> _locals, _roots; // locals the collector may read
+		vector<x64::Register> _saved;
 		map<u32, u32> _labels;
 		u32 _label;
 		Function(u32 label);
+		void allocate_stack();
+		void allocate_linear();
 	public:
 		Function(const string& label);
 		~Function();
@@ -95,8 +183,16 @@ namespace basil {
 		Location create_local(const Type* t);
 		Location create_local(const string& name, const Type* t);
 		Location next_local(const Location& loc);
+		Location create_cell(); // or none, if the frame already holds enough
 		Location add(Insn* insn);
+		void replace(u32 i, Insn* insn); // swaps in insn, keeping the old result
 		u32 label() const;
+		vector<Insn*>& insns();
+		void set_insns(const vector<Insn*>& insns); // adopts any new insns
+		const vector<Location>& locals() const;
+		const vector<Function*>& functions() const;
+		i64 frame() const; // bytes from rsp to the return address in the body
+		u32 layout(); // reorders blocks, returning how many branches it saved
 		void allocate();
 		void emit(Object& obj);
 		void format(stream& io) const;
@@ -110,6 +206,8 @@ namespace basil {
 		LoadInsn(Location src);
 
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
@@ -122,31 +220,55 @@ namespace basil {
 		StoreInsn(Location dest, Location src, bool init);
 
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
+		Location* def() override;
 		void format(stream& io) const override;
 	};	
 	
+	// The memory operand of a pointer load or store: the word at
+	// [base + index * scale + disp], where base is first replaced by the
+	// pointer stored at base + offset, for each offset in chain.
+	struct Indirect {
+		Location base, index; // index is SSA_NONE if unused
+		vector<i32> chain;
+		x64::Scale scale;
+		i32 disp;
+
+		Indirect(Location base, i32 disp);
+	};
+
 	class LoadPtrInsn : public Insn {
-		Location _src;
+		Indirect _src;
 		const Type* _type;
-		i32 _offset;
+		x64::Size _size;
 	protected:
 		Location lazy_loc() override;
 	public:
 		LoadPtrInsn(Location src, const Type* t, i32 offset);
+		LoadPtrInsn(const Indirect& src, const Type* t, x64::Size size); // zero-extends bytes
 
+		Indirect& src();
+		x64::Size size() const;
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override; // base, index
 		void format(stream& io) const override;
 	};
 
 	class StorePtrInsn : public Insn {
-		Location _dest, _src;
-		i32 _offset;
+		Indirect _dest;
+		Location _src;
 	protected:
 		Location lazy_loc() override;
 	public:
 		StorePtrInsn(Location dest, Location src, i32 offset);
+		StorePtrInsn(const Indirect& dest, Location src);
 
+		Indirect& dest();
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override; // base, src, index
 		void format(stream& io) const override;
 	};
 
@@ -159,6 +281,8 @@ namespace basil {
 		AddressInsn(Location src, const Type* t);
 
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
@@ -170,6 +294,7 @@ namespace basil {
 		BinaryInsn(const char* name, Location left, Location right);
 
 		void format(stream& io) const override;
+		void uses(vector<Location*>& locs) override;
 	};
 
 	class BinaryMathInsn : public BinaryInsn {
@@ -184,30 +309,35 @@ namespace basil {
 	public:
 		AddInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class SubInsn : public BinaryMathInsn {
 	public:
 		SubInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class MulInsn : public BinaryMathInsn {
 	public:
 		MulInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class DivInsn : public BinaryMathInsn {
 	public:
 		DivInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class RemInsn : public BinaryMathInsn {
 	public:
 		RemInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class BinaryLogicInsn : public BinaryInsn {
@@ -222,18 +352,21 @@ namespace basil {
 	public:
 		AndInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class OrInsn : public BinaryLogicInsn {
 	public:
 		OrInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class XorInsn : public BinaryLogicInsn {
 	public:
 		XorInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class NotInsn : public Insn {
@@ -244,6 +377,8 @@ namespace basil {
 		NotInsn(Location src);
 
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
@@ -259,12 +394,14 @@ namespace basil {
 	public:
 		EqualInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class InequalInsn : public BinaryEqualityInsn {
 	public:
 		InequalInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class BinaryRelationInsn : public BinaryInsn {
@@ -279,24 +416,28 @@ namespace basil {
 	public:
 		LessInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class LessEqualInsn : public BinaryRelationInsn {
 	public:
 		LessEqualInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class GreaterInsn : public BinaryRelationInsn {
 	public:
 		GreaterInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class GreaterEqualInsn : public BinaryRelationInsn {
 	public:
 		GreaterEqualInsn(Location left, Location right);
 		void emit() override;
+		InsnKind kind() const override;
 	};
 
 	class RetInsn : public Insn {
@@ -307,6 +448,8 @@ namespace basil {
 		RetInsn(Location src);
 
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
@@ -318,7 +461,9 @@ namespace basil {
 	public:
 		LoadArgumentInsn(u32 index, const Type* type);
 
+		u32 index() const;
 		void emit() override;
+		InsnKind kind() const override;
 		void format(stream& io) const override;
 	};
 
@@ -331,19 +476,29 @@ namespace basil {
 	public:
 		StoreArgumentInsn(Location src, u32 index, const Type* type);
 
+		u32 index() const;
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
 	class CallInsn : public Insn {
 		Location _fn;
 		const Type* _ret;
+		vector<Location> _live;
 	protected:
 		Location lazy_loc() override;
 	public:
 		CallInsn(Location fn, const Type* ret);
 
+		bool may_collect() const; // calls compiled code or an allocating native
+		void set_live(const vector<Location>& live); // heap pointers live across it
+		void safepoint(); // records what's live at the return address just emitted
+
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 
@@ -355,30 +510,114 @@ namespace basil {
 		Label(u32 label);
 
 		void emit() override;
+		InsnKind kind() const override;
+		u32 label() const;
 		void format(stream& io) const override;
 	};
 
-	class GotoInsn : public Insn {
-		u32 _label;
+	class BranchInsn : public Insn {
 	protected:
+		u32 _label;
 		Location lazy_loc() override;
+	public:
+		BranchInsn(u32 label);
+
+		u32 label() const;
+		void retarget(u32 label);
+	};
+
+	class GotoInsn : public BranchInsn {
 	public:
 		GotoInsn(u32 label);
 
 		void emit() override;
+		InsnKind kind() const override;
 		void format(stream& io) const override;
 	};
 
-	class IfZeroInsn : public Insn {
-		u32 _label;
+	class ConditionalBranchInsn : public BranchInsn {
+	protected:
 		Location _cond;
-		const Type* _result;
+	public:
+		ConditionalBranchInsn(u32 label, Location cond);
+
+		void uses(vector<Location*>& locs) override;
+	};
+
+	class IfZeroInsn : public ConditionalBranchInsn {
+	public:
+		IfZeroInsn(u32 label, Location cond);
+
+		void emit() override;
+		InsnKind kind() const override;
+		void format(stream& io) const override;
+	};
+
+	class IfNonZeroInsn : public ConditionalBranchInsn {
+	public:
+		IfNonZeroInsn(u32 label, Location cond);
+
+		void emit() override;
+		InsnKind kind() const override;
+		void format(stream& io) const override;
+	};
+
+	// Jumps if a comparison between two values holds. Stands in for a 
+	// compare whose only use is a conditional branch right after it.
+	class IfCompareInsn : public BranchInsn {
+		InsnKind _compare;
+		Location _left, _right;
+	public:
+		IfCompareInsn(u32 label, InsnKind compare, Location left, Location right);
+
+		InsnKind compare() const;
+		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
+		void format(stream& io) const override;
+	};
+
+	// Picks between two values without branching: the result is if_true
+	// if a comparison between two values holds, and if_false otherwise.
+	class SelectInsn : public Insn {
+		InsnKind _compare;
+		Location _left, _right, _if_true, _if_false;
+		const Type* _type;
 	protected:
 		Location lazy_loc() override;
 	public:
-		IfZeroInsn(u32 label, Location cond);
+		SelectInsn(Location cond, Location if_true, Location if_false, 
+			const Type* type); // selects if_true when cond is nonzero
+		SelectInsn(InsnKind compare, Location left, Location right, 
+			Location if_true, Location if_false, const Type* type);
+
+		InsnKind compare() const;
+		const Type* type() const;
+		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override; // left, right, if_true, if_false
+		void format(stream& io) const override;
+	};
+
+	// Merges the values a local has coming from each predecessor block.
+	// Phis are removed by the optimizer before code generation.
+	class PhiInsn : public Insn {
+		Location _dest;
+		vector<u32> _preds; // label beginning each argument's predecessor
+		vector<Location> _args;
+	protected:
+		Location lazy_loc() override;
+	public:
+		PhiInsn(Location dest);
 
+		void add(u32 pred, Location arg);
+		void retarget(u32 from, u32 to); // renames a predecessor
+		u32 size() const;
+		u32 pred(u32 i) const;
+		const Location& arg(u32 i) const;
 		void emit() override;
+		InsnKind kind() const override;
+		void uses(vector<Location*>& locs) override;
 		void format(stream& io) const override;
 	};
 }
@@ -58,6 +58,34 @@ namespace basil {
     write(io, "[", _element, "]");
   }
 
+  ArrayType::ArrayType(const Type* element):
+    Type(element->hash() ^ 2478629411356201841ul), _element(element) {}
+
+	bool ArrayType::concrete() const {
+		return _element->concrete();
+	}
+
+	const Type* ArrayType::concretify() const {
+		return find<ArrayType>(_element->concretify());
+	}
+
+  const Type* ArrayType::element() const {
+    return _element;
+  }
+
+  TypeKind ArrayType::kind() const {
+    return KIND_ARRAY;
+  }
+
+  bool ArrayType::operator==(const Type& other) const {
+    return other.kind() == kind() && 
+      ((const ArrayType&) other).element() == element();
+  }
+
+  void ArrayType::format(stream& io) const {
+    write(io, "array<", _element, ">");
+  }
+
   u64 set_hash(const set<const Type*>& members) {
     u64 h = 6530804687830202173ul;
     for (const Type* t : members) h ^= t->hash();
@@ -359,6 +387,13 @@ namespace basil {
 			return find<ListType>(elt);
 		}
 
+		if (a->kind() == KIND_ARRAY && b->kind() == KIND_ARRAY) {
+			const Type* elt = unify(((const ArrayType*)a)->element(),
+				((const ArrayType*)b)->element());
+			if (!elt) return nullptr;
+			return find<ArrayType>(elt);
+		}
+
 		if (a->kind() == KIND_PRODUCT && b->kind() == KIND_PRODUCT) {
 			vector<const Type*> members;
 			if (((const ProductType*)a)->count() != ((const ProductType*)b)->count())
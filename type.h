@@ -19,7 +19,8 @@ namespace basil {
     KIND_FUNCTION = GC_KIND_FLAG | 3,
     KIND_ALIAS = GC_KIND_FLAG | 4,
     KIND_MACRO = GC_KIND_FLAG | 5,
-		KIND_RUNTIME = GC_KIND_FLAG | 6
+		KIND_RUNTIME = GC_KIND_FLAG | 6,
+		KIND_ARRAY = GC_KIND_FLAG | 7
   };
 
   class Type {
@@ -59,6 +60,21 @@ namespace basil {
     void format(stream& io) const override;
   };
 
+  // Arrays are only built at runtime. Their elements are stored unboxed
+  // and contiguously, so indexing one takes constant time.
+  class ArrayType : public Type {
+    const Type* _element;
+  public:
+    ArrayType(const Type* element);
+
+    const Type* element() const;
+		bool concrete() const override;
+		const Type* concretify() const override;
+    TypeKind kind() const override;
+    bool operator==(const Type& other) const override;
+    void format(stream& io) const override;
+  };
+
   class SumType : public Type {
     set<const Type*> _members;
   public:
@@ -0,0 +1,76 @@
+#ifndef BASIL_BITSET_H
+#define BASIL_BITSET_H
+
+#include "defs.h"
+#include "vec.h"
+
+class bitset {
+    vector<u64> words;
+    u32 _size;
+public:
+    bitset(): _size(0) {}
+
+    bitset(u32 size): _size(size) {
+        for (u32 i = 0; i < (size + 63) / 64; i ++) words.push(0);
+    }
+
+    u32 size() const {
+        return _size;
+    }
+
+    bool contains(u32 i) const {
+        return words[i / 64] >> (i % 64) & 1;
+    }
+
+    void insert(u32 i) {
+        words[i / 64] |= 1ul << (i % 64);
+    }
+
+    void erase(u32 i) {
+        words[i / 64] &= ~(1ul << (i % 64));
+    }
+
+    void clear() {
+        for (u64& w : words) w = 0;
+    }
+
+    // returns true if any bits were added
+    bool operator|=(const bitset& other) {
+        bool changed = false;
+        for (u32 i = 0; i < words.size(); i ++) {
+            u64 w = words[i] | other.words[i];
+            if (w != words[i]) changed = true;
+            words[i] = w;
+        }
+        return changed;
+    }
+
+    bitset& operator-=(const bitset& other) {
+        for (u32 i = 0; i < words.size(); i ++) words[i] &= ~other.words[i];
+        return *this;
+    }
+
+    bool operator==(const bitset& other) const {
+        for (u32 i = 0; i < words.size(); i ++)
+            if (words[i] != other.words[i]) return false;
+        return true;
+    }
+
+    bool operator!=(const bitset& other) const {
+        return !(*this == other);
+    }
+
+    // calls fn with the index of every set bit, in increasing order
+    template<typename F>
+    void each(const F& fn) const {
+        for (u32 i = 0; i < words.size(); i ++) {
+            u64 w = words[i];
+            while (w) {
+                fn(i * 64 + __builtin_ctzl(w));
+                w &= w - 1;
+            }
+        }
+    }
+};
+
+#endif
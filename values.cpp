@@ -992,6 +992,8 @@ namespace basil {
   }
 
   Value char_at(const Value& str, const Value& idx) {
+    if (str.is_runtime() && ((const RuntimeType*)str.type())->base()->kind() == KIND_ARRAY)
+      return new ASTIndex(str.loc(), lower(str).get_runtime(), lower(idx).get_runtime());
     if (str.is_runtime() || idx.is_runtime()) {
       vector<ASTNode*> args;
       Value s = lower(str), i = lower(idx);
@@ -1013,6 +1015,152 @@ namespace basil {
     return Value(i64(str.get_string()[idx.get_int()]));
   }
 
+  Value to_array(const Value& list) {
+    if (list.is_error()) return error();
+    if (!list.is_runtime() && !list.is_list()) {
+      err(list.loc(), "Expected list, given '", list.type(), "'.");
+      return error();
+    }
+    return new ASTToArray(list.loc(), lower(list).get_runtime());
+  }
+
+  // Arrays are only ever built at runtime, so any other value isn't one.
+  static bool expect_array(const Value& array) {
+    if (array.is_runtime() && ((const RuntimeType*)array.type())->base()->kind() == KIND_ARRAY)
+      return true;
+    if (!array.is_error()) err(array.loc(), "Expected array, given '", array.type(), "'.");
+    return false;
+  }
+
+  Value to_list(const Value& array) {
+    if (!expect_array(array)) return error();
+    return new ASTToList(array.loc(), lower(array).get_runtime());
+  }
+
+  Value set_at(const Value& array, const Value& idx, const Value& value) {
+    if (!expect_array(array) || idx.is_error() || value.is_error()) return error();
+    return new ASTSetIndex(array.loc(), lower(array).get_runtime(), 
+      lower(idx).get_runtime(), lower(value).get_runtime());
+  }
+
+  Value push(const Value& array, const Value& value) {
+    if (!expect_array(array) || value.is_error()) return error();
+    return new ASTPush(array.loc(), lower(array).get_runtime(), lower(value).get_runtime());
+  }
+
+  static const char* REDUCTION_NAMES[] = { nullptr, "sum", "min", "max" };
+
+  // Checks that list can be reduced, and finds its ints: the elements of
+  // a list, or the characters of a string.
+  static bool reduction_ints(const Value& list, vector<i64>& ints) {
+    if (list.is_string()) {
+      const string& str = list.get_string();
+      for (u32 i = 0; i < str.size(); i ++) ints.push(str[i]);
+      return true;
+    }
+    if (!list.is_list() && !list.is_void()) {
+      err(list.loc(), "Expected list or string, given '", list.type(), "'.");
+      return false;
+    }
+    for (const Value& v : to_vector(list)) {
+      if (!v.is_int()) {
+        err(v.loc(), "Expected integer element, given '", v.type(), "'.");
+        return false;
+      }
+      ints.push(v.get_int());
+    }
+    return true;
+  }
+
+  // Calls the list or string version of a reduction native, by the type
+  // of list.
+  static Value native_reduction(const char* op, const Value& list, const Value& arg) {
+    Value l = lower(list), a = arg.is_void() ? arg : lower(arg);
+    bool str = ((const RuntimeType*)l.type())->base()->concretify() == STRING;
+    vector<ASTNode*> args;
+    vector<const Type*> arg_types;
+    args.push(l.get_runtime());
+    arg_types.push(str ? STRING : find<ListType>(INT));
+    if (!a.is_void()) {
+      args.push(a.get_runtime());
+      arg_types.push(INT);
+    }
+    return new ASTNativeCall(list.loc(), string(str ? "_str_" : "_list_") + op, INT, args, arg_types);
+  }
+
+  Value reduce(const Value& list, Reduction op) {
+    if (list.is_error()) return error();
+    if (list.is_runtime()) return native_reduction(REDUCTION_NAMES[op], list, Value(VOID));
+    vector<i64> ints;
+    if (!reduction_ints(list, ints)) return error();
+    if (ints.size() == 0) return Value(i64(0));
+    i64 result = op == REDUCE_SUM ? 0 : ints[0];
+    for (i64 i : ints) {
+      if (op == REDUCE_SUM) result = i64(u64(result) + u64(i));
+      else if (op == REDUCE_MIN ? i < result : i > result) result = i;
+    }
+    return Value(result);
+  }
+
+  Value count(const Value& list, const Value& item) {
+    if (list.is_error() || item.is_error()) return error();
+    if (list.is_runtime() || item.is_runtime()) {
+      if (!list.is_runtime() && !list.is_string() && !list.is_list() && !list.is_void()) {
+        err(list.loc(), "Expected list or string, given '", list.type(), "'.");
+        return error();
+      }
+      return native_reduction("count", list, item);
+    }
+    vector<i64> ints;
+    if (!reduction_ints(list, ints)) return error();
+    if (!item.is_int()) {
+      err(item.loc(), "Expected integer, given '", item.type(), "'.");
+      return error();
+    }
+    i64 result = 0;
+    for (i64 i : ints) result += i == item.get_int();
+    return Value(result);
+  }
+
+  Value dot(const Value& a, const Value& b) {
+    if (a.is_error() || b.is_error()) return error();
+    if (a.is_runtime() || b.is_runtime()) {
+      vector<ASTNode*> args;
+      Value la = lower(a), lb = lower(b);
+      args.push(la.get_runtime());
+      args.push(lb.get_runtime());
+      vector<const Type*> arg_types;
+      arg_types.push(find<ListType>(INT));
+      arg_types.push(find<ListType>(INT));
+      return new ASTNativeCall(a.loc(), "_list_dot", INT, args, arg_types);
+    }
+    vector<i64> as, bs;
+    if (a.is_string() || b.is_string()) {
+      err((a.is_string() ? a : b).loc(), "Expected list, given '", STRING, "'.");
+      return error();
+    }
+    if (!reduction_ints(a, as) || !reduction_ints(b, bs)) return error();
+    u64 result = 0;
+    for (u32 i = 0; i < as.size() && i < bs.size(); i ++) result += u64(as[i]) * u64(bs[i]);
+    return Value(i64(result));
+  }
+
+  static u64 _native_reductions = 0;
+
+  u64 native_reductions() {
+    return _native_reductions;
+  }
+
+  // Whether reducing with fn is one of the reductions we have natives
+  // for, and list is a list of ints only known at runtime.
+  static Reduction native_reduce(const Value& list, const Value& fn) {
+    if (!list.is_runtime() || !fn.is_function()) return REDUCE_NONE;
+    const Type* t = ((const RuntimeType*)list.type())->base()->concretify();
+    if (t->kind() != KIND_LIST || ((const ListType*)t)->element()->concretify() != INT) 
+      return REDUCE_NONE;
+    return find_reduction(fn.get_function());
+  }
+
   Value type_of(const Value& v) {
     return Value(v.type(), TYPE);
   }
@@ -1144,6 +1292,15 @@ namespace basil {
 				find_calls(fn, env, fn.body(), visited);
 			}
 			if (fn.recursive()) runtime_call = true;
+
+			// std/list's reduce, with an operator we have a kernel for
+			if (runtime_call && argc == 2 && is_std_reduce(fn)) {
+				Reduction op = native_reduce(arg.get_product()[0], arg.get_product()[1]);
+				if (op != REDUCE_NONE) {
+					_native_reductions ++;
+					return reduce(arg.get_product()[0], op);
+				}
+			}
 			
 			if (runtime_call) {
 				vector<const Type*> argts;
@@ -266,7 +266,22 @@ namespace basil {
   Value length(const Value& str);
 
   Value read_line();
-  Value char_at(const Value& str, const Value& idx);
+  Value char_at(const Value& str, const Value& idx); // or an array's element
+  Value to_array(const Value& list);
+  Value to_list(const Value& array);
+  Value set_at(const Value& array, const Value& idx, const Value& value);
+  Value push(const Value& array, const Value& value);
+
+  // Reductions over lists of ints, or the characters of strings, run
+  // natively when the list is only known at runtime.
+  enum Reduction {
+    REDUCE_NONE, REDUCE_SUM, REDUCE_MIN, REDUCE_MAX
+  };
+
+  Value reduce(const Value& list, Reduction op);
+  Value count(const Value& list, const Value& item);
+  Value dot(const Value& a, const Value& b);
+  u64 native_reductions(); // calls to reduce replaced so far
 
   Value type_of(const Value& v);
 